@@ -87,6 +87,19 @@ public:
     return energy;
   }
 
+  /**
+   * Set the amount of stored energy, like when resuming a saved simulation.
+   *
+   * @param energy_stored The amount of energy in nJ, at most the maximum.
+   */
+  void set_energy_stored(double const energy_stored)
+  {
+    assert(energy_stored >= 0 && energy_stored <= maximum_energy);
+
+    energy = energy_stored;
+    update_voltage();
+  }
+
   /**
    * @return The maximum amount of energy (nJ) this capacitor can store.
    */
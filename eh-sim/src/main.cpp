@@ -1,5 +1,11 @@
 #include <argagg/argagg.hpp>
+#include <thumbulator/machine.hpp>
+#include <thumbulator/program.hpp>
+#include <thumbulator/sampler.hpp>
+#include <thumbulator/semihosting.hpp>
+#include <thumbulator/tracer.hpp>
 
+#include <cstdio>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -9,7 +15,9 @@
 #include "scheme/clank.hpp"
 #include "scheme/parametric.hpp"
 
+#include "sampling.hpp"
 #include "simulate.hpp"
+#include "stats.hpp"
 #include "voltage_trace.hpp"
 
 void print_usage(std::ostream &stream, argagg::parser const &arguments)
@@ -59,7 +67,21 @@ int main(int argc, char *argv[])
       {"scheme", {"--scheme"}, "the checkpointing scheme to use", 1},
       {"tau_B", {"--tau-b"}, "the backup period for the parametric scheme", 1},
       {"binary", {"-b", "--binary"}, "path to application binary", 1},
-      {"output", {"-o", "--output"}, "output file", 1}}};
+      {"output", {"-o", "--output"}, "output file", 1},
+      {"trace", {"--trace"}, "write a binary instruction trace to a file", 1},
+      {"profile", {"--profile"}, "write sampled call stacks to a file, folded for flame graphs", 1},
+      {"profile_period", {"--profile-period"}, "cycles between call stack samples", 1},
+      {"slice", {"--slice-cycles"},
+          "most cycles between energy updates, 0 to update after every instruction", 1},
+      {"uart", {"--uart-output"}, "write what the program sends to the UART to a file", 1},
+      {"semihosting", {"--semihosting"}, "serve semihosting calls made with bkpt 0xAB", 0},
+      {"save_state", {"--save-state"}, "save the simulation state to a file", 1},
+      {"save_cycle", {"--save-state-cycle"}, "CPU cycles to run before saving the state", 1},
+      {"resume", {"--resume-state"}, "resume from a state saved with the same scheme", 1},
+      {"functional", {"--sample-functional-cycles"},
+          "cycles to fast-forward between detailed windows, 0 to not sample", 1},
+      {"warmup", {"--sample-warmup-cycles"}, "cycles to warm up before a detailed window", 1},
+      {"detailed", {"--sample-detailed-cycles"}, "least cycles of a detailed window", 1}}};
 
   try {
     auto const options = arguments.parse(argc, argv);
@@ -70,38 +92,98 @@ int main(int argc, char *argv[])
 
     validate(options);
 
-    auto const path_to_binary = options["binary"];
+    thumbulator::program_image const program(options["binary"].as<std::string>().c_str());
     bool always_harvest = options["harvest"].as<int>(1) == 1;
+    auto const slice_cycles = options["slice"].as<uint64_t>(0);
 
     auto const path_to_voltage_trace = options["voltages"];
     std::chrono::milliseconds sampling_period(options["rate"]);
 
-    std::unique_ptr<ehsim::eh_scheme> scheme = nullptr;
+    // the machine flushes its UART output on destruction, so the file has to outlive it
+    std::unique_ptr<FILE, int (*)(FILE *)> uart_output(nullptr, std::fclose);
+    thumbulator::machine machine;
+
+    std::unique_ptr<thumbulator::instruction_tracer> tracer;
+    if(options["trace"].count() > 0) {
+      tracer.reset(new thumbulator::instruction_tracer(options["trace"].as<std::string>().c_str()));
+      machine.tracer = tracer.get();
+    }
+
+    std::unique_ptr<thumbulator::pc_sampler> sampler;
+    if(options["profile"].count() > 0) {
+      auto const period = options["profile_period"].as<uint64_t>(10000);
+      sampler.reset(new thumbulator::pc_sampler(period));
+      thumbulator::start_sampling(&machine, sampler.get());
+    }
+
+    if(options["uart"].count() > 0) {
+      uart_output.reset(std::fopen(options["uart"].as<std::string>().c_str(), "wb"));
+      if(uart_output == nullptr) {
+        throw std::runtime_error("Could not create UART output file.");
+      }
+      machine.uart.write_to(uart_output.get());
+    }
+
+    std::unique_ptr<thumbulator::semihosting_host> semihosting;
+    if(options["semihosting"]) {
+      semihosting.reset(new thumbulator::semihosting_host(options["binary"].as<std::string>()));
+      machine.semihosting = semihosting.get();
+    }
+
+    ehsim::voltage_trace power(path_to_voltage_trace, sampling_period);
+
+    auto const resume_path = options["resume"].as<std::string>("");
+    auto const save_path = options["save_state"].as<std::string>("");
+    ehsim::state_files states{};
+    states.resume_from = resume_path.empty() ? nullptr : resume_path.c_str();
+    states.save_to = save_path.empty() ? nullptr : save_path.c_str();
+    states.save_cycle = options["save_cycle"].as<uint64_t>(0);
+
+    ehsim::sampling_options sampling{};
+    sampling.functional_cycles = options["functional"].as<uint64_t>(0);
+    sampling.warmup_cycles = options["warmup"].as<uint64_t>(0);
+    sampling.detailed_cycles = options["detailed"].as<uint64_t>(0);
+
+    ehsim::stats_bundle stats{};
     auto const scheme_select = options["scheme"].as<std::string>("bec");
     if(scheme_select == "bec") {
-      scheme = std::make_unique<ehsim::backup_every_cycle>();
+      ehsim::backup_every_cycle scheme;
+      stats = ehsim::simulate(
+          &machine, program, power, &scheme, always_harvest, slice_cycles, states, sampling);
     } else if(scheme_select == "odab") {
       throw std::runtime_error("ODAB is no longer supported.");
     } else if(scheme_select == "magic") {
       throw std::runtime_error("Magic is no longer supported.");
     } else if(scheme_select == "clank") {
-      scheme = std::make_unique<ehsim::clank>();
+      ehsim::clank scheme(&machine);
+      stats = ehsim::simulate(
+          &machine, program, power, &scheme, always_harvest, slice_cycles, states, sampling);
     } else if(scheme_select == "parametric") {
       auto const tau_b = options["tau_B"].as<int>(1000);
-      scheme = std::make_unique<ehsim::parametric>(tau_b);
+      ehsim::parametric scheme(&machine, tau_b);
+      stats = ehsim::simulate(
+          &machine, program, power, &scheme, always_harvest, slice_cycles, states, sampling);
     } else {
       throw std::runtime_error("Unknown scheme selected.");
     }
 
-    ehsim::voltage_trace power(path_to_voltage_trace, sampling_period);
-
-    auto const stats = ehsim::simulate(path_to_binary, power, scheme.get(), always_harvest);
-
     std::cout << "CPU instructions executed: " << stats.cpu.instruction_count << "\n";
     std::cout << "CPU time (cycles): " << stats.cpu.cycle_count << "\n";
     std::cout << "Total time (ns): " << stats.system.time.count() << "\n";
     std::cout << "Energy harvested (J): " << stats.system.energy_harvested * 1e-9 << "\n";
     std::cout << "Energy remaining (J): " << stats.system.energy_remaining * 1e-9 << "\n";
+    if(sampling.functional_cycles != 0) {
+      ehsim::print_sampled_estimates(std::cout, stats);
+    }
+
+    if(sampler != nullptr) {
+      auto *const folded = std::fopen(options["profile"].as<std::string>().c_str(), "w");
+      if(folded == nullptr) {
+        throw std::runtime_error("Could not create profile file.");
+      }
+      sampler->write_folded(folded, program);
+      std::fclose(folded);
+    }
 
     std::string output_file_name(scheme_select + ".csv");
     if(options["output"].count() > 0) {
@@ -0,0 +1,84 @@
+#include "sampling.hpp"
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+namespace ehsim {
+
+// The quantile of the normal distribution for 95% confidence intervals
+#define CONFIDENCE_95_Z 1.96
+
+sampled_estimate estimate(stats_bundle const &stats, double (*metric)(active_stats const &))
+{
+  double sum = 0.0;
+  double sum_of_squares = 0.0;
+
+  sampled_estimate result{};
+  size_t first_period = 0;
+  for(auto const periods : stats.sampling.window_periods) {
+    double window_sum = 0.0;
+    size_t defined = 0;
+    for(size_t i = first_period; i < first_period + periods; ++i) {
+      auto const value = metric(stats.models[i]);
+      if(std::isfinite(value)) {
+        window_sum += value;
+        defined++;
+      }
+    }
+    first_period += periods;
+
+    if(defined != 0) {
+      auto const sample = window_sum / defined;
+      sum += sample;
+      sum_of_squares += sample * sample;
+      result.samples++;
+    }
+  }
+
+  if(result.samples == 0) {
+    result.mean = std::numeric_limits<double>::quiet_NaN();
+    result.half_width = std::numeric_limits<double>::infinity();
+    return result;
+  }
+
+  auto const n = static_cast<double>(result.samples);
+  result.mean = sum / n;
+  if(result.samples < 2) {
+    result.half_width = std::numeric_limits<double>::infinity();
+  } else {
+    auto const variance = std::max(0.0, (sum_of_squares - n * result.mean * result.mean) / (n - 1));
+    result.half_width = CONFIDENCE_95_Z * std::sqrt(variance / n);
+  }
+
+  return result;
+}
+
+static void print_estimate(std::ostream &out, char const *name, sampled_estimate const &metric)
+{
+  out << name << ": " << metric.mean << " +/- " << metric.half_width << " (95% CI, "
+      << metric.samples << " windows)\n";
+}
+
+void print_sampled_estimates(std::ostream &out, stats_bundle const &stats)
+{
+  out << "Sampled windows: " << stats.sampling.window_periods.size() << "\n";
+  out << "Functional instructions executed: " << stats.sampling.functional_instructions << "\n";
+  out << "Functional time (cycles): " << stats.sampling.functional_cycles << "\n";
+
+  print_estimate(out, "Progress per active period", estimate(stats, [](active_stats const &s) {
+    return s.progress;
+  }));
+  print_estimate(out, "Estimated progress per active period",
+      estimate(stats, [](active_stats const &s) { return s.eh_progress; }));
+  print_estimate(out, "Backups per active period", estimate(stats, [](active_stats const &s) {
+    return static_cast<double>(s.num_backups);
+  }));
+  print_estimate(out, "Cycles per active period", estimate(stats, [](active_stats const &s) {
+    return static_cast<double>(s.time_total);
+  }));
+}
+}
@@ -0,0 +1,80 @@
+#ifndef EH_SIM_SAMPLING_HPP
+#define EH_SIM_SAMPLING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+namespace ehsim {
+
+struct active_stats;
+struct stats_bundle;
+
+/**
+ * How a simulation alternates between functional and detailed simulation, SMARTS-style.
+ *
+ * Functional simulation only runs the application, without energy accounting, memory policy
+ * hooks, or time passing. Detailed windows run the whole energy harvesting model and end at the
+ * first power off after running for detailed_cycles, so they hold whole active periods. The
+ * application is fast-forwarded by functional_cycles at the next power on, after the restore.
+ */
+struct sampling_options {
+  /**
+   * CPU cycles to run functionally between detailed windows, 0 to simulate everything in detail.
+   */
+  uint64_t functional_cycles = 0u;
+
+  /**
+   * CPU cycles to simulate in detail after a fast-forward before the window starts, so that the
+   * scheme settles from being backed up at an arbitrary point. Active periods that end during the
+   * warm-up are left out of the estimates.
+   */
+  uint64_t warmup_cycles = 0u;
+
+  /**
+   * The least CPU cycles a detailed window runs for, after the warm-up.
+   */
+  uint64_t detailed_cycles = 0u;
+};
+
+/**
+ * The estimate of a metric of the active periods from the detailed windows of a simulation.
+ *
+ * The mean of the metric over the active periods of a window is one sample, so the confidence
+ * interval holds as long as windows are far enough apart to be independent.
+ */
+struct sampled_estimate {
+  /**
+   * The mean of the samples.
+   */
+  double mean = 0.0;
+
+  /**
+   * Half of the width of the 95% confidence interval around the mean, infinite without at least
+   * two samples.
+   */
+  double half_width = 0.0;
+
+  /**
+   * The number of windows where the metric is defined.
+   */
+  size_t samples = 0u;
+};
+
+/**
+ * Estimate a metric of the active periods from the detailed windows of a simulation.
+ *
+ * @param stats The statistics of a sampled simulation.
+ * @param metric The metric of an active period, active periods where it is not finite are left
+ * out.
+ */
+sampled_estimate estimate(stats_bundle const &stats, double (*metric)(active_stats const &));
+
+/**
+ * Print the estimates of the usual metrics of a sampled simulation, with their confidence
+ * intervals.
+ */
+void print_sampled_estimates(std::ostream &out, stats_bundle const &stats);
+}
+
+#endif //EH_SIM_SAMPLING_HPP
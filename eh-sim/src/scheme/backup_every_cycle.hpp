@@ -6,14 +6,19 @@
 #include "scheme/eh_model.hpp"
 #include "capacitor.hpp"
 
+#include <thumbulator/state_file.hpp>
+
 namespace ehsim {
 
+// The version of the state backup_every_cycle saves, to increment when what it saves changes
+#define BEC_STATE_VERSION 1
+
 /**
  * Based on Architecture Exploration for Ambient Energy Harvesting Nonvolatile Processors.
  *
  * See the data relating to the BEC scheme.
  */
-class backup_every_cycle : public eh_scheme {
+class backup_every_cycle final : public eh_scheme {
 public:
   backup_every_cycle() : battery(NVP_CAPACITANCE, MEMENTOS_MAX_CAPACITOR_VOLTAGE, MEMENTOS_MAX_CURRENT)
   {
@@ -40,11 +45,12 @@ public:
     return required_energy;
   }
 
-  void execute_instruction(stats_bundle *stats) override
+  void execute_instructions(stats_bundle *stats, uint64_t count) override
   {
-    battery.consume_energy(NVP_INSTRUCTION_ENERGY);
+    auto const instruction_energy = NVP_INSTRUCTION_ENERGY * count;
+    battery.consume_energy(instruction_energy);
 
-    stats->models.back().energy_for_instructions += NVP_INSTRUCTION_ENERGY;
+    stats->models.back().energy_for_instructions += instruction_energy;
   }
 
   bool is_active(stats_bundle *stats) override
@@ -97,6 +103,26 @@ public:
         NVP_BEC_OMEGA_B, NVP_BEC_SIGMA_B, NVP_BEC_A_B);
   }
 
+  void assume_backed_up(stats_bundle *stats) override
+  {
+    // arch/app state is all non-volatile
+    last_backup_cycle = stats->cpu.cycle_count;
+  }
+
+  void save_state(FILE *out) const override
+  {
+    thumbulator::write_state_tag(out, "bec", BEC_STATE_VERSION);
+    thumbulator::write_state_value<double>(out, battery.energy_stored());
+    thumbulator::write_state_value<uint64_t>(out, last_backup_cycle);
+  }
+
+  void load_state(FILE *in) override
+  {
+    thumbulator::expect_state_tag(in, "bec", BEC_STATE_VERSION);
+    battery.set_energy_stored(thumbulator::read_state_value<double>(in));
+    last_backup_cycle = thumbulator::read_state_value<uint64_t>(in);
+  }
+
 private:
   capacitor battery;
 
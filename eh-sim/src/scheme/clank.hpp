@@ -3,33 +3,44 @@
 
 #include "scheme/eh_scheme.hpp"
 #include "scheme/data_sheet.hpp"
+#include "scheme/eh_model.hpp"
 #include "capacitor.hpp"
 #include "stats.hpp"
 
+#include <thumbulator/machine.hpp>
 #include <thumbulator/memory.hpp>
+#include <thumbulator/memory_policy.hpp>
+#include <thumbulator/run.hpp>
+#include <thumbulator/state_file.hpp>
 
+#include <algorithm>
 #include <set>
 #include <unordered_map>
-#include <thumbulator/cpu.hpp>
 
 namespace ehsim {
 
+// The version of the state clank saves, to increment when what it saves changes
+#define CLANK_STATE_VERSION 1
+
 /**
  * Based on Clank: Architectural Support for Intermittent Computation.
  *
  * Only implements the read- and write-first buffers.
  */
-class clank : public eh_scheme {
+class clank final : public eh_scheme {
 public:
   /**
    * Construct a default clank configuration.
+   *
+   * @param machine The machine to track the memory accesses of.
    */
-  clank() : clank(8, 8, 8000)
+  explicit clank(thumbulator::machine *machine) : clank(machine, 8, 8, 8000)
   {
   }
 
-  clank(size_t rf_entries, size_t wf_entries, int watchdog_period)
-      : battery(NVP_CAPACITANCE, MEMENTOS_MAX_CAPACITOR_VOLTAGE, MEMENTOS_MAX_CURRENT)
+  clank(thumbulator::machine *machine, size_t rf_entries, size_t wf_entries, int watchdog_period)
+      : machine(machine)
+      , battery(NVP_CAPACITANCE, MEMENTOS_MAX_CAPACITOR_VOLTAGE, MEMENTOS_MAX_CURRENT)
       , WATCHDOG_PERIOD(watchdog_period)
       , READFIRST_ENTRIES(rf_entries)
       , WRITEFIRST_ENTRIES(wf_entries)
@@ -39,11 +50,7 @@ public:
     assert(READFIRST_ENTRIES >= 1);
     assert(WRITEFIRST_ENTRIES >= 0);
 
-    thumbulator::ram_load_hook = [this](
-        uint32_t address, uint32_t data) -> uint32_t { return this->process_read(address, data); };
-
-    thumbulator::ram_store_hook = [this](uint32_t address, uint32_t last_value,
-        uint32_t value) -> uint32_t { return this->process_store(address, last_value, value); };
+    thumbulator::use_memory_policy(machine, this);
   }
 
   capacitor &get_battery() override
@@ -61,7 +68,7 @@ public:
     return battery.maximum_energy_stored();
   }
 
-  void execute_instruction(stats_bundle *stats) override
+  void execute_instructions(stats_bundle *stats, uint64_t /* count */) override
   {
     auto const elapsed_cycles = stats->cpu.cycle_count - last_tick;
     last_tick = stats->cpu.cycle_count;
@@ -98,6 +105,18 @@ public:
     return idempotent_violation;
   }
 
+  uint64_t cycles_until_decision(stats_bundle * /* stats */) const override
+  {
+    // idempotency violations end the run early through thumbulator::request_stop
+    auto const spare_energy = battery.energy_stored() - MAX_BACKUP_ENERGY;
+    if(progress_watchdog <= 0 || spare_energy < CLANK_INSTRUCTION_ENERGY) {
+      return 1;
+    }
+
+    auto const cycles = static_cast<uint64_t>(spare_energy / CLANK_INSTRUCTION_ENERGY);
+    return std::min<uint64_t>(progress_watchdog, cycles);
+  }
+
   uint64_t backup(stats_bundle *stats) override
   {
     auto &active_stats = stats->models.back();
@@ -107,7 +126,7 @@ public:
     last_backup_cycle = stats->cpu.cycle_count;
 
     // save architectural state
-    architectural_state = thumbulator::cpu;
+    architectural_state = machine->cpu;
 
     // reset the watchdog
     progress_watchdog = WATCHDOG_PERIOD;
@@ -129,7 +148,7 @@ public:
 
     // restore saved architectural state
     thumbulator::cpu_reset();
-    thumbulator::cpu = architectural_state;
+    machine->cpu = architectural_state;
 
     stats->models.back().energy_for_restore = CLANK_RESTORE_ENERGY;
     battery.consume_energy(CLANK_RESTORE_ENERGY);
@@ -144,7 +163,77 @@ public:
         CLANK_OMEGA_B, CLANK_SIGMA_B, CLANK_A_B);
   }
 
+  void assume_backed_up(stats_bundle *stats) override
+  {
+    last_backup_cycle = stats->cpu.cycle_count;
+    architectural_state = machine->cpu;
+
+    progress_watchdog = WATCHDOG_PERIOD;
+    clear_buffers();
+    idempotent_violation = false;
+  }
+
+  void save_state(FILE *out) const override
+  {
+    thumbulator::write_state_tag(out, "clank", CLANK_STATE_VERSION);
+    thumbulator::write_state_value<double>(out, battery.energy_stored());
+    thumbulator::write_state_value<uint64_t>(out, last_backup_cycle);
+    thumbulator::write_state_value<uint64_t>(out, last_tick);
+    thumbulator::write_cpu_state(out, architectural_state);
+    thumbulator::write_state_flag(out, active);
+    thumbulator::write_state_value<int32_t>(out, progress_watchdog);
+    thumbulator::write_state_flag(out, idempotent_violation);
+    save_buffer(out, readfirst_buffer);
+    save_buffer(out, writefirst_buffer);
+  }
+
+  void load_state(FILE *in) override
+  {
+    thumbulator::expect_state_tag(in, "clank", CLANK_STATE_VERSION);
+    battery.set_energy_stored(thumbulator::read_state_value<double>(in));
+    last_backup_cycle = thumbulator::read_state_value<uint64_t>(in);
+    last_tick = thumbulator::read_state_value<uint64_t>(in);
+    architectural_state = thumbulator::read_cpu_state(in);
+    active = thumbulator::read_state_flag(in);
+    progress_watchdog = thumbulator::read_state_value<int32_t>(in);
+    idempotent_violation = thumbulator::read_state_flag(in);
+    load_buffer(in, &readfirst_buffer);
+    load_buffer(in, &writefirst_buffer);
+  }
+
+  /**
+   * Memory policy hook for loads from RAM, see thumbulator::no_memory_policy.
+   */
+  uint32_t ram_load(uint32_t address, uint32_t value)
+  {
+    detect_violation(address, operation::read, value, value);
+
+    if(idempotent_violation && battery.energy_stored() < MAX_BACKUP_ENERGY) {
+      power_off();
+    }
+
+    return value;
+  }
+
+  /**
+   * Memory policy hook for stores to RAM, see thumbulator::no_memory_policy.
+   */
+  uint32_t ram_store(uint32_t address, uint32_t old_value, uint32_t value)
+  {
+    detect_violation(address, operation::write, old_value, value);
+
+    if(idempotent_violation && battery.energy_stored() < MAX_BACKUP_ENERGY) {
+      power_off();
+
+      return old_value;
+    }
+
+    return value;
+  }
+
 private:
+  thumbulator::machine *machine;
+
   capacitor battery;
 
   uint64_t last_backup_cycle = 0u;
@@ -183,6 +272,23 @@ private:
     clear_buffers();
   }
 
+  static void save_buffer(FILE *out, std::set<uint32_t> const &buffer)
+  {
+    thumbulator::write_state_value(out, static_cast<uint32_t>(buffer.size()));
+    for(auto const address : buffer) {
+      thumbulator::write_state_value(out, address);
+    }
+  }
+
+  static void load_buffer(FILE *in, std::set<uint32_t> *buffer)
+  {
+    buffer->clear();
+    auto const size = thumbulator::read_state_value<uint32_t>(in);
+    for(uint32_t i = 0; i < size; ++i) {
+      buffer->insert(thumbulator::read_state_value<uint32_t>(in));
+    }
+  }
+
   bool try_insert(std::set<uint32_t> *buffer, uint32_t const address, size_t const max_buffer_size)
   {
     if(buffer->size() < max_buffer_size) {
@@ -224,30 +330,11 @@ private:
       // idempotent violation - write to read-dominated address
       idempotent_violation = true;
     }
-  }
-
-  uint32_t process_read(uint32_t address, uint32_t value)
-  {
-    detect_violation(address, operation::read, value, value);
-
-    if(idempotent_violation && battery.energy_stored() < MAX_BACKUP_ENERGY) {
-      power_off();
-    }
-
-    return value;
-  }
 
-  uint32_t process_store(uint32_t address, uint32_t old_value, uint32_t value)
-  {
-    detect_violation(address, operation::write, old_value, value);
-
-    if(idempotent_violation && battery.energy_stored() < MAX_BACKUP_ENERGY) {
-      power_off();
-
-      return old_value;
+    if(idempotent_violation) {
+      // the simulation has to decide whether to back up after this instruction
+      thumbulator::request_stop();
     }
-
-    return value;
   }
 };
 }
@@ -1,6 +1,9 @@
 #ifndef EH_SIM_SCHEME_HPP
 #define EH_SIM_SCHEME_HPP
 
+#include <cstdint>
+#include <cstdio>
+
 namespace ehsim {
 
 class capacitor;
@@ -18,17 +21,63 @@ public:
 
   virtual double min_energy_to_power_on(stats_bundle *stats) = 0;
 
-  virtual void execute_instruction(stats_bundle *stats) = 0;
+  /**
+   * Charge the energy of the instructions executed since the last call.
+   *
+   * The simulation runs the application one instruction at a time, or with slices until the
+   * scheme may have to decide, see cycles_until_decision, then charges all of its instructions at
+   * once, after adding them to the statistics of the CPU.
+   *
+   * @param count Number of instructions executed.
+   */
+  virtual void execute_instructions(stats_bundle *stats, uint64_t count) = 0;
 
   virtual bool is_active(stats_bundle *stats) = 0;
 
   virtual bool will_backup(stats_bundle *stats) const = 0;
 
+  /**
+   * The number of cycles the application can run for before the scheme may have to back up or
+   * power off, so that it can run without checking after every instruction.
+   *
+   * The run ends at the first instruction that reaches the number of cycles, or earlier when the
+   * scheme calls thumbulator::request_stop from a memory policy hook. Schemes that must check
+   * after every instruction keep the default of 1.
+   */
+  virtual uint64_t cycles_until_decision(stats_bundle * /* stats */) const
+  {
+    return 1;
+  }
+
   virtual uint64_t backup(stats_bundle *stats) = 0;
 
   virtual uint64_t restore(stats_bundle *stats) = 0;
 
   virtual double estimate_progress(eh_model_parameters const &) const = 0;
+
+  /**
+   * Take the current state of the application as backed up, at no cost.
+   *
+   * Sampled simulation calls this after fast-forwarding the application outside of the scheme,
+   * so that the next restore resumes from where the application got to.
+   */
+  virtual void assume_backed_up(stats_bundle *stats) = 0;
+
+  /**
+   * Write the state of the scheme, including its battery, to a state file.
+   *
+   * @throws std::runtime_error If the file cannot be written.
+   */
+  virtual void save_state(FILE *out) const = 0;
+
+  /**
+   * Replace the state of the scheme with the one written by save_state.
+   *
+   * The parameters of the scheme are kept, so a state can be resumed with other parameters.
+   *
+   * @throws std::runtime_error If the file cannot be read or holds the state of another scheme.
+   */
+  virtual void load_state(FILE *in) = 0;
 };
 }
 
@@ -31,7 +31,7 @@ public:
     return MEMENTOS_CPU_FREQUENCY;
   }
 
-  void execute_instruction(stats_bundle *stats) override
+  void execute_instructions(stats_bundle *stats, uint64_t /* count */) override
   {
   }
 
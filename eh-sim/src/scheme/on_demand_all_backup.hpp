@@ -29,11 +29,12 @@ public:
     return NVP_CPU_FREQUENCY;
   }
 
-  void execute_instruction(stats_bundle *stats) override
+  void execute_instructions(stats_bundle *stats, uint64_t count) override
   {
-    battery.consume_energy(NVP_INSTRUCTION_ENERGY);
+    auto const instruction_energy = NVP_INSTRUCTION_ENERGY * count;
+    battery.consume_energy(instruction_energy);
 
-    stats->models.back().energy_for_instructions += NVP_INSTRUCTION_ENERGY;
+    stats->models.back().energy_for_instructions += instruction_energy;
   }
 
   bool is_active(stats_bundle *stats) override
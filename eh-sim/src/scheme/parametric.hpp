@@ -3,27 +3,29 @@
 
 #include "scheme/eh_scheme.hpp"
 #include "scheme/data_sheet.hpp"
+#include "scheme/eh_model.hpp"
 #include "capacitor.hpp"
 #include "stats.hpp"
 
+#include <thumbulator/machine.hpp>
 #include <thumbulator/memory.hpp>
+#include <thumbulator/state_file.hpp>
 
-#include <unordered_map>
+#include <algorithm>
 
 namespace ehsim {
 
-class parametric : public eh_scheme {
+// The version of the state parametric saves, to increment when what it saves changes
+#define PARAMETRIC_STATE_VERSION 1
+
+class parametric final : public eh_scheme {
 public:
-  explicit parametric(int backup_period)
-      : battery(MEMENTOS_CAPACITANCE, MEMENTOS_MAX_CAPACITOR_VOLTAGE, MEMENTOS_MAX_CURRENT)
+  parametric(thumbulator::machine *machine, int backup_period)
+      : machine(machine)
+      , battery(MEMENTOS_CAPACITANCE, MEMENTOS_MAX_CAPACITOR_VOLTAGE, MEMENTOS_MAX_CURRENT)
       , BACKUP_PERIOD(backup_period)
       , countdown_to_backup(BACKUP_PERIOD)
   {
-    thumbulator::ram_load_hook = [this](
-        uint32_t address, uint32_t data) -> uint32_t { return this->process_read(address, data); };
-
-    thumbulator::ram_store_hook = [this](uint32_t address, uint32_t last_value,
-        uint32_t value) -> uint32_t { return this->process_store(address, last_value, value); };
   }
 
   capacitor &get_battery() override
@@ -41,10 +43,11 @@ public:
     return battery.maximum_energy_stored();
   }
 
-  void execute_instruction(stats_bundle *stats) override
+  void execute_instructions(stats_bundle *stats, uint64_t count) override
   {
-    battery.consume_energy(CLANK_INSTRUCTION_ENERGY);
-    stats->models.back().energy_for_instructions += CLANK_INSTRUCTION_ENERGY;
+    auto const instruction_energy = CLANK_INSTRUCTION_ENERGY * count;
+    battery.consume_energy(instruction_energy);
+    stats->models.back().energy_for_instructions += instruction_energy;
 
     countdown_to_backup -= stats->cpu.cycle_count - last_tick;
     last_tick = stats->cpu.cycle_count;
@@ -75,6 +78,20 @@ public:
     return countdown_to_backup <= 0;
   }
 
+  uint64_t cycles_until_decision(stats_bundle * /* stats */) const override
+  {
+    // every instruction takes at least a cycle and dirties at most 9 words, with push {r0-r7, lr}
+    auto const worst_instruction_energy =
+        CLANK_INSTRUCTION_ENERGY + (9 * 4 * CORTEX_M0PLUS_ENERGY_FLASH);
+    auto const spare_energy = battery.energy_stored() - calculate_backup_energy();
+    if(countdown_to_backup <= 0 || spare_energy < worst_instruction_energy) {
+      return 1;
+    }
+
+    auto const instructions = static_cast<uint64_t>(spare_energy / worst_instruction_energy);
+    return std::min<uint64_t>(countdown_to_backup, instructions);
+  }
+
   uint64_t backup(stats_bundle *stats) override
   {
     auto &active_stats = stats->models.back();
@@ -91,9 +108,9 @@ public:
     // reset countdown
     countdown_to_backup = BACKUP_PERIOD;
     // save architectural state
-    architectural_state = thumbulator::cpu;
+    architectural_state = machine->cpu;
     // save application state
-    auto const num_stores = write_back();
+    auto const num_stores = commit_stores();
 
     auto const backup_time = CLANK_BACKUP_ARCH_TIME + (num_stores * CLANK_MEMORY_TIME);
     active_stats.bytes_application += static_cast<double>(num_stores * 4) / tau_B;
@@ -108,7 +125,7 @@ public:
 
     // restore saved architectural state
     thumbulator::cpu_reset();
-    thumbulator::cpu = architectural_state;
+    machine->cpu = architectural_state;
 
     stats->models.back().energy_for_restore = CLANK_RESTORE_ENERGY;
     battery.consume_energy(CLANK_RESTORE_ENERGY);
@@ -122,7 +139,43 @@ public:
         PARAMETRIC_SIGMA_R, PARAMETRIC_A_R, PARAMETRIC_OMEGA_B, PARAMETRIC_SIGMA_B, PARAMETRIC_A_B);
   }
 
+  void assume_backed_up(stats_bundle *stats) override
+  {
+    last_backup_cycle = stats->cpu.cycle_count;
+    countdown_to_backup = BACKUP_PERIOD;
+
+    architectural_state = machine->cpu;
+    commit_stores();
+  }
+
+  void save_state(FILE *out) const override
+  {
+    // the stores since the last backup are undone from the saved pages of RAM, in the machine state
+    thumbulator::write_state_tag(out, "parametric", PARAMETRIC_STATE_VERSION);
+    thumbulator::write_state_value<double>(out, battery.energy_stored());
+    thumbulator::write_state_flag(out, active);
+    thumbulator::write_state_value<uint64_t>(out, last_backup_cycle);
+    thumbulator::write_state_value<uint64_t>(out, last_tick);
+    thumbulator::write_state_value<int32_t>(out, countdown_to_backup);
+    thumbulator::write_cpu_state(out, architectural_state);
+    thumbulator::write_state_flag(out, application_state_saved);
+  }
+
+  void load_state(FILE *in) override
+  {
+    thumbulator::expect_state_tag(in, "parametric", PARAMETRIC_STATE_VERSION);
+    battery.set_energy_stored(thumbulator::read_state_value<double>(in));
+    active = thumbulator::read_state_flag(in);
+    last_backup_cycle = thumbulator::read_state_value<uint64_t>(in);
+    last_tick = thumbulator::read_state_value<uint64_t>(in);
+    countdown_to_backup = thumbulator::read_state_value<int32_t>(in);
+    architectural_state = thumbulator::read_cpu_state(in);
+    application_state_saved = thumbulator::read_state_flag(in);
+  }
+
 private:
+  thumbulator::machine *machine;
+
   capacitor battery;
   bool active = false;
 
@@ -133,57 +186,45 @@ private:
   int countdown_to_backup;
 
   thumbulator::cpu_state architectural_state{};
-  std::unordered_map<uint32_t, uint32_t> stores;
+  // whether RAM was saved, so that the stores since the last backup can be undone
+  bool application_state_saved = false;
 
   void power_on()
   {
     active = true;
+
+    if(!application_state_saved) {
+      commit_stores();
+      application_state_saved = true;
+    }
   }
 
   void power_off()
   {
     active = false;
-    stores.clear();
+
+    // stores since the last backup are lost, the words RAM dirtied tell which there were
+    if(machine->ram.dirty_word_count() != 0) {
+      machine->ram.restore_pages();
+      machine->ram.clear_dirty();
+    }
   }
 
   double calculate_backup_energy() const
   {
-    return CLANK_BACKUP_ARCH_ENERGY + (stores.size() * 4 * CORTEX_M0PLUS_ENERGY_FLASH);
+    auto const num_stores = machine->ram.dirty_word_count();
+    return CLANK_BACKUP_ARCH_ENERGY + (num_stores * 4 * CORTEX_M0PLUS_ENERGY_FLASH);
   }
 
-  size_t write_back()
+  size_t commit_stores()
   {
-    auto const count = stores.size();
+    auto const count = machine->ram.dirty_word_count();
 
-    for(auto const &store : stores) {
-      thumbulator::RAM[(store.first & RAM_ADDRESS_MASK) >> 2] = store.second;
-    }
-    stores.clear();
+    machine->ram.save_pages();
+    machine->ram.clear_dirty();
 
     return count;
   }
-
-  uint32_t process_read(uint32_t address, uint32_t value)
-  {
-    auto it = stores.find(address);
-    if(it != stores.end()) {
-      return it->second;
-    }
-
-    return value;
-  }
-
-  uint32_t process_store(uint32_t address, uint32_t old_value, uint32_t value)
-  {
-    auto it = stores.find(address);
-    if(it != stores.end()) {
-      it->second = value;
-    } else {
-      stores.emplace(address, value);
-    }
-
-    return old_value;
-  }
 };
 }
 
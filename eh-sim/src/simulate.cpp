@@ -1,36 +1,37 @@
 #include "simulate.hpp"
 
 #include <thumbulator/cpu.hpp>
+#include <thumbulator/machine.hpp>
 #include <thumbulator/memory.hpp>
-
+#include <thumbulator/memory_policy.hpp>
+#include <thumbulator/profile.hpp>
+#include <thumbulator/program.hpp>
+#include <thumbulator/run.hpp>
+#include <thumbulator/state_file.hpp>
+
+#include "scheme/backup_every_cycle.hpp"
+#include "scheme/clank.hpp"
 #include "scheme/eh_scheme.hpp"
+#include "scheme/parametric.hpp"
 #include "capacitor.hpp"
+#include "sampling.hpp"
 #include "stats.hpp"
 #include "voltage_trace.hpp"
 
-#include <cstring>
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
 
 namespace ehsim {
 
-void load_program(char const *file_name)
-{
-  std::FILE *fd = std::fopen(file_name, "r");
-  if(fd == nullptr) {
-    throw std::runtime_error("Could not open binary file.\n");
-  }
-
-  std::fread(&thumbulator::FLASH_MEMORY, sizeof(uint32_t),
-      sizeof(thumbulator::FLASH_MEMORY) / sizeof(uint32_t), fd);
-  std::fclose(fd);
-}
-
-void initialize_system(char const *binary_file)
+void initialize_system(thumbulator::machine *machine, thumbulator::program_image const &program)
 {
   // Reset memory, then load program to memory
-  std::memset(thumbulator::RAM, 0, sizeof(thumbulator::RAM));
-  std::memset(thumbulator::FLASH_MEMORY, 0, sizeof(thumbulator::FLASH_MEMORY));
-  load_program(binary_file);
+  machine->ram.clear();
+  program.load(machine);
 
   // Initialize CPU state
   thumbulator::cpu_reset();
@@ -40,35 +41,41 @@ void initialize_system(char const *binary_file)
 }
 
 /**
- * Execute one instruction.
+ * Run the application until the scheme may have to back up or power off.
  *
- * @return Number of cycles to execute that instruction.
+ * The application runs in slices of at most slice_cycles cycles, or one instruction at a time
+ * for 0. Slices end at the same instructions as the run, so its result does not depend on their
+ * size.
+ *
+ * @param decision_cycles The cycles to run for, see eh_scheme::cycles_until_decision.
+ *
+ * @return The instructions and cycles executed.
  */
-uint32_t step_cpu()
+thumbulator::run_result run_until_decision(uint64_t decision_cycles, uint64_t slice_cycles)
 {
-  thumbulator::BRANCH_WAS_TAKEN = false;
+  thumbulator::run_result run{0, 0, thumbulator::STOP_NONE};
+  while(run.cycles < decision_cycles) {
+    thumbulator::run_limits limits{};
+    limits.cycles = decision_cycles - run.cycles;
+    limits.instructions = UINT64_MAX;
+    if(slice_cycles == 0) {
+      limits.instructions = 1;
+    } else {
+      limits.cycles = std::min(limits.cycles, slice_cycles);
+    }
 
-  if((thumbulator::cpu_get_pc() & 0x1) == 0) {
-    printf("Oh no! Current PC: 0x%08X\n", thumbulator::cpu.gpr[15]);
-    throw std::runtime_error("PC moved out of thumb mode.");
-  }
+    auto const slice = thumbulator::run_until(limits);
+    run.instructions += slice.instructions;
+    run.cycles += slice.cycles;
+    run.reason = slice.reason;
 
-  // fetch
-  uint16_t instruction;
-  thumbulator::fetch_instruction(thumbulator::cpu_get_pc() - 0x4, &instruction);
-  // decode
-  auto const decoded = thumbulator::decode(instruction);
-  // execute, memory, and write-back
-  uint32_t const instruction_ticks = thumbulator::exmemwb(instruction, &decoded);
-
-  // advance to next PC
-  if(!thumbulator::BRANCH_WAS_TAKEN) {
-    thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + 0x2);
-  } else {
-    thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + 0x4);
+    // stops requested by the scheme, like clank's idempotency violations, need a decision now
+    if(slice.reason == thumbulator::STOP_REQUESTED || slice.reason == thumbulator::STOP_EXIT) {
+      break;
+    }
   }
 
-  return instruction_ticks;
+  return run;
 }
 
 std::chrono::nanoseconds get_time(uint64_t const cycle_count, uint32_t const frequency)
@@ -144,18 +151,193 @@ double update_energy_harvested(uint64_t elapsed_cycles,
   return actual_harvested_energy;
 }
 
-stats_bundle simulate(char const *binary_file,
+/**
+ * The state of the simulation loop besides the machine, the scheme, and the statistics.
+ */
+struct loop_state {
+  bool was_active;
+  uint64_t active_start;
+
+  // where the simulation is in the voltage trace
+  double env_voltage;
+  double charging_rate;
+  std::chrono::nanoseconds next_charge_time;
+};
+
+// The version of the state of the simulation, to increment when what is saved changes
+#define EH_SIM_STATE_VERSION 1
+
+// Energies, voltages, and ratios are saved as IEEE 754 doubles
+static_assert(std::numeric_limits<double>::is_iec559 && sizeof(double) == 8,
+    "State files need 64-bit IEEE 754 doubles");
+
+using state_file = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+state_file open_state_file(char const *path, char const *mode)
+{
+  state_file file(std::fopen(path, mode), std::fclose);
+  if(!file) {
+    throw std::runtime_error(std::string("Could not open state file ") + path + ".");
+  }
+
+  return file;
+}
+
+void write_active_stats(FILE *out, active_stats const &period)
+{
+  uint64_t const times[] = {period.time_between_backups, period.time_for_backups,
+      period.time_for_restores, period.time_forward_progress, period.time_for_instructions,
+      period.time_total};
+  for(auto const time : times) {
+    thumbulator::write_state_value<uint64_t>(out, time);
+  }
+
+  thumbulator::write_state_value<int32_t>(out, period.num_backups);
+
+  double const values[] = {period.energy_start, period.energy_consumed, period.energy_for_backups,
+      period.energy_charged, period.energy_for_restore, period.energy_for_instructions,
+      period.energy_forward_progress, period.bytes_application, period.progress,
+      period.eh_progress};
+  for(auto const value : values) {
+    thumbulator::write_state_value<double>(out, value);
+  }
+}
+
+active_stats read_active_stats(FILE *in)
+{
+  active_stats period{};
+  uint64_t *const times[] = {&period.time_between_backups, &period.time_for_backups,
+      &period.time_for_restores, &period.time_forward_progress, &period.time_for_instructions,
+      &period.time_total};
+  for(auto *time : times) {
+    *time = thumbulator::read_state_value<uint64_t>(in);
+  }
+
+  period.num_backups = thumbulator::read_state_value<int32_t>(in);
+
+  double *const values[] = {&period.energy_start, &period.energy_consumed,
+      &period.energy_for_backups, &period.energy_charged, &period.energy_for_restore,
+      &period.energy_for_instructions, &period.energy_forward_progress, &period.bytes_application,
+      &period.progress, &period.eh_progress};
+  for(auto *value : values) {
+    *value = thumbulator::read_state_value<double>(in);
+  }
+
+  return period;
+}
+
+/**
+ * Save the machine, then the simulation, then the scheme.
+ *
+ * Every value is written on its own with a fixed width, so that the layout of the structures
+ * does not leak into the file.
+ */
+void save_simulation(char const *path,
+    loop_state const &loop,
+    stats_bundle const &stats,
+    eh_scheme const &scheme)
+{
+  auto out = open_state_file(path, "wb");
+
+  thumbulator::save_state(out.get());
+
+  thumbulator::write_state_tag(out.get(), "eh-sim", EH_SIM_STATE_VERSION);
+  thumbulator::write_state_flag(out.get(), loop.was_active);
+  thumbulator::write_state_value<uint64_t>(out.get(), loop.active_start);
+  thumbulator::write_state_value<double>(out.get(), loop.env_voltage);
+  thumbulator::write_state_value<double>(out.get(), loop.charging_rate);
+  thumbulator::write_state_value<int64_t>(out.get(), loop.next_charge_time.count());
+
+  thumbulator::write_state_value<int64_t>(out.get(), stats.system.time.count());
+  thumbulator::write_state_value<double>(out.get(), stats.system.energy_harvested);
+  thumbulator::write_state_value<double>(out.get(), stats.system.energy_remaining);
+  thumbulator::write_state_value<uint64_t>(out.get(), stats.cpu.instruction_count);
+  thumbulator::write_state_value<uint64_t>(out.get(), stats.cpu.cycle_count);
+
+  thumbulator::write_state_value<uint64_t>(out.get(), stats.models.size());
+  for(auto const &active_period : stats.models) {
+    write_active_stats(out.get(), active_period);
+  }
+
+  scheme.save_state(out.get());
+
+  // buffered writes can still fail
+  if(std::fclose(out.release()) != 0) {
+    throw std::runtime_error(std::string("Could not write state file ") + path + ".");
+  }
+}
+
+/**
+ * Resume the simulation saved by save_simulation.
+ */
+loop_state resume_simulation(char const *path, stats_bundle *stats, eh_scheme *scheme)
+{
+  auto in = open_state_file(path, "rb");
+
+  thumbulator::load_state(in.get());
+
+  thumbulator::expect_state_tag(in.get(), "eh-sim", EH_SIM_STATE_VERSION);
+  loop_state loop{};
+  loop.was_active = thumbulator::read_state_flag(in.get());
+  loop.active_start = thumbulator::read_state_value<uint64_t>(in.get());
+  loop.env_voltage = thumbulator::read_state_value<double>(in.get());
+  loop.charging_rate = thumbulator::read_state_value<double>(in.get());
+  loop.next_charge_time =
+      std::chrono::nanoseconds(thumbulator::read_state_value<int64_t>(in.get()));
+
+  stats->system.time = std::chrono::nanoseconds(thumbulator::read_state_value<int64_t>(in.get()));
+  stats->system.energy_harvested = thumbulator::read_state_value<double>(in.get());
+  stats->system.energy_remaining = thumbulator::read_state_value<double>(in.get());
+  stats->cpu.instruction_count = thumbulator::read_state_value<uint64_t>(in.get());
+  stats->cpu.cycle_count = thumbulator::read_state_value<uint64_t>(in.get());
+
+  auto const active_periods = thumbulator::read_state_value<uint64_t>(in.get());
+  stats->models.clear();
+  for(uint64_t i = 0; i < active_periods; ++i) {
+    stats->models.push_back(read_active_stats(in.get()));
+  }
+
+  scheme->load_state(in.get());
+
+  return loop;
+}
+
+/**
+ * Run the application functionally, with the memory policy bypassed and no energy accounting.
+ */
+void fast_forward(thumbulator::machine *machine, uint64_t cycles, stats_bundle *stats)
+{
+  thumbulator::memory_policy_bypass bypass(machine);
+
+  thumbulator::run_limits limits{};
+  limits.cycles = cycles;
+  limits.instructions = UINT64_MAX;
+  auto const run = thumbulator::run_until(limits);
+
+  stats->sampling.functional_instructions += run.instructions;
+  stats->sampling.functional_cycles += run.cycles;
+}
+
+template <typename Scheme>
+stats_bundle simulate(thumbulator::machine *machine,
+    thumbulator::program_image const &program,
     ehsim::voltage_trace const &power,
-    eh_scheme *scheme,
-    bool always_harvest)
+    Scheme *scheme,
+    bool always_harvest,
+    uint64_t slice_cycles,
+    state_files const &states,
+    sampling_options const &sampling)
 {
   using namespace std::chrono_literals;
 
+  // the simulator operates on the machine bound to this thread
+  thumbulator::machine_binding binding(machine);
+
   // stats tracking
   stats_bundle stats{};
   stats.system.time = 0ns;
 
-  initialize_system(binary_file);
+  initialize_system(machine, program);
 
   // energy harvesting
   auto &battery = scheme->get_battery();
@@ -178,9 +360,38 @@ stats_bundle simulate(char const *binary_file,
   uint64_t active_start = 0u;
   int no_progress_counter = 0;
 
+  if(states.resume_from != nullptr) {
+    auto const loop = resume_simulation(states.resume_from, &stats, scheme);
+    was_active = loop.was_active;
+    active_start = loop.active_start;
+    env_voltage = loop.env_voltage;
+    charging_rate = loop.charging_rate;
+    next_charge_time = loop.next_charge_time;
+    std::cout << "resumed at cycle " << stats.cpu.cycle_count << "\n";
+  }
+  auto state_saved = states.save_to == nullptr;
+
+  // the detailed window of a sampled simulation, which starts after the last fast-forward
+  auto const sampled = sampling.functional_cycles != 0;
+  auto window_start = stats.cpu.cycle_count;
+  auto window_first_period = stats.models.size();
+  auto fast_forward_pending = false;
+
   // Execute the program
   // Simulation will terminate when it executes insn == 0xBFAA
-  while(!thumbulator::EXIT_INSTRUCTION_ENCOUNTERED) {
+  while(!machine->exit_instruction_encountered) {
+    if(!state_saved && stats.cpu.cycle_count >= states.save_cycle) {
+      loop_state loop{};
+      loop.was_active = was_active;
+      loop.active_start = active_start;
+      loop.env_voltage = env_voltage;
+      loop.charging_rate = charging_rate;
+      loop.next_charge_time = next_charge_time;
+      save_simulation(states.save_to, loop, stats, *scheme);
+      state_saved = true;
+      std::cout << "saved state at cycle " << stats.cpu.cycle_count << "\n";
+    }
+
     uint64_t elapsed_cycles = 0;
 
     if(scheme->is_active(&stats)) {
@@ -202,19 +413,34 @@ stats_bundle simulate(char const *binary_file,
 
           stats.models.back().time_for_restores += restore_time;
         }
+
+        if(fast_forward_pending) {
+          fast_forward(machine, sampling.functional_cycles, &stats);
+          scheme->assume_backed_up(&stats);
+          fast_forward_pending = false;
+          window_start = stats.cpu.cycle_count;
+
+          if(machine->exit_instruction_encountered) {
+            // the period did not run in detail, so it is no sample
+            window_first_period = stats.models.size();
+            break;
+          }
+        }
       }
 
       was_active = true;
 
-      auto const instruction_ticks = step_cpu();
-
-      stats.cpu.instruction_count++;
-      stats.cpu.cycle_count += instruction_ticks;
-      stats.models.back().time_for_instructions += instruction_ticks;
-      elapsed_cycles += instruction_ticks;
+      // Without slices every instruction is charged on its own, like the reference model, as
+      // charging many at once rounds the energy and the time differently
+      auto const decision_cycles = slice_cycles == 0 ? 1 : scheme->cycles_until_decision(&stats);
+      auto const run = run_until_decision(decision_cycles, slice_cycles);
+      stats.cpu.instruction_count += run.instructions;
+      stats.cpu.cycle_count += run.cycles;
+      stats.models.back().time_for_instructions += run.cycles;
+      elapsed_cycles += run.cycles;
 
       // consume energy for execution
-      scheme->execute_instruction(&stats);
+      scheme->execute_instructions(&stats, run.instructions);
 
       if(scheme->will_backup(&stats)) {
         auto const backup_time = scheme->backup(&stats);
@@ -266,6 +492,18 @@ stats_bundle simulate(char const *binary_file,
         active_period.progress =
             active_period.energy_forward_progress / active_period.energy_consumed;
         active_period.eh_progress = scheme->estimate_progress(eh_model_parameters(active_period));
+
+        if(sampled) {
+          auto const window_cycles = stats.cpu.cycle_count - window_start;
+          if(window_cycles < sampling.warmup_cycles) {
+            // the scheme is still warming up from the fast-forward, so the window starts later
+            window_first_period = stats.models.size();
+          } else if(window_cycles - sampling.warmup_cycles >= sampling.detailed_cycles) {
+            stats.sampling.window_periods.push_back(stats.models.size() - window_first_period);
+            window_first_period = stats.models.size();
+            fast_forward_pending = true;
+          }
+        }
       }
 
       was_active = false;
@@ -303,6 +541,14 @@ stats_bundle simulate(char const *binary_file,
   }
   std::cout << "done\n";
 
+  if(!state_saved) {
+    std::cerr << "The application finished before the state was saved.\n";
+  }
+
+#if defined(THUMBULATOR_PROFILE)
+  thumbulator::print_profile(stdout);
+#endif
+
   auto &active_period = stats.models.back();
   active_period.time_total = active_period.time_for_instructions + active_period.time_for_backups +
                              active_period.time_for_restores;
@@ -316,6 +562,37 @@ stats_bundle simulate(char const *binary_file,
 
   stats.system.energy_remaining = battery.energy_stored();
 
+  if(sampled && stats.models.size() > window_first_period) {
+    stats.sampling.window_periods.push_back(stats.models.size() - window_first_period);
+  }
+
   return stats;
 }
+
+template stats_bundle simulate(thumbulator::machine *,
+    thumbulator::program_image const &,
+    ehsim::voltage_trace const &,
+    backup_every_cycle *,
+    bool,
+    uint64_t,
+    state_files const &,
+    sampling_options const &);
+
+template stats_bundle simulate(thumbulator::machine *,
+    thumbulator::program_image const &,
+    ehsim::voltage_trace const &,
+    clank *,
+    bool,
+    uint64_t,
+    state_files const &,
+    sampling_options const &);
+
+template stats_bundle simulate(thumbulator::machine *,
+    thumbulator::program_image const &,
+    ehsim::voltage_trace const &,
+    parametric *,
+    bool,
+    uint64_t,
+    state_files const &,
+    sampling_options const &);
 }
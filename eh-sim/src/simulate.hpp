@@ -4,26 +4,72 @@
 #include <chrono>
 #include <cstdint>
 
+namespace thumbulator {
+struct machine;
+class program_image;
+}
+
 namespace ehsim {
 
-class eh_scheme;
+struct sampling_options;
 struct stats_bundle;
 class voltage_trace;
 
+/**
+ * The state files of a simulation, so that simulations sharing a prefix simulate it only once.
+ */
+struct state_files {
+  /**
+   * A state saved by a simulation of the same application and power supply with the same kind of
+   * scheme to resume from, or nullptr to start from the beginning of the application.
+   */
+  char const *resume_from = nullptr;
+
+  /**
+   * Where to save the state, or nullptr to not save it.
+   */
+  char const *save_to = nullptr;
+
+  /**
+   * The state is saved at the first energy update after the CPU ran for this many cycles.
+   */
+  uint64_t save_cycle = 0u;
+};
+
 /**
  * Simulate an energy harvesting device.
  *
- * @param binary_file The path to the application binary file.
+ * The simulation is instantiated for each energy harvesting scheme, so the calls into the scheme
+ * are resolved at compile time.
+ *
+ * @param machine The machine to run the application on, bound to the calling thread meanwhile.
+ * @param program The application binary, loaded into the machine at the start.
  * @param power The power supply over time.
  * @param scheme The energy harvesting scheme to use.
  * @param always_harvest true to harvest always, false to harvest during off periods only.
+ * @param slice_cycles The most cycles to run the application for at once, or 0 to run it one
+ * instruction at a time and update energy and time after every instruction, like the reference
+ * model. Otherwise energy and time are updated where the scheme may have to back up or power off,
+ * see eh_scheme::cycles_until_decision, so the results are the same for any slice size, but can
+ * differ from the reference in the last digits.
+ * @param states The states to resume from and to save.
+ * @param sampling How to alternate between functional and detailed simulation.
  *
  * @return The statistics tracked during the simulation.
+ *
+ * @throws thumbulator::simulation_fault If the application does something the simulator cannot
+ * continue from, like accessing memory out of range.
+ * @throws std::runtime_error If a state file cannot be used.
  */
-stats_bundle simulate(char const *binary_file,
+template <typename Scheme>
+stats_bundle simulate(thumbulator::machine *machine,
+    thumbulator::program_image const &program,
     ehsim::voltage_trace const &power,
-    eh_scheme *scheme,
-    bool always_harvest);
+    Scheme *scheme,
+    bool always_harvest,
+    uint64_t slice_cycles,
+    state_files const &states,
+    sampling_options const &sampling);
 }
 
 #endif //EH_SIM_SIMULATE_HPP
@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include <deque>
+#include <vector>
 
 namespace ehsim {
 struct cpu_stats {
@@ -165,6 +166,23 @@ struct eh_model_parameters {
   bool const do_restore;
 };
 
+struct sampling_stats {
+  /**
+   * Number of instructions executed functionally, between the detailed windows.
+   */
+  uint64_t functional_instructions = 0u;
+
+  /**
+   * Number of cycles executed functionally, between the detailed windows.
+   */
+  uint64_t functional_cycles = 0u;
+
+  /**
+   * The number of active periods in each detailed window, which follow each other in models.
+   */
+  std::vector<size_t> window_periods;
+};
+
 struct stats_bundle {
   system_stats system;
   cpu_stats cpu;
@@ -173,6 +191,11 @@ struct stats_bundle {
    * Model of multiple active periods.
    */
   std::deque<active_stats> models;
+
+  /**
+   * The split between functional and detailed simulation, for sampled simulations.
+   */
+  sampling_stats sampling;
 };
 }
 
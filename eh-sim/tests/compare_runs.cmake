@@ -0,0 +1,77 @@
+# Checks that eh-sim run one instruction at a time gives the results of the reference model, that
+# it gives the same results however it slices a run, and when it resumes a run from a saved state.
+#
+# The reference results were written by the eh-sim this simulator started from, on the same inputs.
+#
+# cmake -DEH_SIM=<eh-sim> -DWRITE_INPUTS=<writer> -DSCHEME=<scheme> -DREFERENCE_DIR=<dir>
+#   -DWORK_DIR=<dir> [-DPROFILED=ON] -P compare_runs.cmake
+#
+# PROFILED tells that eh-sim prints an execution profile, which the reference output does not have.
+
+cmake_minimum_required(VERSION 3.1 FATAL_ERROR)
+
+foreach(variable EH_SIM WRITE_INPUTS SCHEME REFERENCE_DIR WORK_DIR)
+  if(NOT DEFINED ${variable})
+    message(FATAL_ERROR "${variable} is not set")
+  endif()
+endforeach()
+
+# cycles to run before saving the state, about halfway through the program
+set(SAVE_CYCLE 300000)
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+execute_process(
+  COMMAND ${WRITE_INPUTS} ${WORK_DIR}/program.bin ${WORK_DIR}/voltages.txt
+  RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "Could not write the inputs: ${result}")
+endif()
+
+# Run eh-sim on the inputs, writing its results to <name>.csv and what it prints to <name>.out
+function(run_eh_sim name)
+  execute_process(
+    COMMAND ${EH_SIM} --binary ${WORK_DIR}/program.bin --voltage-trace ${WORK_DIR}/voltages.txt
+        --voltage-rate 100 --scheme ${SCHEME} --output ${WORK_DIR}/${name}.csv ${ARGN}
+    OUTPUT_FILE ${WORK_DIR}/${name}.out
+    RESULT_VARIABLE result
+  )
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "eh-sim failed for the ${name} run: ${result}")
+  endif()
+endfunction()
+
+# Fail if two files differ, relative paths are files of the runs
+function(compare_files expected actual)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${expected} ${actual}
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+  )
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${actual} differs from ${expected}")
+  endif()
+endfunction()
+
+run_eh_sim(instructions --slice-cycles 0)
+compare_files(${REFERENCE_DIR}/${SCHEME}.csv instructions.csv)
+if(NOT PROFILED)
+  compare_files(${REFERENCE_DIR}/${SCHEME}.out instructions.out)
+endif()
+
+# slices charge energy in batches, which rounds differently from the reference in the last digits
+# odd slices end in the middle of blocks, large ones span many blocks
+run_eh_sim(slices-7 --slice-cycles 7)
+foreach(slice 1000 100000)
+  run_eh_sim(slices-${slice} --slice-cycles ${slice})
+  compare_files(slices-7.csv slices-${slice}.csv)
+  compare_files(slices-7.out slices-${slice}.out)
+endforeach()
+
+# the resumed run reports where it resumed, so only the results are compared
+run_eh_sim(saved --save-state ${WORK_DIR}/state --save-state-cycle ${SAVE_CYCLE})
+compare_files(instructions.csv saved.csv)
+run_eh_sim(resumed --resume-state ${WORK_DIR}/state)
+compare_files(instructions.csv resumed.csv)
@@ -0,0 +1,187 @@
+#include "test_inputs.hpp"
+
+#include <thumbulator/machine.hpp>
+#include <thumbulator/program.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <numeric>
+
+#include "scheme/clank.hpp"
+
+#include "sampling.hpp"
+#include "simulate.hpp"
+#include "stats.hpp"
+#include "voltage_trace.hpp"
+
+namespace {
+
+// How the simulation of the test program is sampled, so that it has many windows
+#define FUNCTIONAL_CYCLES 20000
+#define WARMUP_CYCLES 2000
+#define DETAILED_CYCLES 10000
+
+// Estimates are compared to values computed by hand up to rounding
+#define TOLERANCE 1e-12
+
+bool check(char const *what, bool passed)
+{
+  if(!passed) {
+    std::fprintf(stderr, "%s does not hold\n", what);
+  }
+
+  return passed;
+}
+
+bool check_close(char const *what, double expected, double actual)
+{
+  if(!(std::fabs(expected - actual) <= TOLERANCE)) {
+    std::fprintf(stderr, "%s is %.15g instead of %.15g\n", what, actual, expected);
+    return false;
+  }
+
+  return true;
+}
+
+double progress(ehsim::active_stats const &period)
+{
+  return period.progress;
+}
+
+/**
+ * Check the estimates of windows with known samples, where some active periods and a whole
+ * window have no value.
+ */
+bool check_estimates()
+{
+  auto const nan = std::numeric_limits<double>::quiet_NaN();
+  ehsim::stats_bundle stats{};
+  for(auto const value : {0.2, 0.4, 0.5, nan, 0.1, 0.3, nan}) {
+    stats.models.emplace_back();
+    stats.models.back().progress = value;
+  }
+
+  // windows of 0.2 and 0.4, of 0.5, of 0.1 and 0.3, and of no value
+  stats.sampling.window_periods = {2, 1, 3, 1};
+  auto const three = ehsim::estimate(stats, progress);
+  auto const mean = (0.3 + 0.5 + 0.2) / 3;
+  auto const variance = ((0.3 - mean) * (0.3 - mean) + (0.5 - mean) * (0.5 - mean) +
+                            (0.2 - mean) * (0.2 - mean)) /
+                        2;
+  auto passed = check("three windows have a value", three.samples == 3);
+  passed &= check_close("the mean of three windows", mean, three.mean);
+  passed &= check_close(
+      "the half width of three windows", 1.96 * std::sqrt(variance / 3), three.half_width);
+
+  stats.sampling.window_periods = {2};
+  auto const one = ehsim::estimate(stats, progress);
+  passed &= check("one window has a value", one.samples == 1);
+  passed &= check_close("the mean of one window", 0.3, one.mean);
+  passed &= check("one window has no interval", std::isinf(one.half_width));
+
+  stats.sampling.window_periods.clear();
+  auto const none = ehsim::estimate(stats, progress);
+  passed &= check("no windows have a value", none.samples == 0);
+  passed &= check("no windows have no mean", std::isnan(none.mean));
+  passed &= check("no windows have no interval", std::isinf(none.half_width));
+
+  return passed;
+}
+
+ehsim::stats_bundle simulate_test_program(char const *program_path,
+    ehsim::voltage_trace const &power,
+    ehsim::sampling_options const &sampling)
+{
+  thumbulator::program_image const program(program_path);
+  thumbulator::machine machine;
+  ehsim::clank scheme(&machine);
+
+  return ehsim::simulate(&machine, program, power, &scheme, true, 0, {}, sampling);
+}
+
+/**
+ * Check that a sampled simulation of the test program splits its active periods into windows of
+ * at least DETAILED_CYCLES, with the cycles between them run functionally, and that warming up
+ * leaves active periods out of the windows.
+ */
+bool check_windows(char const *program_path, char const *trace_path)
+{
+  ehsim::voltage_trace const power(trace_path, std::chrono::milliseconds(TRACE_RATE));
+
+  auto const detailed = simulate_test_program(program_path, power, {});
+  auto passed = check("a detailed simulation has no windows",
+      detailed.sampling.window_periods.empty() && detailed.sampling.functional_cycles == 0);
+
+  ehsim::sampling_options sampling{};
+  sampling.functional_cycles = FUNCTIONAL_CYCLES;
+  sampling.detailed_cycles = DETAILED_CYCLES;
+  auto const sampled = simulate_test_program(program_path, power, sampling);
+
+  // without a warm-up, the windows hold every active period in turn, but one that only ran the
+  // application to its end functionally
+  auto const &windows = sampled.sampling.window_periods;
+  auto const functional_end = sampled.models.back().time_for_instructions == 0 ? 1u : 0u;
+  passed &= check("the sampled simulation has windows", windows.size() > 2);
+  passed &= check("the windows hold every active period",
+      std::accumulate(windows.begin(), windows.end(), size_t{0}) + functional_end ==
+          sampled.models.size());
+
+  // the last window ends with the application, every other one runs for detailed_cycles
+  size_t first_period = 0;
+  for(size_t i = 0; i + 1 < windows.size(); ++i) {
+    uint64_t cycles = 0;
+    for(auto period = first_period; period < first_period + windows[i]; ++period) {
+      cycles += sampled.models[period].time_for_instructions;
+    }
+
+    passed &= check("a window runs for detailed_cycles", cycles >= DETAILED_CYCLES);
+    first_period += windows[i];
+  }
+
+  passed &= check("a fast-forward follows every window but the last",
+      sampled.sampling.functional_cycles >= (windows.size() - 1) * FUNCTIONAL_CYCLES &&
+          sampled.sampling.functional_instructions != 0);
+  passed &= check("the sampled simulation runs fewer instructions in detail",
+      sampled.cpu.instruction_count < detailed.cpu.instruction_count);
+
+  auto const estimate = ehsim::estimate(sampled, progress);
+  passed &= check("every window estimates the progress",
+      estimate.samples == windows.size() && std::isfinite(estimate.half_width));
+
+  sampling.warmup_cycles = WARMUP_CYCLES;
+  auto const warmed_up = simulate_test_program(program_path, power, sampling);
+  auto const &warmed_up_windows = warmed_up.sampling.window_periods;
+  passed &= check("the warm-up leaves active periods out of the windows",
+      warmed_up_windows.size() > 2 &&
+          std::accumulate(warmed_up_windows.begin(), warmed_up_windows.end(), size_t{0}) <
+              warmed_up.models.size());
+
+  return passed;
+}
+}
+
+/**
+ * Checks the confidence intervals of sampled estimates, and how a sampled simulation of the test
+ * program of thumbulator splits into detailed windows.
+ *
+ * sampling PROGRAM TRACE, where the inputs of the simulation are written to
+ */
+int main(int argc, char *argv[])
+{
+  if(argc != 3) {
+    std::fprintf(stderr, "usage: %s PROGRAM TRACE\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if(!ehsim_tests::write_test_inputs(argv[1], argv[2])) {
+    std::fprintf(stderr, "Could not create the input files.\n");
+    return EXIT_FAILURE;
+  }
+
+  auto passed = check_estimates();
+  passed &= check_windows(argv[1], argv[2]);
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,54 @@
+#ifndef EH_SIM_TESTS_TEST_INPUTS_HPP
+#define EH_SIM_TESTS_TEST_INPUTS_HPP
+
+#include <test_program.hpp>
+
+#include <cstdio>
+#include <memory>
+
+namespace ehsim_tests {
+
+// Samples in the voltage trace, which alternates between charging and running out of energy
+#define TRACE_SAMPLES 100
+#define HIGH_VOLTAGE 3.5
+#define LOW_VOLTAGE 1.5
+
+/**
+ * The time between the samples of the voltage trace, in milliseconds.
+ */
+#define TRACE_RATE 100
+
+/**
+ * Write the test program of thumbulator as a binary for eh-sim, and a voltage trace under which
+ * the program loses power many times before it exits.
+ *
+ * @param program_path Where to write the program.
+ * @param trace_path Where to write the voltage trace.
+ * @return Whether or not the files could be created.
+ */
+inline bool write_test_inputs(char const *program_path, char const *trace_path)
+{
+  using file_handle = std::unique_ptr<FILE, int (*)(FILE *)>;
+  file_handle program(std::fopen(program_path, "wb"), std::fclose);
+  file_handle trace(std::fopen(trace_path, "w"), std::fclose);
+  if(!program || !trace) {
+    return false;
+  }
+
+  auto const &image = thumbulator_tests::test_program;
+  auto const halfwords = sizeof(image) / sizeof(image[0]);
+  for(size_t i = 0; i < halfwords; ++i) {
+    // binaries are little-endian whatever the host is
+    std::fputc(image[i] & 0xFF, program.get());
+    std::fputc(image[i] >> 8, program.get());
+  }
+
+  for(int i = 0; i < TRACE_SAMPLES; ++i) {
+    std::fprintf(trace.get(), "%d %.1f\n", i, (i % 10) < 5 ? HIGH_VOLTAGE : LOW_VOLTAGE);
+  }
+
+  return true;
+}
+}
+
+#endif //EH_SIM_TESTS_TEST_INPUTS_HPP
@@ -0,0 +1,25 @@
+#include "test_inputs.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Writes the test program of thumbulator as a binary for eh-sim, and a voltage trace under which
+ * the program loses power many times before it exits.
+ *
+ * write_inputs PROGRAM TRACE
+ */
+int main(int argc, char *argv[])
+{
+  if(argc != 3) {
+    std::fprintf(stderr, "usage: %s PROGRAM TRACE\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if(!ehsim_tests::write_test_inputs(argv[1], argv[2])) {
+    std::fprintf(stderr, "Could not create the input files.\n");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <cstdint>
 
 #include "thumbulator/decode.hpp"
+#include "thumbulator/decode_cache.hpp"
 
 namespace thumbulator {
 
@@ -19,9 +20,16 @@ struct cpu_state {
   uint32_t gpr[16];
 
   /**
-   * Application program status register.
+   * Application program status register flags, kept the way the ALU produces them.
+   *
+   * N is bit 31 of flag_n, Z is set when flag_z is 0, C is flag_c, and V is bit 31 of flag_v.
+   * This way, flag-setting instructions only store their result, and the flags are packed into
+   * the register when an instruction reads it.
    */
-  uint32_t apsr;
+  uint32_t flag_n;
+  uint32_t flag_z;
+  uint32_t flag_c;
+  uint32_t flag_v;
 
   /**
    * Interrupt program status register.
@@ -49,32 +57,22 @@ struct cpu_state {
   uint32_t exceptmask;
 };
 
-/**
- * Informs fetch that previous instruction caused a control flow change
- */
-extern bool BRANCH_WAS_TAKEN;
-
-/**
- * Whether or not the exit instruction has been executed.
- */
-extern bool EXIT_INSTRUCTION_ENCOUNTERED;
-
 /**
  * Resets the CPU according to the specification.
  */
 void cpu_reset();
 
-extern cpu_state cpu;
-
 /**
- * Get a general-purpose register.
+ * Get a general-purpose register of the machine bound to the calling thread.
+ *
+ * The register accessors require thumbulator/machine.hpp.
  */
-#define cpu_get_gpr(x) cpu.gpr[x]
+#define cpu_get_gpr(x) current_machine->cpu.gpr[x]
 
 /**
- * Set a general-purpose register.
+ * Set a general-purpose register of the machine bound to the calling thread.
  */
-#define cpu_set_gpr(x, y) cpu.gpr[x] = y
+#define cpu_set_gpr(x, y) current_machine->cpu.gpr[x] = y
 
 /**
  * The register-index of the program counter.
@@ -91,14 +89,41 @@ extern cpu_state cpu;
  */
 #define cpu_set_pc(x) cpu_set_gpr(GPR_PC, (x))
 
+// GPRs with special functions
+#define GPR_SP 13
+#define GPR_LR 14
+#define cpu_get_sp() cpu_get_gpr(GPR_SP)
+#define cpu_set_sp(x) (cpu_set_gpr(GPR_SP, (x)))
+#define cpu_get_lr() cpu_get_gpr(GPR_LR)
+#define cpu_set_lr(x) cpu_set_gpr(GPR_LR, (x))
+
+// Sign extension
+#define zeroExtend32(x) (x)
+#define signExtend32(x, n) \
+  (((((x) >> ((n)-1)) & 0x1) != 0) ? (~((unsigned int)0) << (n)) | (x) : (x))
+
+/**
+ * The SYSTICK timer.
+ *
+ * While the timer is enabled, the current value is not updated every cycle but computed when it is
+ * read, and the timer wraps at a scheduled event.
+ */
 struct system_tick {
   uint32_t control;
   uint32_t reload;
+
+  /**
+   * The value of the timer at value_cycle.
+   */
   uint32_t value;
+
   uint32_t calib;
-};
 
-extern system_tick SYSTICK;
+  /**
+   * The cycle at which the timer had value, counted by machine::cycle_count.
+   */
+  uint64_t value_cycle;
+};
 
 /**
  * Cycles taken for branch instructions.
@@ -120,6 +145,11 @@ extern system_tick SYSTICK;
  */
 #define TIMING_MEM 2
 
+/**
+ * The most cycles any instruction takes, which is the multiplication.
+ */
+#define MAX_INSTRUCTION_CYCLES 32
+
 /**
  * Perform the execute, mem, and write-back stages.
  *
@@ -129,6 +159,24 @@ extern system_tick SYSTICK;
  * @return The number of cycles taken.
  */
 uint32_t exmemwb(uint16_t instruction, decode_result const *decoded);
+
+/**
+ * Perform the execute, mem, and write-back stages of an already decoded instruction.
+ *
+ * @param instruction The instruction to execute.
+ *
+ * @return The number of cycles taken.
+ */
+uint32_t exmemwb(decoded_instruction const *instruction);
+
+/**
+ * Find the handler that executes an instruction.
+ *
+ * @param instruction The instruction to execute.
+ *
+ * @return The handler the execute stage dispatches the instruction to.
+ */
+execute_handler resolve_handler(uint16_t instruction);
 }
 
 #endif //THUMBULATOR_CPU_H
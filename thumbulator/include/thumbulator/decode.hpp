@@ -42,13 +42,19 @@ struct decode_result {
   uint32_t register_list;
 };
 
+/**
+ * Handler for the execute, memory, and write-back stages of a single instruction.
+ */
+using execute_handler = uint32_t (*)(decode_result const *);
+
 /**
  * Interface to the decode stage.
  *
  * @param instruction The instruction to decode.
+ * @param second_half The halfword after the instruction, only read for 32-bit instructions.
  * @return The decode stage registers based upon the passed instruction.
  */
-decode_result decode(uint16_t instruction);
+decode_result decode(uint16_t instruction, uint16_t second_half);
 }
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef THUMBULATOR_DECODE_CACHE_H
+#define THUMBULATOR_DECODE_CACHE_H
+
+#include <cstdint>
+
+#include "thumbulator/decode.hpp"
+
+namespace thumbulator {
+
+/**
+ * An instruction that has already been through the fetch and decode stages.
+ */
+struct decoded_instruction {
+  /**
+   * The handler that executes this instruction, nullptr if the entry is empty.
+   */
+  execute_handler execute;
+
+  /**
+   * The result of the decode stage.
+   */
+  decode_result decoded;
+
+  /**
+   * The raw instruction.
+   */
+  uint16_t instruction;
+
+  /**
+   * The value of the program counter while this instruction executes.
+   */
+  uint32_t pc;
+};
+
+/**
+ * Fetch and decode the instruction at the specified address.
+ *
+ * Instructions in FLASH are decoded once and served from the decode cache afterwards, and so are
+ * those in RAM while the memory policy does not see instruction fetches. Modifying the memory
+ * through stores drops the affected instructions again.
+ *
+ * @param address The address of the instruction.
+ *
+ * @return The decoded instruction, valid until the next call.
+ */
+decoded_instruction const *fetch_decoded(uint32_t address);
+
+/**
+ * Drop the cached decoding of the instructions overlapping the specified bytes.
+ *
+ * Stores and the other modifications seen by memory_region::watch_code do this on their own.
+ *
+ * @param address The address of the first modified byte.
+ * @param bytes Number of modified bytes.
+ */
+void invalidate_decode_cache(uint32_t address, uint32_t bytes = 4);
+
+/**
+ * Drop all cached decodings, e.g., after loading a new program.
+ */
+void flush_decode_cache();
+}
+
+#endif //THUMBULATOR_DECODE_CACHE_H
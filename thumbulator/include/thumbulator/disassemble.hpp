@@ -0,0 +1,28 @@
+#ifndef THUMBULATOR_DISASSEMBLE_H
+#define THUMBULATOR_DISASSEMBLE_H
+
+#include <cstdint>
+#include <string>
+
+namespace thumbulator {
+
+/**
+ * Whether or not a halfword is the first half of a 32-bit instruction.
+ */
+inline bool is_32bit_instruction(uint16_t first_half)
+{
+  return (first_half >> 11) >= 0x1D;
+}
+
+/**
+ * Render an ARMv6-M Thumb instruction in assembly syntax.
+ *
+ * @param address The address of the instruction, to resolve PC-relative targets.
+ * @param opcode The instruction, with the second half of 32-bit instructions in the upper 16 bits.
+ *
+ * @return The assembly, or a .hword/.word directive for encodings that are not instructions.
+ */
+std::string disassemble(uint32_t address, uint32_t opcode);
+}
+
+#endif //THUMBULATOR_DISASSEMBLE_H
@@ -0,0 +1,60 @@
+#ifndef THUMBULATOR_EXIT_HPP
+#define THUMBULATOR_EXIT_HPP
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace thumbulator {
+
+/**
+ * The reasons a simulation cannot continue.
+ */
+enum fault_kind : uint8_t {
+  FAULT_UNDEFINED_INSTRUCTION,
+  FAULT_UNSUPPORTED_INSTRUCTION,
+  FAULT_MALFORMED_INSTRUCTION,
+  FAULT_INTERWORKING,
+  FAULT_FETCH_OUT_OF_RANGE,
+  FAULT_LOAD_OUT_OF_RANGE,
+  FAULT_STORE_OUT_OF_RANGE
+};
+
+/**
+ * Thrown when the simulated program does something the simulator cannot continue from.
+ *
+ * The machine is left as it was at the fault, and can be reset or loaded with another program.
+ */
+struct simulation_fault : std::runtime_error {
+  simulation_fault(fault_kind kind, uint32_t pc, uint32_t address);
+
+  fault_kind kind;
+
+  /**
+   * The address of the instruction that faulted.
+   */
+  uint32_t pc;
+
+  /**
+   * The address that could not be accessed or branched to, the PC for instruction faults.
+   */
+  uint32_t address;
+};
+
+/**
+ * Terminate the simulation prematurely by throwing a simulation_fault.
+ *
+ * Use this on a fatal error while executing an instruction, which is taken as the faulting one.
+ *
+ * @param kind What went wrong.
+ * @param address The address involved in the fault, see simulation_fault::address.
+ */
+[[noreturn]] void terminate_simulation(fault_kind kind, uint32_t address);
+
+/**
+ * Terminate the simulation prematurely because of the executing instruction itself.
+ *
+ * @param kind What went wrong.
+ */
+[[noreturn]] void terminate_simulation(fault_kind kind);
+}
+#endif //THUMBULATOR_EXIT_HPP
@@ -1,14 +1,100 @@
-#include "thumbulator/memory.hpp"
+#ifndef THUMBULATOR_EXMEMWB_MEM_H
+#define THUMBULATOR_EXMEMWB_MEM_H
+
+#include <cstdint>
+#include <cstdio>
 
-#include "cpu_flags.hpp"
-#include "exit.hpp"
-#include "trace.hpp"
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/decode.hpp"
+#include "thumbulator/exit.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory.hpp"
+#include "thumbulator/sampler.hpp"
+#include "thumbulator/trace.hpp"
+#include "thumbulator/tracer.hpp"
 
 namespace thumbulator {
 
+/**
+ * The memory policy of the machine bound to the calling thread.
+ */
+template <typename Policy>
+inline Policy *memory_policy()
+{
+  return static_cast<Policy *>(current_machine->memory_policy);
+}
+
+/**
+ * Load data from memory, passing loads from RAM through a memory policy.
+ *
+ * @param policy The memory policy of the machine.
+ * @param address The address to load data from.
+ * @param value The data in memory at that address.
+ * @param false_read true if this is a read due to anything other than the program.
+ */
+template <typename Policy>
+inline void load(Policy *policy, uint32_t address, uint32_t *value, uint32_t false_read)
+{
+  auto *const bound = current_machine;
+
+  if(address >= RAM_START) {
+    auto &ram = bound->ram;
+    if(!ram.contains(address)) {
+      load_peripheral(address, value, false_read);
+    } else {
+      auto const data = ram.word(address);
+      *value = false_read == 1 ? data : policy->ram_load(address, data);
+    }
+  } else {
+    auto &flash = bound->flash;
+    if(!flash.contains(address)) {
+      load_peripheral(address, value, false_read);
+    } else {
+      *value = flash.word(address);
+    }
+  }
+
+  if(bound->tracer != nullptr && false_read != 1) {
+    trace_access(bound->tracer, address, *value, TRACE_LOAD);
+  }
+}
+
+/**
+ * Store data into memory, passing stores to RAM through a memory policy.
+ *
+ * Stores to RAM mark the word they store to as dirty.
+ *
+ * @param policy The memory policy of the machine.
+ * @param address The address to store the data to.
+ * @param value The data to store at that address.
+ */
+template <typename Policy>
+inline void store(Policy *policy, uint32_t address, uint32_t value)
+{
+  auto *const bound = current_machine;
+
+  auto &ram = bound->ram;
+  if(ram.contains(address)) {
+    ram.mark_dirty(address);
+
+    auto const old_value = ram.word(address);
+    auto const new_value = policy->ram_store(address, old_value, value);
+    if(new_value != old_value) {
+      ram.writable_word(address) = new_value;
+    }
+  } else {
+    store_outside_ram(address, value);
+  }
+
+  if(bound->tracer != nullptr) {
+    trace_access(bound->tracer, address, value, TRACE_STORE);
+  }
+}
+
 ///--- Load/store multiple operations --------------------------------------------///
 
 // LDM - Load multiple registers from the stack
+template <typename Policy>
 uint32_t ldm(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldm r%u!, {0x%X}\n", decoded->Rn, decoded->register_list);
@@ -21,7 +107,7 @@ uint32_t ldm(decode_result const *decoded)
     int mask = 1 << i;
     if(decoded->register_list & mask) {
       uint32_t data = 0;
-      load(address, &data, 0);
+      load(memory_policy<Policy>(), address, &data, 0);
       cpu_set_gpr(i, data);
       address += 4;
       ++numLoaded;
@@ -35,6 +121,7 @@ uint32_t ldm(decode_result const *decoded)
 }
 
 // STM - Store multiple registers to the stack
+template <typename Policy>
 uint32_t stm(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("stm r%u!, {0x%X}\n", decoded->Rn, decoded->register_list);
@@ -46,12 +133,11 @@ uint32_t stm(decode_result const *decoded)
     int mask = 1 << i;
     if(decoded->register_list & mask) {
       if(i == decoded->Rn && numStored == 0) {
-        fprintf(stderr, "Error: Malformed instruction!\n");
-        terminate_simulation(1);
+        terminate_simulation(FAULT_MALFORMED_INSTRUCTION);
       }
 
       uint32_t data = cpu_get_gpr(i);
-      store(address, data);
+      store(memory_policy<Policy>(), address, data);
       address += 4;
       ++numStored;
     }
@@ -65,6 +151,7 @@ uint32_t stm(decode_result const *decoded)
 ///--- Stack operations --------------------------------------------///
 
 // Pop multiple reg values from the stack and update SP
+template <typename Policy>
 uint32_t pop(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("pop {0x%X}\n", decoded->register_list);
@@ -76,11 +163,11 @@ uint32_t pop(decode_result const *decoded)
     int mask = 1 << i;
     if(decoded->register_list & mask) {
       uint32_t data = 0;
-      load(address, &data, 0);
+      load(memory_policy<Policy>(), address, &data, 0);
       cpu_set_gpr(i, data);
       ++numLoaded;
       if(i == 15)
-        BRANCH_WAS_TAKEN = 1;
+        current_machine->branch_was_taken = 1;
       address += 4;
     }
 
@@ -91,10 +178,15 @@ uint32_t pop(decode_result const *decoded)
 
   cpu_set_sp(address);
 
-  return 1 + numLoaded + BRANCH_WAS_TAKEN ? TIMING_PC_UPDATE : 0;
+  if((decoded->register_list & (1 << GPR_PC)) != 0 && current_machine->sampler != nullptr) {
+    current_machine->sampler->return_to(cpu_get_pc() & ~0x1u, address);
+  }
+
+  return 1 + numLoaded + current_machine->branch_was_taken ? TIMING_PC_UPDATE : 0;
 }
 
 // Push multiple reg values to the stack and update SP
+template <typename Policy>
 uint32_t push(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("push {0x%4.4X}\n", decoded->register_list);
@@ -107,7 +199,7 @@ uint32_t push(decode_result const *decoded)
     if(decoded->register_list & mask) {
       address -= 4;
       uint32_t data = cpu_get_gpr(i);
-      store(address, data);
+      store(memory_policy<Policy>(), address, data);
       ++numStored;
     }
 
@@ -124,6 +216,7 @@ uint32_t push(decode_result const *decoded)
 ///--- Single load operations --------------------------------------------///
 
 // LDR - Load from offset from register
+template <typename Policy>
 uint32_t ldr_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldr r%u, [r%u, #0x%X]\n", decoded->Rd, decoded->Rn, decoded->imm << 2);
@@ -133,7 +226,7 @@ uint32_t ldr_i(decode_result const *decoded)
   uint32_t effectiveAddress = base + offset;
 
   uint32_t result = 0;
-  load(effectiveAddress, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddress, &result, 0);
 
   cpu_set_gpr(decoded->Rd, result);
 
@@ -141,6 +234,7 @@ uint32_t ldr_i(decode_result const *decoded)
 }
 
 // LDR - Load from offset from SP
+template <typename Policy>
 uint32_t ldr_sp(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldr r%u, [SP, #0x%X]\n", decoded->Rd, decoded->imm << 2);
@@ -150,7 +244,7 @@ uint32_t ldr_sp(decode_result const *decoded)
   uint32_t effectiveAddress = base + offset;
 
   uint32_t result = 0;
-  load(effectiveAddress, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddress, &result, 0);
 
   cpu_set_gpr(decoded->Rd, result);
 
@@ -158,6 +252,7 @@ uint32_t ldr_sp(decode_result const *decoded)
 }
 
 // LDR - Load from offset from PC
+template <typename Policy>
 uint32_t ldr_lit(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldr r%u, [PC, #%d]\n", decoded->Rd, decoded->imm << 2);
@@ -167,7 +262,7 @@ uint32_t ldr_lit(decode_result const *decoded)
   uint32_t effectiveAddress = base + offset;
 
   uint32_t result = 0;
-  load(effectiveAddress, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddress, &result, 0);
 
   cpu_set_gpr(decoded->Rd, result);
 
@@ -175,6 +270,7 @@ uint32_t ldr_lit(decode_result const *decoded)
 }
 
 // LDR - Load from an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t ldr_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldr r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -184,7 +280,7 @@ uint32_t ldr_r(decode_result const *decoded)
   uint32_t effectiveAddress = base + offset;
 
   uint32_t result = 0;
-  load(effectiveAddress, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddress, &result, 0);
 
   cpu_set_gpr(decoded->Rd, result);
 
@@ -192,6 +288,7 @@ uint32_t ldr_r(decode_result const *decoded)
 }
 
 // LDRB - Load byte from offset from register
+template <typename Policy>
 uint32_t ldrb_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrb r%u, [r%u, #0x%X]\n", decoded->Rd, decoded->Rn, decoded->imm);
@@ -202,7 +299,7 @@ uint32_t ldrb_i(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct byte
   switch(effectiveAddress & 0x3) {
@@ -226,6 +323,7 @@ uint32_t ldrb_i(decode_result const *decoded)
 }
 
 // LDRB - Load byte from an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t ldrb_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrb r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -236,7 +334,7 @@ uint32_t ldrb_r(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct byte
   switch(effectiveAddress & 0x3) {
@@ -260,6 +358,7 @@ uint32_t ldrb_r(decode_result const *decoded)
 }
 
 // LDRH - Load halfword from offset from register
+template <typename Policy>
 uint32_t ldrh_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrh r%u, [r%u, #0x%X]\n", decoded->Rd, decoded->Rn, decoded->imm);
@@ -270,7 +369,7 @@ uint32_t ldrh_i(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct halfword
   switch(effectiveAddress & 0x2) {
@@ -289,6 +388,7 @@ uint32_t ldrh_i(decode_result const *decoded)
 }
 
 // LDRH - Load halfword from an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t ldrh_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrh r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -299,7 +399,7 @@ uint32_t ldrh_r(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct halfword
   switch(effectiveAddress & 0x2) {
@@ -318,6 +418,7 @@ uint32_t ldrh_r(decode_result const *decoded)
 }
 
 // LDRSB - Load signed byte from an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t ldrsb_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrsb r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -328,7 +429,7 @@ uint32_t ldrsb_r(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct byte
   switch(effectiveAddress & 0x3) {
@@ -352,6 +453,7 @@ uint32_t ldrsb_r(decode_result const *decoded)
 }
 
 // LDRSH - Load signed halfword from an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t ldrsh_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("ldrsh r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -362,7 +464,7 @@ uint32_t ldrsh_r(decode_result const *decoded)
   uint32_t effectiveAddressWordAligned = effectiveAddress & ~0x3;
 
   uint32_t result = 0;
-  load(effectiveAddressWordAligned, &result, 0);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &result, 0);
 
   // Select the correct halfword
   switch(effectiveAddress & 0x2) {
@@ -382,6 +484,7 @@ uint32_t ldrsh_r(decode_result const *decoded)
 ///--- Single store operations --------------------------------------------///
 
 // STR - Store to offset from register
+template <typename Policy>
 uint32_t str_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("str r%u, [r%u, #%d]\n", decoded->Rd, decoded->Rn, decoded->imm << 2);
@@ -390,12 +493,13 @@ uint32_t str_i(decode_result const *decoded)
   uint32_t offset = zeroExtend32(decoded->imm << 2);
   uint32_t effectiveAddress = base + offset;
 
-  store(effectiveAddress, cpu_get_gpr(decoded->Rd));
+  store(memory_policy<Policy>(), effectiveAddress, cpu_get_gpr(decoded->Rd));
 
   return TIMING_MEM;
 }
 
 // STR - Store to offset from SP
+template <typename Policy>
 uint32_t str_sp(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("str r%u, [SP, #%d]\n", decoded->Rd, decoded->imm << 2);
@@ -404,12 +508,13 @@ uint32_t str_sp(decode_result const *decoded)
   uint32_t offset = zeroExtend32(decoded->imm << 2);
   uint32_t effectiveAddress = base + offset;
 
-  store(effectiveAddress, cpu_get_gpr(decoded->Rd));
+  store(memory_policy<Policy>(), effectiveAddress, cpu_get_gpr(decoded->Rd));
 
   return TIMING_MEM;
 }
 
 // STR - Store to an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t str_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("str r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -418,12 +523,13 @@ uint32_t str_r(decode_result const *decoded)
   uint32_t offset = cpu_get_gpr(decoded->Rm);
   uint32_t effectiveAddress = base + offset;
 
-  store(effectiveAddress, cpu_get_gpr(decoded->Rd));
+  store(memory_policy<Policy>(), effectiveAddress, cpu_get_gpr(decoded->Rd));
 
   return TIMING_MEM;
 }
 
 // STRB - Store byte to offset from register
+template <typename Policy>
 uint32_t strb_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("strb r%u, [r%u, #0x%X]\n", decoded->Rd, decoded->Rn, decoded->imm);
@@ -435,7 +541,7 @@ uint32_t strb_i(decode_result const *decoded)
   uint32_t data = cpu_get_gpr(decoded->Rd) & 0xFF;
 
   uint32_t orig;
-  load(effectiveAddressWordAligned, &orig, 1);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &orig, 1);
 
   // Select the correct byte
   switch(effectiveAddress & 0x3) {
@@ -452,12 +558,13 @@ uint32_t strb_i(decode_result const *decoded)
     orig = (orig & 0x00FFFFFF) | (data << 24);
   }
 
-  store(effectiveAddressWordAligned, orig);
+  store(memory_policy<Policy>(), effectiveAddressWordAligned, orig);
 
   return TIMING_MEM;
 }
 
 // STRB - Store byte to an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t strb_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("strb r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -469,7 +576,7 @@ uint32_t strb_r(decode_result const *decoded)
   uint32_t data = cpu_get_gpr(decoded->Rd) & 0xFF;
 
   uint32_t orig;
-  load(effectiveAddressWordAligned, &orig, 1);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &orig, 1);
 
   // Select the correct byte
   switch(effectiveAddress & 0x3) {
@@ -486,12 +593,13 @@ uint32_t strb_r(decode_result const *decoded)
     orig = (orig & 0x00FFFFFF) | (data << 24);
   }
 
-  store(effectiveAddressWordAligned, orig);
+  store(memory_policy<Policy>(), effectiveAddressWordAligned, orig);
 
   return TIMING_MEM;
 }
 
 // STRH - Store halfword to offset from register
+template <typename Policy>
 uint32_t strh_i(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("strh r%u, [r%u, #0x%X]\n", decoded->Rd, decoded->Rn, decoded->imm);
@@ -503,7 +611,7 @@ uint32_t strh_i(decode_result const *decoded)
   uint32_t data = cpu_get_gpr(decoded->Rd) & 0xFFFF;
 
   uint32_t orig;
-  load(effectiveAddressWordAligned, &orig, 1);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &orig, 1);
 
   // Select the correct byte
   switch(effectiveAddress & 0x2) {
@@ -514,12 +622,13 @@ uint32_t strh_i(decode_result const *decoded)
     orig = (orig & 0x0000FFFF) | (data << 16);
   }
 
-  store(effectiveAddressWordAligned, orig);
+  store(memory_policy<Policy>(), effectiveAddressWordAligned, orig);
 
   return TIMING_MEM;
 }
 
 // STRH - Store halfword to an offset from a reg based on another reg value
+template <typename Policy>
 uint32_t strh_r(decode_result const *decoded)
 {
   TRACE_INSTRUCTION("strh r%u, [r%u, r%u]\n", decoded->Rd, decoded->Rn, decoded->Rm);
@@ -531,7 +640,7 @@ uint32_t strh_r(decode_result const *decoded)
   uint32_t data = cpu_get_gpr(decoded->Rd) & 0xFFFF;
 
   uint32_t orig;
-  load(effectiveAddressWordAligned, &orig, 1);
+  load(memory_policy<Policy>(), effectiveAddressWordAligned, &orig, 1);
 
   // Select the correct byte
   switch(effectiveAddress & 0x2) {
@@ -542,8 +651,52 @@ uint32_t strh_r(decode_result const *decoded)
     orig = (orig & 0x0000FFFF) | (data << 16);
   }
 
-  store(effectiveAddressWordAligned, orig);
+  store(memory_policy<Policy>(), effectiveAddressWordAligned, orig);
 
   return TIMING_MEM;
 }
+
+/**
+ * The handlers of the instructions that access memory, instantiated for a memory policy.
+ */
+struct memory_handlers {
+  execute_handler ldm;
+  execute_handler stm;
+  execute_handler pop;
+  execute_handler push;
+  execute_handler ldr_i;
+  execute_handler ldr_sp;
+  execute_handler ldr_lit;
+  execute_handler ldr_r;
+  execute_handler ldrb_i;
+  execute_handler ldrb_r;
+  execute_handler ldrh_i;
+  execute_handler ldrh_r;
+  execute_handler ldrsb_r;
+  execute_handler ldrsh_r;
+  execute_handler str_i;
+  execute_handler str_sp;
+  execute_handler str_r;
+  execute_handler strb_i;
+  execute_handler strb_r;
+  execute_handler strh_i;
+  execute_handler strh_r;
+};
+
+/**
+ * The handlers of the instructions that access memory through Policy.
+ */
+template <typename Policy>
+struct memory_handlers_of {
+  static constexpr memory_handlers table = {ldm<Policy>, stm<Policy>, pop<Policy>, push<Policy>,
+      ldr_i<Policy>, ldr_sp<Policy>, ldr_lit<Policy>, ldr_r<Policy>, ldrb_i<Policy>,
+      ldrb_r<Policy>, ldrh_i<Policy>, ldrh_r<Policy>, ldrsb_r<Policy>, ldrsh_r<Policy>,
+      str_i<Policy>, str_sp<Policy>, str_r<Policy>, strb_i<Policy>, strb_r<Policy>,
+      strh_i<Policy>, strh_r<Policy>};
+};
+
+template <typename Policy>
+constexpr memory_handlers memory_handlers_of<Policy>::table;
 }
+
+#endif //THUMBULATOR_EXMEMWB_MEM_H
@@ -0,0 +1,284 @@
+#ifndef THUMBULATOR_MACHINE_H
+#define THUMBULATOR_MACHINE_H
+
+#include <cstdint>
+#include <memory>
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/memory.hpp"
+#include "thumbulator/peripheral.hpp"
+#include "thumbulator/profile.hpp"
+#include "thumbulator/run.hpp"
+#include "thumbulator/uart.hpp"
+
+namespace thumbulator {
+
+// GCC and Clang access __thread variables without the initialization checks of thread_local
+#if defined(__GNUC__)
+#define THUMBULATOR_THREAD_LOCAL __thread
+#else
+#define THUMBULATOR_THREAD_LOCAL thread_local
+#endif
+
+struct decode_cache;
+class instruction_tracer;
+class pc_sampler;
+class semihosting_host;
+struct memory_handlers;
+struct translation_cache;
+
+/**
+ * Things that happen at a given cycle, rather than being checked for after every instruction.
+ */
+enum machine_event : uint8_t { EVENT_SYSTICK, EVENT_SAMPLE, EVENT_CYCLE_BUDGET, EVENT_COUNT };
+
+/**
+ * The deadline of events that are not scheduled.
+ */
+#define EVENT_NEVER UINT64_MAX
+
+/**
+ * The cycles at which the events of a machine happen next.
+ */
+struct event_schedule {
+  /**
+   * The earliest of the deadlines.
+   */
+  uint64_t next;
+
+  /**
+   * The deadline of each event, EVENT_NEVER if it is not scheduled.
+   */
+  uint64_t deadlines[EVENT_COUNT];
+};
+
+/**
+ * The memory region instructions were last fetched from.
+ *
+ * Fetches from the same region skip working out which region they are in and its bounds, see
+ * fetch_instruction. The window is moved when control flow leaves the region.
+ */
+struct fetch_window {
+  /**
+   * The address of the first byte of the region.
+   */
+  uint32_t start;
+
+  /**
+   * The size of the region in bytes, 0 while there is no region.
+   */
+  uint32_t size;
+
+  uint32_t const *words;
+
+  /**
+   * Whether fetches from the region go through the memory policy, true for RAM with hooks.
+   */
+  bool hooked;
+};
+
+/**
+ * The state of a call to run_until.
+ */
+struct run_control {
+  /**
+   * Whether or not run_until is running.
+   */
+  bool running;
+
+  /**
+   * Whether or not accesses to peripherals stop the run.
+   */
+  bool stop_on_peripheral_access;
+
+  /**
+   * Why the run has to stop after the executing instruction, STOP_NONE while it can go on.
+   */
+  stop_reason pending_stop;
+};
+
+/**
+ * The part of a snapshot that is not in the memories, see take_snapshot.
+ */
+struct snapshot_registers {
+  /**
+   * Whether or not a snapshot was taken.
+   */
+  bool taken;
+
+  cpu_state cpu;
+
+  system_tick systick;
+
+  uint64_t cycle_count;
+
+  event_schedule events;
+
+  bool exit_instruction_encountered;
+};
+
+/**
+ * A complete simulated system: the CPU, memories, peripherals, and the caches derived from them.
+ *
+ * The simulator functions operate on the machine bound to the calling thread, see machine_binding.
+ * Independent machines can therefore be simulated concurrently, one per thread.
+ */
+struct machine {
+  /**
+   * Create a machine, reset and with zero-filled memories.
+   *
+   * @param ram_size_bytes The size of RAM, a multiple of 4 up to RAM_MAX_SIZE_BYTES.
+   * @param flash_size_bytes The size of FLASH, a multiple of 4 up to FLASH_MAX_SIZE_BYTES.
+   */
+  explicit machine(uint32_t ram_size_bytes = RAM_SIZE_BYTES,
+      uint32_t flash_size_bytes = FLASH_SIZE_BYTES);
+  ~machine();
+
+  machine(machine const &) = delete;
+  machine &operator=(machine const &) = delete;
+
+  cpu_state cpu;
+
+  system_tick systick;
+
+  /**
+   * Number of cycles executed since the machine was created.
+   */
+  uint64_t cycle_count;
+
+  /**
+   * The events scheduled to happen once cycle_count reaches their deadline.
+   */
+  event_schedule events;
+
+  /**
+   * The state of the run_until in progress, if any.
+   */
+  run_control run;
+
+  /**
+   * The region the next instruction is likely to be fetched from.
+   */
+  fetch_window fetch;
+
+  /**
+   * Informs fetch that previous instruction caused a control flow change
+   */
+  bool branch_was_taken;
+
+  /**
+   * Whether or not the exit instruction has been executed.
+   */
+  bool exit_instruction_encountered;
+
+  /**
+   * Random-Access Memory, like SRAM, starting at RAM_START.
+   */
+  memory_region ram;
+
+  /**
+   * Read-Only Memory starting at FLASH_START.
+   *
+   * Typically used to store the application code.
+   */
+  memory_region flash;
+
+  /**
+   * The memory-mapped devices, for the addresses outside of RAM and FLASH, see map_peripheral.
+   */
+  peripheral_bus peripherals;
+
+  /**
+   * The serial port at UART_ADDRESS, also the console of semihosting.
+   */
+  uart_port uart;
+
+  /**
+   * The host serving semihosting calls, nullptr to ignore them, see semihosting_host.
+   */
+  semihosting_host *semihosting;
+
+  /**
+   * The memory policy that accesses to RAM go through, see use_memory_policy.
+   */
+  void *memory_policy;
+
+  /**
+   * The handlers of the memory instructions, instantiated for the memory policy.
+   */
+  memory_handlers const *memory_instructions;
+
+  /**
+   * Hook of the memory policy into loads from RAM, for accesses outside of the memory instructions.
+   *
+   * The first parameter is the memory policy, the others are those of its ram_load.
+   */
+  uint32_t (*ram_load_hook)(void *, uint32_t, uint32_t);
+
+  /**
+   * Hook of the memory policy into stores to RAM, for accesses outside of the memory instructions.
+   *
+   * The first parameter is the memory policy, the others are those of its ram_store.
+   */
+  uint32_t (*ram_store_hook)(void *, uint32_t, uint32_t, uint32_t);
+
+  /**
+   * The tracer recording the executed instructions, nullptr while not tracing.
+   *
+   * Translated blocks are bypassed while tracing.
+   */
+  instruction_tracer *tracer;
+
+  /**
+   * The sampler of the PC and call stack, nullptr while not sampling, see start_sampling.
+   */
+  pc_sampler *sampler;
+
+#if defined(THUMBULATOR_PROFILE)
+  /**
+   * The instructions executed since the machine was created or the profile was reset.
+   */
+  execution_profile profile;
+#endif
+
+  /**
+   * The registers of the last snapshot, the memories save their own pages.
+   */
+  snapshot_registers snapshot;
+
+  std::unique_ptr<decode_cache> decoded;
+
+  std::unique_ptr<translation_cache> translations;
+};
+
+/**
+ * The machine bound to the calling thread, nullptr if there is none.
+ */
+extern THUMBULATOR_THREAD_LOCAL machine *current_machine;
+
+/**
+ * Binds a machine to the calling thread for the lifetime of the binding.
+ *
+ * The previously bound machine, if any, is restored afterwards.
+ */
+class machine_binding {
+public:
+  explicit machine_binding(machine *bound) : previous(current_machine)
+  {
+    current_machine = bound;
+  }
+
+  ~machine_binding()
+  {
+    current_machine = previous;
+  }
+
+  machine_binding(machine_binding const &) = delete;
+  machine_binding &operator=(machine_binding const &) = delete;
+
+private:
+  machine *previous;
+};
+}
+
+#endif //THUMBULATOR_MACHINE_H
@@ -1,53 +1,333 @@
 #ifndef THUMBULATOR_SIM_SUPPORT_H
 #define THUMBULATOR_SIM_SUPPORT_H
 
+#include <cstddef>
 #include <cstdint>
-#include <functional>
+#include <cstdio>
+#include <vector>
 
 namespace thumbulator {
 
 #define RAM_START 0x40000000
-#define RAM_SIZE_BYTES (1 << 23) // 8 MB
-#define RAM_SIZE_ELEMENTS (RAM_SIZE_BYTES >> 2)
-#define RAM_ADDRESS_MASK (((~0) << 23) ^ (~0))
+#define RAM_SIZE_BYTES (1 << 23) // 8 MB by default
+#define RAM_MAX_SIZE_BYTES (0xE0000000 - RAM_START)
 
-/**
- * Random-Access Memory, like SRAM.
- */
-extern uint32_t RAM[RAM_SIZE_ELEMENTS];
+#define FLASH_START 0x0
+#define FLASH_SIZE_BYTES (1 << 23) // 8 MB by default
+#define FLASH_MAX_SIZE_BYTES (RAM_START - FLASH_START)
 
-/**
- * Hook into loads to RAM.
- *
- * The first parameter is the address.
- * The second parameter is the data that would be loaded.
- *
- * The function returns the data that will be loaded, potentially different than the second parameter.
- */
-extern std::function<uint32_t(uint32_t, uint32_t)> ram_load_hook;
+// Memories are saved for snapshots and tracked for modifications in pages of this size
+#define MEMORY_PAGE_BYTES (1 << 12)
+#define MEMORY_PAGE_WORDS (MEMORY_PAGE_BYTES >> 2)
 
 /**
- * Hook into stores to RAM.
- *
- * The first parameter is the address.
- * The second parameter is the value at the address before the store.
- * The third parameter is the desired value to store at the address.
+ * A memory in the address space, backed by lazily committed host memory.
  *
- * The function returns the data that will be stored, potentially different from the third parameter.
+ * The host only commits the pages that the simulation touches, so memories can be sized
+ * generously and many of them can exist at once.
  */
-extern std::function<uint32_t(uint32_t, uint32_t, uint32_t)> ram_store_hook;
+class memory_region {
+public:
+  /**
+   * Reserve a zero-filled memory.
+   *
+   * @param start The address of the first byte of the memory.
+   * @param size_bytes The size of the memory, a multiple of 4.
+   */
+  memory_region(uint32_t start, uint32_t size_bytes);
 
-#define FLASH_START 0x0
-#define FLASH_SIZE_BYTES (1 << 23) // 8 MB
-#define FLASH_SIZE_ELEMENTS (FLASH_SIZE_BYTES >> 2)
-#define FLASH_ADDRESS_MASK (((~0) << 23) ^ (~0))
+  ~memory_region();
 
-/**
- * Read-Only Memory.
- *
- * Typically used to store the application code.
- */
-extern uint32_t FLASH_MEMORY[FLASH_SIZE_ELEMENTS];
+  memory_region(memory_region const &) = delete;
+  memory_region &operator=(memory_region const &) = delete;
+
+  uint32_t start() const
+  {
+    return base;
+  }
+
+  uint32_t size_bytes() const
+  {
+    return size;
+  }
+
+  /**
+   * Whether or not an address is inside of the memory.
+   */
+  bool contains(uint32_t address) const
+  {
+    return address - base < size;
+  }
+
+  /**
+   * The word containing an address inside of the memory.
+   */
+  uint32_t &word(uint32_t address)
+  {
+    return words[(address - base) >> 2];
+  }
+
+  /**
+   * The word containing an address inside of the memory, for modifying it.
+   *
+   * While pages are saved, the page of the word is saved first if it was not yet. If the page
+   * holds cached code, the code hook is told about the word, see watch_code.
+   * Modifications through word, operator[], or data are not seen by save_pages or watch_code.
+   */
+  uint32_t &writable_word(uint32_t address)
+  {
+    auto const offset = address - base;
+    auto const page = offset / MEMORY_PAGE_BYTES;
+    if(((watched_pages[page >> 6] >> (page & 63)) & 0x1) != 0) {
+      page_written(offset);
+    }
+
+    return words[offset >> 2];
+  }
+
+  /**
+   * The bytes of a range inside of the memory, for modifying them at once.
+   *
+   * Like writable_word for every word of the range, except that the code hook is told about the
+   * modified bytes once per page.
+   *
+   * @param address The address of the first byte.
+   * @param bytes Number of bytes, all of them inside of the memory.
+   */
+  uint8_t *writable_bytes(uint32_t address, uint32_t bytes);
+
+  /**
+   * The word at an index from the start of the memory.
+   */
+  uint32_t &operator[](size_t index)
+  {
+    return words[index];
+  }
+
+  uint32_t *data()
+  {
+    return words;
+  }
+
+  /**
+   * Fill the memory with zeros again.
+   *
+   * Only the pages that were touched since the last clear are released, so this is cheap for
+   * large, sparsely used memories.
+   */
+  void clear();
+
+  /**
+   * Back the start of the memory with a private, copy-on-write mapping of a file.
+   *
+   * Memories mapping the same file share its pages until they store to them.
+   *
+   * @param descriptor The file to map, open for reading.
+   * @param bytes Number of bytes of the file to map, at most the size of the memory.
+   */
+  void map_file(int descriptor, size_t bytes);
+
+  /**
+   * Call a hook whenever a page holding cached code is modified, see mark_code.
+   *
+   * The hook receives the context and the address and size of the modified bytes. It is called
+   * before modifications through writable_word, and after restore_pages, clear, and map_file.
+   *
+   * @param hook The function to call, nullptr to stop calling one.
+   * @param context Passed to the hook as is.
+   */
+  void watch_code(void (*hook)(void *, uint32_t, uint32_t), void *context)
+  {
+    code_hook = hook;
+    code_hook_context = context;
+  }
+
+  /**
+   * Note that instructions from the page holding an address were cached.
+   *
+   * The page stays marked until the memory is cleared or mapped to a file.
+   */
+  void mark_code(uint32_t address)
+  {
+    auto const page = (address - base) / MEMORY_PAGE_BYTES;
+    auto const bit = uint64_t{1} << (page & 63);
+    code_pages[page >> 6] |= bit;
+    watched_pages[page >> 6] |= bit;
+  }
+
+  /**
+   * Mark the word containing an address as dirty, see dirty_word_count.
+   */
+  void mark_dirty(uint32_t address)
+  {
+    auto const index = (address - base) >> 2;
+    auto const bit = uint64_t{1} << (index & 63);
+    auto &bits = dirty_words[index >> 6];
+    if((bits & bit) != 0) {
+      return;
+    }
+
+    // The first dirty word of a group may be the first one of its page
+    if(bits == 0) {
+      auto const page = index / MEMORY_PAGE_WORDS;
+      auto &page_bits = dirty_page_bits[page >> 6];
+      auto const page_bit = uint64_t{1} << (page & 63);
+      if((page_bits & page_bit) == 0) {
+        page_bits |= page_bit;
+        dirty_page_list.push_back(page);
+      }
+    }
+
+    bits |= bit;
+    ++dirty_count;
+  }
+
+  /**
+   * Whether or not the word containing an address was marked dirty since clear_dirty.
+   */
+  bool is_dirty(uint32_t address) const
+  {
+    auto const index = (address - base) >> 2;
+
+    return ((dirty_words[index >> 6] >> (index & 63)) & 0x1) != 0;
+  }
+
+  /**
+   * Number of words marked dirty since clear_dirty.
+   *
+   * Stores to RAM mark the words they store to, whether or not the store changes the word.
+   */
+  size_t dirty_word_count() const
+  {
+    return dirty_count;
+  }
+
+  /**
+   * The pages holding dirty words, in the order they were first dirtied.
+   */
+  std::vector<uint32_t> const &dirty_pages() const
+  {
+    return dirty_page_list;
+  }
+
+  /**
+   * Call a function with the address of every dirty word, in time proportional to the dirty pages.
+   */
+  template <typename Visitor>
+  void for_each_dirty_word(Visitor &&visit) const
+  {
+    for(auto const page : dirty_page_list) {
+      auto const first = page * MEMORY_PAGE_WORDS;
+      for(uint32_t group = 0; group < MEMORY_PAGE_WORDS / 64; ++group) {
+        for(auto bits = dirty_words[(first >> 6) + group]; bits != 0; bits &= bits - 1) {
+          auto const index = first + group * 64 + static_cast<uint32_t>(__builtin_ctzll(bits));
+          visit(base + index * 4);
+        }
+      }
+    }
+  }
+
+  /**
+   * Forget which words are dirty, in time proportional to the dirty pages.
+   */
+  void clear_dirty();
+
+  /**
+   * Save the current contents of the memory, replacing what was saved before.
+   *
+   * Pages are copied on their first modification through writable_word afterwards,
+   * so this costs time proportional to the pages saved since the previous call.
+   */
+  void save_pages();
+
+  /**
+   * Put back the saved contents of the memory.
+   *
+   * The contents stay saved, so they can be restored again.
+   *
+   * @return The number of pages that were put back.
+   */
+  size_t restore_pages();
+
+  /**
+   * Stop saving pages and forget about the saved contents.
+   *
+   * Clearing or mapping a file into the memory also discards the saved pages.
+   */
+  void discard_saved_pages();
+
+  /**
+   * Write the contents of the memory to a state file, with its saved pages and dirty words.
+   *
+   * Pages of zeros are left out, see save_state.
+   *
+   * @param out The file to write to.
+   * @throws std::runtime_error If the file cannot be written.
+   */
+  void write_state(FILE *out) const;
+
+  /**
+   * Replace the contents, saved pages, and dirty words of the memory with those written by
+   * write_state.
+   *
+   * The code hook is called like for clear.
+   *
+   * @param in The file to read from.
+   * @throws std::runtime_error If the file cannot be read or holds another memory.
+   */
+  void read_state(FILE *in);
+
+private:
+  uint32_t base;
+  uint32_t size;
+  size_t mapped_bytes;
+  uint32_t *words;
+
+  /**
+   * Bit per page, set if the page must be saved before it is modified.
+   */
+  std::vector<uint64_t> pages_to_save;
+
+  /**
+   * Bit per page, set if code from the page was cached, see mark_code.
+   */
+  std::vector<uint64_t> code_pages;
+
+  /**
+   * Bit per page, set if the page is to be saved or holds code, so writable_word tests one bit.
+   */
+  std::vector<uint64_t> watched_pages;
+
+  void (*code_hook)(void *, uint32_t, uint32_t) = nullptr;
+  void *code_hook_context = nullptr;
+
+  /**
+   * The pages saved since save_pages, and their contents in the same order.
+   */
+  std::vector<uint32_t> saved_pages;
+  std::vector<uint32_t> saved_contents;
+
+  bool saving = false;
+
+  /**
+   * Bit per word, set if the word is dirty, and lazily committed like the memory.
+   */
+  uint64_t *dirty_words;
+
+  /**
+   * Bit per page, set if the page is in dirty_page_list.
+   */
+  std::vector<uint64_t> dirty_page_bits;
+  std::vector<uint32_t> dirty_page_list;
+
+  size_t dirty_count = 0;
+
+  void save_page(uint32_t page);
+  void page_written(uint32_t offset);
+  void code_modified(uint32_t page);
+  void forget_code();
+  void update_watched_pages();
+};
 
 /**
  * Fetch an instruction from memory.
@@ -73,6 +353,29 @@ void load(uint32_t address, uint32_t *value, uint32_t false_read);
  * @param value The data to store at that address.
  */
 void store(uint32_t address, uint32_t value);
+
+/**
+ * Load data from an address that is neither in RAM nor in FLASH.
+ *
+ * Dispatches to the device mapped to the address on the peripheral bus, any other address is
+ * fatal. False reads give 0 without reaching the device, so that the reads merging byte and
+ * halfword stores into words do not trigger the side effects of reading a register.
+ *
+ * @param address The address to load data from.
+ * @param value The data at that address.
+ * @param false_read true if this is a read due to anything other than the program.
+ */
+void load_peripheral(uint32_t address, uint32_t *value, uint32_t false_read);
+
+/**
+ * Store data to an address that is not in RAM.
+ *
+ * Handles FLASH and the devices on the peripheral bus, any other address is fatal.
+ *
+ * @param address The address to store the data to.
+ * @param value The data to store at that address.
+ */
+void store_outside_ram(uint32_t address, uint32_t value);
 }
 
 #endif
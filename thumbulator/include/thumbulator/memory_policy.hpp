@@ -0,0 +1,120 @@
+#ifndef THUMBULATOR_MEMORY_POLICY_H
+#define THUMBULATOR_MEMORY_POLICY_H
+
+#include <cstdint>
+
+#include "thumbulator/decode_cache.hpp"
+#include "thumbulator/exmemwb_mem.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/translation.hpp"
+
+namespace thumbulator {
+
+/**
+ * The memory policy that leaves accesses to RAM alone.
+ *
+ * A memory policy hooks into the accesses to RAM at compile time, by providing:
+ *
+ * uint32_t ram_load(uint32_t address, uint32_t data);
+ *   Called on loads with the address and the data that would be loaded.
+ *   Returns the data that will be loaded, potentially different than data.
+ *
+ * uint32_t ram_store(uint32_t address, uint32_t old_value, uint32_t value);
+ *   Called on stores with the address, the value at the address before the store,
+ *   and the desired value to store at the address.
+ *   Returns the data that will be stored, potentially different from value.
+ */
+struct no_memory_policy {
+  uint32_t ram_load(uint32_t /* address */, uint32_t data)
+  {
+    return data;
+  }
+
+  uint32_t ram_store(uint32_t /* address */, uint32_t /* old_value */, uint32_t value)
+  {
+    return value;
+  }
+};
+
+/**
+ * Pass the accesses to RAM of a machine through a memory policy.
+ *
+ * The memory instructions are instantiated for Policy, so its hooks are inlined into them.
+ *
+ * @param target The machine to hook into.
+ * @param policy The memory policy, which must outlive its use by the machine.
+ */
+template <typename Policy>
+void use_memory_policy(machine *target, Policy *policy)
+{
+  target->memory_policy = policy;
+  target->memory_instructions = &memory_handlers_of<Policy>::table;
+
+  target->ram_load_hook = [](void *hooks, uint32_t address, uint32_t data) -> uint32_t {
+    return static_cast<Policy *>(hooks)->ram_load(address, data);
+  };
+
+  target->ram_store_hook = [](void *hooks, uint32_t address, uint32_t old_value,
+      uint32_t value) -> uint32_t {
+    return static_cast<Policy *>(hooks)->ram_store(address, old_value, value);
+  };
+
+  // Decoded instructions are bound to the handlers of the previous policy
+  machine_binding binding(target);
+  flush_decode_cache();
+  flush_translations();
+}
+
+/**
+ * Let the accesses to RAM of a machine bypass its memory policy while in scope, like when
+ * fast-forwarding through a program.
+ *
+ * Switching policies drops the decoded and translated code, so bypasses should span many
+ * instructions. A machine without a memory policy is left alone.
+ */
+class memory_policy_bypass {
+public:
+  explicit memory_policy_bypass(machine *target)
+      : target(target)
+      , policy(target->memory_policy)
+      , instructions(target->memory_instructions)
+      , load_hook(target->ram_load_hook)
+      , store_hook(target->ram_store_hook)
+  {
+    if(instructions != &memory_handlers_of<no_memory_policy>::table) {
+      use_memory_policy(target, &unhooked);
+    }
+  }
+
+  ~memory_policy_bypass()
+  {
+    if(instructions == &memory_handlers_of<no_memory_policy>::table) {
+      return;
+    }
+
+    target->memory_policy = policy;
+    target->memory_instructions = instructions;
+    target->ram_load_hook = load_hook;
+    target->ram_store_hook = store_hook;
+
+    machine_binding binding(target);
+    flush_decode_cache();
+    flush_translations();
+  }
+
+  memory_policy_bypass(memory_policy_bypass const &) = delete;
+  memory_policy_bypass &operator=(memory_policy_bypass const &) = delete;
+
+private:
+  machine *target;
+  no_memory_policy unhooked;
+
+  // the policy to put back
+  void *policy;
+  memory_handlers const *instructions;
+  uint32_t (*load_hook)(void *, uint32_t, uint32_t);
+  uint32_t (*store_hook)(void *, uint32_t, uint32_t, uint32_t);
+};
+}
+
+#endif //THUMBULATOR_MEMORY_POLICY_H
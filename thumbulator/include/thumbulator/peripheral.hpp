@@ -0,0 +1,137 @@
+#ifndef THUMBULATOR_PERIPHERAL_HPP
+#define THUMBULATOR_PERIPHERAL_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace thumbulator {
+
+struct machine;
+
+/**
+ * The address of the UART data register.
+ */
+#define UART_ADDRESS 0xE0000000
+
+/**
+ * The address of the first register of the SYSTICK unit.
+ */
+#define SYSTICK_ADDRESS 0xE000E010
+
+/**
+ * Peripherals are found by the page of this size that their address is in.
+ */
+#define PERIPHERAL_PAGE_SHIFT 12
+
+/**
+ * A memory-mapped device, accessed by loads and stores that are neither in RAM nor in FLASH.
+ *
+ * The handlers operate on the machine bound to the calling thread, and can end the simulation
+ * with terminate_simulation. The state of the device is its own, it is not part of snapshots.
+ * Byte and halfword stores reach the store handler as words, with the other bytes from peek.
+ */
+struct peripheral_device {
+  /**
+   * Read the register at an address, nullptr if loads are fatal.
+   *
+   * The first parameter is the context, the second the address.
+   */
+  uint32_t (*load)(void *, uint32_t);
+
+  /**
+   * Read the register at an address without side effects, for the byte and halfword stores to
+   * merge into. nullptr if the register reads as 0 for them.
+   *
+   * The first parameter is the context, the second the address.
+   */
+  uint32_t (*peek)(void *, uint32_t);
+
+  /**
+   * Write the register at an address, nullptr if stores are fatal.
+   *
+   * The first parameter is the context, the others the address and the value.
+   */
+  void (*store)(void *, uint32_t, uint32_t);
+
+  void *context;
+};
+
+/**
+ * The devices of a machine by the address range they are mapped to.
+ *
+ * Devices are found through a two-level table of pages, so the cost of an access does not grow
+ * with the number of devices. Each page holds a list of the ranges in it, which has more than one
+ * entry only for the few pages that devices share. RAM and FLASH are not on the bus, so accesses
+ * to them never get here.
+ */
+class peripheral_bus {
+public:
+  peripheral_bus();
+
+  peripheral_bus(peripheral_bus const &) = delete;
+  peripheral_bus &operator=(peripheral_bus const &) = delete;
+
+  /**
+   * Map a device to a range of addresses.
+   *
+   * @param start The address of the first byte of the range.
+   * @param size_bytes The size of the range, at least 1.
+   * @param device The device, whose context must outlive its use by the bus.
+   * @throws std::invalid_argument If the range is empty, wraps around, or overlaps another one.
+   */
+  void map(uint32_t start, uint32_t size_bytes, peripheral_device const &device);
+
+  /**
+   * The device mapped to an address, nullptr if there is none.
+   */
+  peripheral_device const *find(uint32_t address) const;
+
+private:
+  struct mapping {
+    uint32_t start;
+    uint32_t size;
+    peripheral_device device;
+  };
+
+  /**
+   * An entry in the list of the ranges in a page.
+   */
+  struct page_link {
+    uint32_t mapping;
+
+    /**
+     * The next entry of the list, plus 1, 0 for none.
+     */
+    uint32_t next;
+  };
+
+  std::vector<mapping> mappings;
+
+  std::vector<page_link> links;
+
+  /**
+   * The first entry of the list of each page, plus 1, 0 for none, by the upper 10 bits of the
+   * address and then the page within them. Tables are only allocated for the parts with devices.
+   */
+  std::unique_ptr<std::unique_ptr<uint32_t[]>[]> pages;
+};
+
+/**
+ * Map a device to a range of addresses of a machine.
+ *
+ * Every machine starts out with the UART at UART_ADDRESS and the SYSTICK unit at
+ * SYSTICK_ADDRESS.
+ *
+ * @param target The machine to add the device to.
+ * @param start The address of the first byte of the range.
+ * @param size_bytes The size of the range, at least 1.
+ * @param device The device, whose context must outlive its use by the machine.
+ * @throws std::invalid_argument If the range is empty, wraps around, or overlaps RAM, FLASH, or
+ * another device.
+ */
+void map_peripheral(
+    machine *target, uint32_t start, uint32_t size_bytes, peripheral_device const &device);
+}
+
+#endif //THUMBULATOR_PERIPHERAL_HPP
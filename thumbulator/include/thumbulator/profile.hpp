@@ -0,0 +1,49 @@
+#ifndef THUMBULATOR_PROFILE_H
+#define THUMBULATOR_PROFILE_H
+
+#include <cstdint>
+#include <cstdio>
+
+namespace thumbulator {
+
+/**
+ * Instructions are counted by their upper 10 bits, which is enough to tell every handler apart.
+ */
+#define PROFILE_GROUP_SHIFT 6
+#define PROFILE_GROUPS (1 << (16 - PROFILE_GROUP_SHIFT))
+
+/**
+ * The executions and cycles of a group of instructions.
+ */
+struct profile_counter {
+  uint64_t executions;
+  uint64_t cycles;
+};
+
+/**
+ * What a machine spent its time on, counted per group of instructions.
+ *
+ * Only kept when the simulator is built with THUMBULATOR_PROFILE.
+ */
+struct execution_profile {
+  profile_counter groups[PROFILE_GROUPS];
+};
+
+/**
+ * Clear the profile of the machine bound to the calling thread.
+ */
+void reset_profile();
+
+/**
+ * Print the profile of the machine bound to the calling thread.
+ *
+ * The report lists the executions and cycles of each handler and of each value of the upper 6
+ * opcode bits, busiest first. Nothing is printed when the simulator is built without
+ * THUMBULATOR_PROFILE.
+ *
+ * @param out The stream to print to.
+ */
+void print_profile(FILE *out);
+}
+
+#endif //THUMBULATOR_PROFILE_H
@@ -0,0 +1,152 @@
+#ifndef THUMBULATOR_PROGRAM_H
+#define THUMBULATOR_PROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace thumbulator {
+
+struct machine;
+
+/**
+ * A named address in a program, from the symbol table of an ELF file.
+ */
+struct program_symbol {
+  std::string name;
+
+  /**
+   * The address of the symbol, without the Thumb bit for functions.
+   */
+  uint32_t address;
+
+  /**
+   * The size of the symbol in bytes, 0 if unknown.
+   */
+  uint32_t size;
+
+  /**
+   * true for functions, false for data objects.
+   */
+  bool function;
+};
+
+/**
+ * A part of a program that is placed into memory when loading it.
+ */
+struct program_segment {
+  /**
+   * The address the segment runs at.
+   */
+  uint32_t address;
+
+  /**
+   * The address the initial contents of the segment are stored at, usually in FLASH.
+   *
+   * Equal to address, unless the startup code copies the segment, like .data.
+   */
+  uint32_t load_address;
+
+  /**
+   * Number of bytes initialized from the file.
+   */
+  uint32_t file_bytes;
+
+  /**
+   * Number of bytes in memory, the ones past file_bytes are zero-filled, like .bss.
+   */
+  uint32_t memory_bytes;
+
+  /**
+   * Offset of the initial contents in the file.
+   */
+  uint32_t file_offset;
+};
+
+/**
+ * A program binary, either an ARM ELF executable or a raw image of FLASH.
+ *
+ * The file is mapped rather than read, and the FLASH contents are prepared once. Every machine the
+ * program is loaded into maps those contents copy-on-write, so machines running the same program
+ * share one copy of its FLASH until they store to it.
+ *
+ * The image is immutable once opened, so it can be loaded from many threads at once.
+ */
+class program_image {
+public:
+  /**
+   * Open a program binary.
+   *
+   * Files starting with the ELF magic number are loaded by segment, anything else is taken as
+   * a raw image of FLASH.
+   *
+   * @param path The path to the binary.
+   */
+  explicit program_image(char const *path);
+
+  ~program_image();
+
+  program_image(program_image const &) = delete;
+  program_image &operator=(program_image const &) = delete;
+
+  /**
+   * The segments of the program, a single segment at FLASH_START for raw images.
+   */
+  std::vector<program_segment> const &segments() const
+  {
+    return program_segments;
+  }
+
+  /**
+   * The function and object symbols of the program sorted by address, empty for raw images.
+   */
+  std::vector<program_symbol> const &symbols() const
+  {
+    return program_symbols;
+  }
+
+  /**
+   * Find the symbol an address belongs to.
+   *
+   * @param address The address to look up.
+   *
+   * @return The symbol that covers the address, nullptr if there is none.
+   */
+  program_symbol const *find_symbol(uint32_t address) const;
+
+  /**
+   * Place the program into the memories of a machine.
+   *
+   * FLASH is replaced with the program, and the segments that run from RAM are initialized.
+   * The rest of RAM is left alone. The snapshot and the decoded and translated code of
+   * the machine are dropped.
+   *
+   * @param target The machine to load the program into.
+   */
+  void load(machine *target) const;
+
+private:
+  /**
+   * The whole file, mapped read-only.
+   */
+  uint8_t const *file;
+  size_t file_bytes;
+
+  /**
+   * File holding the contents of FLASH, which machines map copy-on-write.
+   */
+  int flash_descriptor;
+  size_t flash_bytes;
+
+  std::vector<program_segment> program_segments;
+  std::vector<program_symbol> program_symbols;
+
+  void release();
+  void open_elf();
+  void read_symbols();
+  void prepare_flash(char const *path);
+};
+}
+
+#endif //THUMBULATOR_PROGRAM_H
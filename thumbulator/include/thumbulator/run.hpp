@@ -0,0 +1,71 @@
+#ifndef THUMBULATOR_RUN_H
+#define THUMBULATOR_RUN_H
+
+#include <cstdint>
+
+namespace thumbulator {
+
+/**
+ * Why run_until returned.
+ */
+enum stop_reason : uint8_t {
+  STOP_NONE,
+  STOP_EXIT,
+  STOP_CYCLE_BUDGET,
+  STOP_INSTRUCTION_BUDGET,
+  STOP_PERIPHERAL_ACCESS,
+  STOP_REQUESTED
+};
+
+/**
+ * The conditions under which run_until stops, besides the exit instruction.
+ */
+struct run_limits {
+  /**
+   * Stop once at least this many cycles were executed, UINT64_MAX for no limit.
+   */
+  uint64_t cycles;
+
+  /**
+   * Stop once this many instructions were executed, UINT64_MAX for no limit.
+   */
+  uint64_t instructions;
+
+  /**
+   * Stop after an instruction that accesses a peripheral, like the UART or SYSTICK.
+   */
+  bool stop_on_peripheral_access;
+};
+
+/**
+ * The work done by a call to run_until.
+ */
+struct run_result {
+  uint64_t instructions;
+  uint64_t cycles;
+  stop_reason reason;
+};
+
+/**
+ * Run the machine bound to the calling thread until one of the limits is reached, a stop is
+ * requested, or the exit instruction is executed, whichever comes first.
+ *
+ * The machine runs by basic block, like execute_block, but stops at the exact instruction that
+ * triggers the stop. The cycle budget is reached by the first instruction that brings the cycles
+ * executed to or past it, so the run may take up to MAX_INSTRUCTION_CYCLES - 1 more cycles.
+ *
+ * Like a sequence of single steps, this leaves the program counter at the next instruction + 4.
+ *
+ * @return The instructions and cycles executed, and why the run stopped.
+ */
+run_result run_until(run_limits const &limits);
+
+/**
+ * Make run_until stop after the executing instruction, e.g., from a memory policy hook.
+ *
+ * Requests made outside of run_until are ignored.
+ */
+void request_stop();
+}
+
+#endif //THUMBULATOR_RUN_H
@@ -0,0 +1,115 @@
+#ifndef THUMBULATOR_SAMPLER_H
+#define THUMBULATOR_SAMPLER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+namespace thumbulator {
+
+struct machine;
+class program_image;
+
+/**
+ * Samples where a machine spends its cycles, with the call stack leading there.
+ *
+ * Every period cycles the address of the next instruction is recorded together with the return
+ * addresses of the calls in progress. The calls are tracked through a shadow stack: bl and blx
+ * push a frame, bx and pop {pc} return to one. Frames are also dropped once the stack pointer
+ * rises above the one they were called with, so code that unwinds the stack in other ways, like
+ * longjmp or restoring a checkpoint, does not leave stale frames behind.
+ *
+ * Sampling is driven by the event schedule, so it costs nothing between samples besides keeping
+ * the shadow stack.
+ */
+class pc_sampler {
+public:
+  /**
+   * @param period_cycles Number of cycles between samples.
+   */
+  explicit pc_sampler(uint64_t period_cycles);
+
+  uint64_t period() const
+  {
+    return period_cycles;
+  }
+
+  /**
+   * Number of samples taken so far.
+   */
+  uint64_t samples() const
+  {
+    return sample_count;
+  }
+
+  /**
+   * Note a call, from bl or blx.
+   *
+   * @param return_address The address the call returns to, without the Thumb bit.
+   * @param sp The stack pointer at the call.
+   */
+  void call(uint32_t return_address, uint32_t sp);
+
+  /**
+   * Note a branch that may return from a call, from bx or pop {pc}.
+   *
+   * @param address The address branched to, without the Thumb bit.
+   * @param sp The stack pointer after the branch.
+   */
+  void return_to(uint32_t address, uint32_t sp);
+
+  /**
+   * Record a sample.
+   *
+   * @param pc The address of the next instruction.
+   * @param sp The current stack pointer.
+   */
+  void sample(uint32_t pc, uint32_t sp);
+
+  /**
+   * Write the samples as folded stacks, the input format of flame graph tools.
+   *
+   * Each line holds the functions from the outermost caller to the sampled one, separated by
+   * semicolons, and the number of samples taken there. Addresses without a symbol are written
+   * in hexadecimal.
+   *
+   * @param out The stream to write to.
+   * @param program The program the samples were taken from, to name the functions.
+   */
+  void write_folded(FILE *out, program_image const &program) const;
+
+private:
+  struct frame {
+    uint32_t return_address;
+    uint32_t sp;
+  };
+
+  uint64_t period_cycles;
+  uint64_t sample_count;
+
+  std::vector<frame> stack;
+
+  /**
+   * Number of samples per call stack, each stack being its return addresses and the sampled PC.
+   */
+  std::map<std::vector<uint32_t>, uint64_t> stacks;
+
+  void drop_returned_frames(uint32_t sp);
+};
+
+/**
+ * Start sampling a machine, replacing the sampler it used before.
+ *
+ * @param target The machine to sample.
+ * @param sampler The sampler, which must outlive its use by the machine.
+ */
+void start_sampling(machine *target, pc_sampler *sampler);
+
+/**
+ * Stop sampling a machine.
+ */
+void stop_sampling(machine *target);
+}
+
+#endif //THUMBULATOR_SAMPLER_H
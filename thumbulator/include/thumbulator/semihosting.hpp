@@ -0,0 +1,119 @@
+#ifndef THUMBULATOR_SEMIHOSTING_HPP
+#define THUMBULATOR_SEMIHOSTING_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace thumbulator {
+
+/**
+ * The immediate of the bkpt instruction that makes a semihosting call.
+ */
+#define SEMIHOSTING_BKPT 0xAB
+
+/**
+ * The semihosting operations that are supported, passed in r0.
+ */
+#define SYS_OPEN 0x01
+#define SYS_CLOSE 0x02
+#define SYS_WRITEC 0x03
+#define SYS_WRITE0 0x04
+#define SYS_WRITE 0x05
+#define SYS_READ 0x06
+#define SYS_READC 0x07
+#define SYS_ISERROR 0x08
+#define SYS_ISTTY 0x09
+#define SYS_SEEK 0x0A
+#define SYS_FLEN 0x0C
+#define SYS_CLOCK 0x10
+#define SYS_TIME 0x11
+#define SYS_ERRNO 0x13
+#define SYS_GET_CMDLINE 0x15
+#define SYS_EXIT 0x18
+
+/**
+ * The handles of the console, which is the UART of the machine.
+ */
+#define SEMIHOSTING_CONSOLE_INPUT 0
+#define SEMIHOSTING_CONSOLE_OUTPUT 1
+
+/**
+ * Serves the ARM semihosting calls of a machine, made with bkpt SEMIHOSTING_BKPT.
+ *
+ * The program passes the operation in r0 and its parameter, usually the address of a block of
+ * words, in r1. The result replaces r0. Files opened by the program are host files, the special
+ * file ":tt" is the console. Data moves between host files and the memories in one copy, like
+ * DMA: memory policies do not see it, while snapshots, dirty words, and cached code do.
+ *
+ * Without a host, bkpt does nothing. Other breakpoints do nothing either way.
+ */
+class semihosting_host {
+public:
+  /**
+   * @param command_line What SYS_GET_CMDLINE returns.
+   */
+  explicit semihosting_host(std::string command_line = "");
+
+  /**
+   * Close the files the program left open.
+   */
+  ~semihosting_host();
+
+  semihosting_host(semihosting_host const &) = delete;
+  semihosting_host &operator=(semihosting_host const &) = delete;
+
+  /**
+   * Serve a call on the machine bound to the calling thread.
+   *
+   * @param operation The operation, one of the SYS_ values.
+   * @param parameter The parameter of the operation.
+   * @return The result of the operation, 0xFFFFFFFF for unknown operations.
+   */
+  uint32_t call(uint32_t operation, uint32_t parameter);
+
+  /**
+   * Whether or not the program called SYS_EXIT.
+   */
+  bool exited() const
+  {
+    return exit_called;
+  }
+
+  /**
+   * The reason the program gave to SYS_EXIT, like 0x20026 for ADP_Stopped_ApplicationExit.
+   */
+  uint32_t exit_reason() const
+  {
+    return reason;
+  }
+
+private:
+  std::string command_line;
+
+  /**
+   * The files opened by the program, nullptr once closed, by handle after the console ones.
+   */
+  std::vector<FILE *> files;
+
+  /**
+   * The errno of the last operation that failed, see SYS_ERRNO.
+   */
+  int error;
+
+  bool exit_called;
+  uint32_t reason;
+
+  FILE *file(uint32_t handle) const;
+  uint32_t open(uint32_t name, uint32_t mode, uint32_t length);
+  uint32_t close(uint32_t handle);
+  uint32_t write(uint32_t handle, uint32_t data, uint32_t bytes);
+  uint32_t read(uint32_t handle, uint32_t data, uint32_t bytes);
+  uint32_t seek(uint32_t handle, uint32_t position);
+  uint32_t length(uint32_t handle);
+  uint32_t get_command_line(uint32_t parameter);
+};
+}
+
+#endif //THUMBULATOR_SEMIHOSTING_HPP
@@ -0,0 +1,33 @@
+#ifndef THUMBULATOR_SNAPSHOT_H
+#define THUMBULATOR_SNAPSHOT_H
+
+namespace thumbulator {
+
+/**
+ * Take a snapshot of the machine bound to the calling thread, replacing the previous one.
+ *
+ * The snapshot covers the CPU, SYSTICK, RAM, and FLASH. Memories are saved copy-on-write by
+ * page: a page is copied the first time it is modified after the snapshot. Taking a snapshot
+ * and restoring it therefore cost time proportional to the pages modified since the last
+ * snapshot, not to the size of the memories.
+ */
+void take_snapshot();
+
+/**
+ * Roll the machine bound to the calling thread back to its last snapshot.
+ *
+ * The snapshot is kept, so the machine can be rolled back to it again.
+ *
+ * @return true if there was a snapshot to roll back to, false otherwise.
+ */
+bool restore_snapshot();
+
+/**
+ * Forget the snapshot of the machine bound to the calling thread.
+ *
+ * Stores stop paying for snapshots afterwards. Loading a program also drops the snapshot.
+ */
+void drop_snapshot();
+}
+
+#endif //THUMBULATOR_SNAPSHOT_H
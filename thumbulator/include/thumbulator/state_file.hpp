@@ -0,0 +1,166 @@
+#ifndef THUMBULATOR_STATE_FILE_HPP
+#define THUMBULATOR_STATE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace thumbulator {
+
+struct cpu_state;
+
+#define STATE_FILE_MAGIC "THUMBSTA"
+#define STATE_FILE_VERSION 1
+
+/**
+ * Write the state of the machine bound to the calling thread to a file.
+ *
+ * The state covers the CPU, SYSTICK, the cycle count, the last snapshot, and RAM and FLASH with
+ * their saved pages and dirty words. Pages of zeros are left out, so the file grows with the
+ * memory the program uses rather than with the size of the memories. Peripherals other than
+ * SYSTICK, the memory policy, and the tracer and sampler are not part of the state.
+ *
+ * The state is written at the current position of the file, so that callers can put their own
+ * state around it.
+ *
+ * @param out The file to write to, open in binary mode.
+ * @throws std::runtime_error If the file cannot be written.
+ */
+void save_state(FILE *out);
+
+/**
+ * Put the machine bound to the calling thread in the state read from a file, see save_state.
+ *
+ * The machine must have memories of the sizes it had when the state was saved, and be built the
+ * same way. Loading the state drops the cached code, like loading a program does.
+ *
+ * @param in The file to read from, open in binary mode.
+ * @throws std::runtime_error If the file cannot be read or does not hold a matching state.
+ */
+void load_state(FILE *in);
+
+/**
+ * Write bytes to a state file.
+ *
+ * @throws std::runtime_error If the bytes cannot be written.
+ */
+inline void write_state_bytes(FILE *out, void const *data, size_t bytes)
+{
+  if(std::fwrite(data, 1, bytes, out) != bytes) {
+    throw std::runtime_error("Could not write state file.");
+  }
+}
+
+/**
+ * Read bytes from a state file.
+ *
+ * @throws std::runtime_error If the file ends before the bytes.
+ */
+inline void read_state_bytes(FILE *in, void *data, size_t bytes)
+{
+  if(std::fread(data, 1, bytes, in) != bytes) {
+    throw std::runtime_error("Truncated state file.");
+  }
+}
+
+/**
+ * Write a value to a state file, as it is in memory.
+ */
+template <typename T>
+inline void write_state_value(FILE *out, T const &value)
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written as is");
+  write_state_bytes(out, &value, sizeof(T));
+}
+
+/**
+ * Read a value written by write_state_value.
+ */
+template <typename T>
+inline T read_state_value(FILE *in)
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be read as is");
+  T value;
+  read_state_bytes(in, &value, sizeof(T));
+
+  return value;
+}
+
+/**
+ * Write a flag to a state file as one byte, whatever the size of bool.
+ */
+inline void write_state_flag(FILE *out, bool flag)
+{
+  write_state_value(out, static_cast<uint8_t>(flag ? 1 : 0));
+}
+
+/**
+ * Read a flag written by write_state_flag.
+ */
+inline bool read_state_flag(FILE *in)
+{
+  return read_state_value<uint8_t>(in) != 0;
+}
+
+/**
+ * Write a tag naming the part of a state file that follows, see expect_state_tag.
+ *
+ * @param version The version of the layout of the part, to change along with it.
+ */
+inline void write_state_tag(FILE *out, char const *tag, uint32_t version)
+{
+  auto const length = static_cast<uint32_t>(std::strlen(tag));
+  write_state_value(out, length);
+  write_state_bytes(out, tag, length);
+  write_state_value(out, version);
+}
+
+/**
+ * Read a tag written by write_state_tag.
+ *
+ * @param version The version of the layout of the part that can be read.
+ * @throws std::runtime_error If the tag is not the expected one, so the state belongs to
+ * something else, or the part was written in another version.
+ */
+inline void expect_state_tag(FILE *in, char const *tag, uint32_t version)
+{
+  auto const length = read_state_value<uint32_t>(in);
+  char read[64];
+  if(length != std::strlen(tag) || length > sizeof(read)) {
+    throw std::runtime_error(std::string("State file does not hold the state of ") + tag + ".");
+  }
+
+  read_state_bytes(in, read, length);
+  if(std::memcmp(read, tag, length) != 0) {
+    throw std::runtime_error(std::string("State file does not hold the state of ") + tag + ".");
+  }
+
+  auto const written = read_state_value<uint32_t>(in);
+  if(written != version) {
+    throw std::runtime_error(std::string("State file holds version ") + std::to_string(written) +
+                             " of the state of " + tag + ", not version " +
+                             std::to_string(version) + ".");
+  }
+}
+
+/**
+ * Write the registers of a CPU to a state file one by one, for the copies kept outside of the
+ * machine, like the backups of energy harvesting schemes.
+ *
+ * @throws std::runtime_error If the file cannot be written.
+ */
+void write_cpu_state(FILE *out, cpu_state const &cpu);
+
+/**
+ * Read the registers written by write_cpu_state.
+ *
+ * @throws std::runtime_error If the file ends before the registers.
+ */
+cpu_state read_cpu_state(FILE *in);
+}
+
+#endif //THUMBULATOR_STATE_FILE_HPP
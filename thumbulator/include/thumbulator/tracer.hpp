@@ -0,0 +1,178 @@
+#ifndef THUMBULATOR_TRACER_H
+#define THUMBULATOR_TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+namespace thumbulator {
+
+/**
+ * Flags of a trace record.
+ */
+#define TRACE_LOAD 0x1
+#define TRACE_STORE 0x2
+
+/**
+ * The execution of an instruction, as written to a trace file.
+ */
+struct trace_record {
+  /**
+   * The cycle the instruction started at, see machine::cycle_count.
+   */
+  uint64_t cycle;
+
+  /**
+   * The address of the instruction.
+   */
+  uint32_t pc;
+
+  /**
+   * The instruction, with the second half of 32-bit instructions in the upper 16 bits.
+   */
+  uint32_t opcode;
+
+  /**
+   * The address of the first memory access of the instruction, if flags say there was one.
+   */
+  uint32_t address;
+
+  /**
+   * The data loaded or stored by the first memory access.
+   */
+  uint32_t value;
+
+  /**
+   * The cycles taken by the instruction.
+   */
+  uint8_t cycles;
+
+  /**
+   * TRACE_LOAD or TRACE_STORE for instructions that access memory, 0 otherwise.
+   */
+  uint8_t flags;
+
+  uint8_t reserved[6];
+};
+
+static_assert(sizeof(trace_record) == 32, "Trace records must keep their size in files");
+
+/**
+ * The start of a trace file, followed by the records.
+ */
+struct trace_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_bytes;
+};
+
+#define TRACE_FILE_MAGIC "THUMBTRC"
+#define TRACE_FILE_VERSION 1
+
+/**
+ * Writes the instructions executed by a machine to a binary trace file.
+ *
+ * Records go into a lock-free ring buffer, which a background thread drains into the file. The
+ * simulation only waits for the writer when the buffer is full, so no record is ever dropped.
+ *
+ * Trace a machine by pointing its tracer at one, and stop by setting it back to nullptr. The
+ * tracer must be used by one machine at a time, and must outlive its use.
+ */
+class instruction_tracer {
+public:
+  /**
+   * Create a trace file and start the writer thread.
+   *
+   * @param path The path of the trace file.
+   * @param capacity Number of records the ring buffer holds, rounded up to a power of two.
+   */
+  explicit instruction_tracer(char const *path, size_t capacity = 1 << 16);
+
+  /**
+   * Write the remaining records and close the trace file.
+   */
+  ~instruction_tracer();
+
+  instruction_tracer(instruction_tracer const &) = delete;
+  instruction_tracer &operator=(instruction_tracer const &) = delete;
+
+  /**
+   * Add a record to the trace, waiting for room in the ring buffer if needed.
+   */
+  void record(trace_record const &entry)
+  {
+    auto const position = head.load(std::memory_order_relaxed);
+    if(position - known_tail == capacity) {
+      wait_for_room(position);
+    }
+
+    records[position & (capacity - 1)] = entry;
+    head.store(position + 1, std::memory_order_release);
+  }
+
+  /**
+   * Number of records added so far.
+   */
+  uint64_t recorded() const
+  {
+    return head.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * The record of the executing instruction, filled in while it executes.
+   */
+  trace_record pending;
+
+private:
+  FILE *file;
+  size_t capacity;
+  std::unique_ptr<trace_record[]> records;
+
+  /**
+   * Number of records added, only written by the simulation.
+   */
+  std::atomic<uint64_t> head;
+
+  /**
+   * The last value of tail seen by the simulation.
+   */
+  uint64_t known_tail;
+
+  // Keeps the counters of the two threads in separate cache lines
+  char separation[64];
+
+  /**
+   * Number of records written to the file, only written by the writer thread.
+   */
+  std::atomic<uint64_t> tail;
+
+  std::atomic<bool> stopping;
+  std::thread writer;
+
+  void wait_for_room(uint64_t position);
+  void write_records();
+};
+
+/**
+ * Note a memory access of the executing instruction, if the bound machine is being traced.
+ *
+ * Only the first access of an instruction is kept.
+ *
+ * @param tracer The tracer of the machine, nullptr if it is not being traced.
+ * @param flags TRACE_LOAD or TRACE_STORE.
+ */
+inline void trace_access(
+    instruction_tracer *tracer, uint32_t address, uint32_t value, uint8_t flags)
+{
+  if(tracer != nullptr && tracer->pending.flags == 0) {
+    tracer->pending.address = address;
+    tracer->pending.value = value;
+    tracer->pending.flags = flags;
+  }
+}
+}
+
+#endif //THUMBULATOR_TRACER_H
@@ -0,0 +1,78 @@
+#ifndef THUMBULATOR_TRANSLATION_H
+#define THUMBULATOR_TRANSLATION_H
+
+#include <cstdint>
+
+namespace thumbulator {
+
+/**
+ * Longest sequence of instructions translated into a single block.
+ */
+#define MAX_BLOCK_INSTRUCTIONS 64
+
+/**
+ * Most instructions executed by a single call to execute_block, in blocks run one after another.
+ */
+#define MAX_CHAINED_INSTRUCTIONS 1024
+
+/**
+ * The work done by a single call to execute_block.
+ */
+struct block_result {
+  /**
+   * Number of executed instructions.
+   */
+  uint32_t instructions;
+
+  /**
+   * Number of cycles taken.
+   */
+  uint32_t cycles;
+};
+
+/**
+ * Execute the basic block starting at the current program counter, and the blocks following it.
+ *
+ * Basic blocks in FLASH, and in RAM while the memory policy does not see instruction fetches, are
+ * translated once into an array of pre-decoded handler calls and run as one unit afterwards.
+ * Code that cannot be translated is executed one instruction at a time. Modifying the code drops
+ * its blocks again.
+ *
+ * Once translated, a block goes straight on to the block after it, until a block is not
+ * translated yet, the run stops, the program exits, code is modified, or MAX_CHAINED_INSTRUCTIONS
+ * would be exceeded.
+ *
+ * Like a sequence of single steps, this leaves the program counter at the next instruction + 4.
+ *
+ * @return The instructions and cycles executed.
+ */
+block_result execute_block();
+
+/**
+ * Execute the basic blocks starting at the current program counter, up to a number of instructions.
+ *
+ * A first block that is too long is cut short by executing a single instruction instead.
+ *
+ * @param max_instructions The most instructions to execute, at least 1.
+ *
+ * @return The instructions and cycles executed.
+ */
+block_result execute_block(uint32_t max_instructions);
+
+/**
+ * Drop the translated blocks overlapping the specified bytes.
+ *
+ * Stores and the other modifications seen by memory_region::watch_code do this on their own.
+ *
+ * @param address The address of the first modified byte.
+ * @param bytes Number of modified bytes.
+ */
+void invalidate_translations(uint32_t address, uint32_t bytes = 4);
+
+/**
+ * Drop all translated blocks, e.g., after loading a new program.
+ */
+void flush_translations();
+}
+
+#endif //THUMBULATOR_TRANSLATION_H
@@ -0,0 +1,135 @@
+#ifndef THUMBULATOR_UART_HPP
+#define THUMBULATOR_UART_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace thumbulator {
+
+/**
+ * Output is handed to the file of a UART in chunks of this size.
+ */
+#define UART_BUFFER_BYTES (1 << 12)
+
+/**
+ * What a load from the UART returns once its input is used up.
+ */
+#define UART_NO_INPUT 0xFFFFFFFF
+
+/**
+ * The serial port of a machine, mapped at UART_ADDRESS.
+ *
+ * Stores send their lowest byte, loads receive the next byte of input or UART_NO_INPUT. Output
+ * is kept in memory, or buffered on its way to a file so that the simulation does not call
+ * into the C library for every byte.
+ */
+class uart_port {
+public:
+  uart_port();
+
+  /**
+   * Flush the output buffered for the file, if any.
+   */
+  ~uart_port();
+
+  uart_port(uart_port const &) = delete;
+  uart_port &operator=(uart_port const &) = delete;
+
+  /**
+   * Send the output to a file from now on, starting with the output kept so far.
+   *
+   * @param out The file, which must stay open while the UART writes to it, nullptr to keep the
+   * output in memory again.
+   */
+  void write_to(FILE *out);
+
+  /**
+   * The output kept in memory, since the UART was created or the output cleared.
+   */
+  std::string const &output() const
+  {
+    return buffer;
+  }
+
+  void clear_output()
+  {
+    buffer.clear();
+  }
+
+  /**
+   * Hand the output buffered for the file over to it.
+   */
+  void flush();
+
+  /**
+   * Add bytes to receive after the input given so far.
+   */
+  void add_input(char const *data, size_t bytes);
+
+  /**
+   * Send a byte.
+   */
+  void put(char byte)
+  {
+    buffer.push_back(byte);
+    if(sink != nullptr && buffer.size() >= UART_BUFFER_BYTES) {
+      flush();
+    }
+  }
+
+  /**
+   * Send bytes.
+   */
+  void write(char const *data, size_t bytes);
+
+  /**
+   * Receive the next byte of input.
+   *
+   * @return The byte, or UART_NO_INPUT if there is none.
+   */
+  uint32_t get()
+  {
+    if(input_read == input.size()) {
+      return UART_NO_INPUT;
+    }
+
+    return static_cast<uint8_t>(input[input_read++]);
+  }
+
+  /**
+   * Receive bytes of input.
+   *
+   * @return Number of bytes received, less than asked for once the input is used up.
+   */
+  size_t read(char *data, size_t bytes);
+
+private:
+  /**
+   * The output, either kept or waiting for the file.
+   */
+  std::string buffer;
+
+  FILE *sink;
+
+  std::string input;
+  size_t input_read;
+};
+
+/**
+ * Load a register of a UART, the load handler of its peripheral_device.
+ *
+ * @param port The uart_port.
+ */
+uint32_t load_uart(void *port, uint32_t address);
+
+/**
+ * Store to a register of a UART, the store handler of its peripheral_device.
+ *
+ * @param port The uart_port.
+ */
+void store_uart(void *port, uint32_t address, uint32_t value);
+}
+
+#endif //THUMBULATOR_UART_HPP
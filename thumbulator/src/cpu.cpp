@@ -1,25 +1,29 @@
 #include "thumbulator/cpu.hpp"
 
+#include "thumbulator/disassemble.hpp"
+#include "thumbulator/exit.hpp"
 #include "thumbulator/memory.hpp"
+#include "thumbulator/tracer.hpp"
 #include "cpu_flags.hpp"
-#include "exit.hpp"
+#include "decode_table.hpp"
+#include "events.hpp"
+#include "exmemwb.hpp"
+#include "profile_counters.hpp"
+#include "systick.hpp"
 
 #include <cstring>
 
 namespace thumbulator {
 
-uint16_t insn;
-
-bool BRANCH_WAS_TAKEN = false;
-bool EXIT_INSTRUCTION_ENCOUNTERED = false;
-
 // Reset CPU state in accordance with B1.5.5 and B3.2.2
 void cpu_reset()
 {
   constexpr auto ESPR_T = (1 << 24);
 
+  auto &cpu = current_machine->cpu;
+
   // Initialize the special-purpose registers
-  cpu.apsr = 0;       // No flags set
+  cpu_set_apsr(0);    // No flags set
   cpu.ipsr = 0;       // No exception number
   cpu.espr = ESPR_T;  // Thumb mode
   cpu.primask = 0;    // No except priority boosting
@@ -51,263 +55,122 @@ void cpu_reset()
 
   // Check for attempts to go to ARM mode
   if((cpu_get_pc() & 0x1) == 0) {
-    printf("Error: Reset PC to an ARM address 0x%08X\n", cpu_get_pc());
-    terminate_simulation(1);
+    throw simulation_fault(FAULT_INTERWORKING, cpu_get_pc(), cpu_get_pc());
   }
 
   // Reset the SYSTICK unit
-  SYSTICK.control = 0x4;
-  SYSTICK.reload = 0x0;
-  SYSTICK.value = 0x0;
-  SYSTICK.calib = CPU_FREQ / 100 | 0x80000000;
+  systick_reset();
 }
 
-cpu_state cpu;
-system_tick SYSTICK;
-
-uint32_t adcs(decode_result const *);
-uint32_t adds_i3(decode_result const *);
-uint32_t adds_i8(decode_result const *);
-uint32_t adds_r(decode_result const *);
-uint32_t add_r(decode_result const *);
-uint32_t add_sp(decode_result const *);
-uint32_t adr(decode_result const *);
-uint32_t subs_i3(decode_result const *);
-uint32_t subs_i8(decode_result const *);
-uint32_t subs(decode_result const *);
-uint32_t sub_sp(decode_result const *);
-uint32_t sbcs(decode_result const *);
-uint32_t rsbs(decode_result const *);
-uint32_t muls(decode_result const *);
-uint32_t cmn(decode_result const *);
-uint32_t cmp_i(decode_result const *);
-uint32_t cmp_r(decode_result const *);
-uint32_t tst(decode_result const *);
-uint32_t b(decode_result const *);
-uint32_t b_c(decode_result const *);
-uint32_t blx(decode_result const *);
-uint32_t bx(decode_result const *);
-uint32_t bl(decode_result const *);
-uint32_t ands(decode_result const *);
-uint32_t bics(decode_result const *);
-uint32_t eors(decode_result const *);
-uint32_t orrs(decode_result const *);
-uint32_t mvns(decode_result const *);
-uint32_t asrs_i(decode_result const *);
-uint32_t asrs_r(decode_result const *);
-uint32_t lsls_i(decode_result const *);
-uint32_t lsrs_i(decode_result const *);
-uint32_t lsls_r(decode_result const *);
-uint32_t lsrs_r(decode_result const *);
-uint32_t rors(decode_result const *);
-uint32_t ldm(decode_result const *);
-uint32_t stm(decode_result const *);
-uint32_t pop(decode_result const *);
-uint32_t push(decode_result const *);
-uint32_t ldr_i(decode_result const *);
-uint32_t ldr_sp(decode_result const *);
-uint32_t ldr_lit(decode_result const *);
-uint32_t ldr_r(decode_result const *);
-uint32_t ldrb_i(decode_result const *);
-uint32_t ldrb_r(decode_result const *);
-uint32_t ldrh_i(decode_result const *);
-uint32_t ldrh_r(decode_result const *);
-uint32_t ldrsb_r(decode_result const *);
-uint32_t ldrsh_r(decode_result const *);
-uint32_t str_i(decode_result const *);
-uint32_t str_sp(decode_result const *);
-uint32_t str_r(decode_result const *);
-uint32_t strb_i(decode_result const *);
-uint32_t strb_r(decode_result const *);
-uint32_t strh_i(decode_result const *);
-uint32_t strh_r(decode_result const *);
-uint32_t movs_i(decode_result const *);
-uint32_t mov_r(decode_result const *);
-uint32_t movs_r(decode_result const *);
-uint32_t sxtb(decode_result const *);
-uint32_t sxth(decode_result const *);
-uint32_t uxtb(decode_result const *);
-uint32_t uxth(decode_result const *);
-uint32_t rev(decode_result const *);
-uint32_t rev16(decode_result const *);
-uint32_t revsh(decode_result const *);
-uint32_t breakpoint(decode_result const *);
 
 uint32_t exmemwb_error(decode_result const *decoded)
 {
-  fprintf(stderr, "Error: Unsupported instruction: Unable to execute\n");
-  terminate_simulation(1);
-  return 0;
+  terminate_simulation(FAULT_UNSUPPORTED_INSTRUCTION);
 }
 
 uint32_t exmemwb_exit_simulation(decode_result const *decoded)
 {
-  EXIT_INSTRUCTION_ENCOUNTERED = true;
+  current_machine->exit_instruction_encountered = true;
 
   return 0;
 }
 
-// Execute functions that require more opcode bits than the first 6
-uint32_t (*executeJumpTable6[2])(decode_result const *) = {
-    adds_r, /* 060 - 067 */
-    subs    /* 068 - 06F */
-};
-
-uint32_t entry6(decode_result const *decoded)
-{
-  return executeJumpTable6[(insn >> 9) & 0x1](decoded);
-}
-
-uint32_t (*executeJumpTable7[2])(decode_result const *) = {
-    adds_i3, /* (070 - 077) */
-    subs_i3  /* (078 - 07F) */
-};
-
-uint32_t entry7(decode_result const *decoded)
-{
-  return executeJumpTable7[(insn >> 9) & 0x1](decoded);
-}
-
-uint32_t (*executeJumpTable16[16])(decode_result const *) = {ands, eors, lsls_r, lsrs_r, asrs_r,
-    adcs, sbcs, rors, tst, rsbs, cmp_r, exmemwb_error, orrs, muls, bics, mvns};
-
-uint32_t entry16(decode_result const *decoded)
-{
-  return executeJumpTable16[(insn >> 6) & 0xF](decoded);
-}
-
-uint32_t (*executeJumpTable17[8])(decode_result const *) = {
-    add_r,        /* (110 - 113) */
-    add_r, cmp_r, /* (114 - 117) */
-    cmp_r, mov_r, /* (118 - 11B) */
-    mov_r, bx,    /* (11C - 11D) */
-    blx           /* (11E - 11F) */
-};
+// The handlers of the decode table, in the order of execute_handler_id
+execute_handler const execute_handlers[EXECUTE_HANDLER_COUNT] = {adcs, adds_i3, adds_i8, adds_r,
+    add_r, add_sp, adr, subs_i3, subs_i8, subs, sub_sp, sbcs, rsbs, muls, cmp_i, cmp_r, tst, b, b_c,
+    blx, bx, bl, ands, bics, eors, orrs, mvns, asrs_i, asrs_r, lsls_i, lsrs_i, lsls_r, lsrs_r, rors,
+    movs_i, mov_r, sxtb, sxth, uxtb, uxth, rev, rev16, breakpoint, exmemwb_error,
+    exmemwb_exit_simulation, exmemwb_error, ldm<no_memory_policy>, stm<no_memory_policy>,
+    pop<no_memory_policy>, push<no_memory_policy>, ldr_i<no_memory_policy>,
+    ldr_sp<no_memory_policy>, ldr_lit<no_memory_policy>, ldr_r<no_memory_policy>,
+    ldrb_i<no_memory_policy>, ldrb_r<no_memory_policy>, ldrh_i<no_memory_policy>,
+    ldrh_r<no_memory_policy>, ldrsb_r<no_memory_policy>, ldrsh_r<no_memory_policy>,
+    str_i<no_memory_policy>, str_sp<no_memory_policy>, str_r<no_memory_policy>,
+    strb_i<no_memory_policy>, strb_r<no_memory_policy>, strh_i<no_memory_policy>,
+    strh_r<no_memory_policy>};
 
-uint32_t entry17(decode_result const *decoded)
+execute_handler resolve_entry(uint16_t instruction)
 {
-  return executeJumpTable17[(insn >> 7) & 0x7](decoded);
+  return execute_handlers[decode_entries.entries[instruction].handler];
 }
 
-uint32_t (*executeJumpTable20[2])(decode_result const *) = {
-    str_r, /* (140 - 147) */
-    strh_r /* (148 - 14F) */
-};
-
-uint32_t entry20(decode_result const *decoded)
-{
-  return executeJumpTable20[(insn >> 9) & 0x1](decoded);
-}
-
-uint32_t (*executeJumpTable21[2])(decode_result const *) = {
-    strb_r, /* (150 - 157) */
-    ldrsb_r /* (158 - 15F) */
-};
-
-uint32_t entry21(decode_result const *decoded)
-{
-  return executeJumpTable21[(insn >> 9) & 0x1](decoded);
-}
+// The handlers of the memory instructions, in the order of their memory_handlers member
+execute_handler memory_handlers::*const memory_instruction_members[] = {&memory_handlers::ldm,
+    &memory_handlers::stm, &memory_handlers::pop, &memory_handlers::push, &memory_handlers::ldr_i,
+    &memory_handlers::ldr_sp, &memory_handlers::ldr_lit, &memory_handlers::ldr_r,
+    &memory_handlers::ldrb_i, &memory_handlers::ldrb_r, &memory_handlers::ldrh_i,
+    &memory_handlers::ldrh_r, &memory_handlers::ldrsb_r, &memory_handlers::ldrsh_r,
+    &memory_handlers::str_i, &memory_handlers::str_sp, &memory_handlers::str_r,
+    &memory_handlers::strb_i, &memory_handlers::strb_r, &memory_handlers::strh_i,
+    &memory_handlers::strh_r};
 
-uint32_t (*executeJumpTable22[2])(decode_result const *) = {
-    ldr_r, /* (160 - 167) */
-    ldrh_r /* (168 - 16F) */
-};
+static_assert(sizeof(memory_instruction_members) / sizeof(memory_instruction_members[0]) ==
+                  EXECUTE_HANDLER_COUNT - EXECUTE_FIRST_MEMORY,
+    "Every memory instruction of the decode table needs its memory_handlers member");
 
-uint32_t entry22(decode_result const *decoded)
+execute_handler resolve_handler(uint16_t instruction)
 {
-  return executeJumpTable22[(insn >> 9) & 0x1](decoded);
-}
+  auto const handler = decode_entries.entries[instruction].handler;
 
-uint32_t (*executeJumpTable23[2])(decode_result const *) = {
-    ldrb_r, /* (170 - 177) */
-    ldrsh_r /* (178 - 17F) */
-};
+  // The memory instructions go through the hooks of the machine's policy
+  if(handler >= EXECUTE_FIRST_MEMORY) {
+    auto const member = memory_instruction_members[handler - EXECUTE_FIRST_MEMORY];
+    return current_machine->memory_instructions->*member;
+  }
 
-uint32_t entry23(decode_result const *decoded)
-{
-  return executeJumpTable23[(insn >> 9) & 0x1](decoded);
+  return execute_handlers[handler];
 }
 
-uint32_t (*executeJumpTable44[16])(decode_result const *) = {add_sp, /* (2C0 - 2C1) */
-    add_sp, sub_sp,                                                  /* (2C2 - 2C3) */
-    sub_sp, exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error, sxth, sxtb, uxth, uxtb,
-    exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error};
-
-uint32_t entry44(decode_result const *decoded)
+// Execute an instruction and add its record to the trace of the machine
+static uint32_t exmemwb_traced(
+    execute_handler execute, uint16_t instruction, decode_result const *decoded)
 {
-  return executeJumpTable44[(insn >> 6) & 0xF](decoded);
-}
+  auto *const tracer = current_machine->tracer;
 
-uint32_t (*executeJumpTable46[16])(decode_result const *) = {exmemwb_error, exmemwb_error,
-    exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error, rev,
-    rev16, exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error, exmemwb_error,
-    exmemwb_error};
+  auto &pending = tracer->pending;
+  pending = trace_record{};
+  pending.cycle = current_machine->cycle_count;
+  pending.pc = (cpu_get_pc() - 0x4) & ~0x1u;
+  pending.opcode = instruction;
+  if(is_32bit_instruction(instruction)) {
+    uint16_t second_half;
+    fetch_instruction(pending.pc + 0x2, &second_half);
+    pending.opcode |= static_cast<uint32_t>(second_half) << 16;
+  }
 
-uint32_t entry46(decode_result const *decoded)
-{
-  return executeJumpTable46[(insn >> 6) & 0xF](decoded);
-}
+  uint32_t insnTicks = execute(decoded);
+  pending.cycles = static_cast<uint8_t>(insnTicks);
+  tracer->record(pending);
 
-uint32_t (*executeJumpTable47[2])(decode_result const *) = {
-    pop,       /* (2F0 - 2F7) */
-    breakpoint /* (2F8 - 2FB) */
-};
+  count_instruction(current_machine, instruction, insnTicks);
+  advance_cycles(insnTicks);
 
-uint32_t entry47(decode_result const *decoded)
-{
-  return executeJumpTable47[(insn >> 9) & 0x1](decoded);
+  return insnTicks;
 }
 
-uint32_t entry55(decode_result const *decoded)
+uint32_t exmemwb(uint16_t instruction, decode_result const *decoded)
 {
-  if((insn & 0x0300) != 0x0300) {
-    return b_c(decoded);
+  auto const handler = resolve_handler(instruction);
+  if(current_machine->tracer != nullptr) {
+    return exmemwb_traced(handler, instruction, decoded);
   }
 
-  if(insn == 0xDF01) {
-    return exmemwb_exit_simulation(decoded);
-  }
+  uint32_t insnTicks = handler(decoded);
+  count_instruction(current_machine, instruction, insnTicks);
+  advance_cycles(insnTicks);
 
-  return exmemwb_error(decoded);
+  return insnTicks;
 }
 
-uint32_t (*executeJumpTable[64])(decode_result const *) = {lsls_i, lsls_i, lsrs_i, lsrs_i, asrs_i,
-    asrs_i, entry6,                                                            /* 6 */
-    entry7,                                                                    /* 7 */
-    movs_i, movs_i, cmp_i, cmp_i, adds_i8, adds_i8, subs_i8, subs_i8, entry16, /* 16 */
-    entry17,                                                                   /* 17 */
-    ldr_lit, ldr_lit, entry20,                                                 /* 20 */
-    entry21,                                                                   /* 21 */
-    entry22,                                                                   /* 22 */
-    entry23,                                                                   /* 23 */
-    str_i, str_i, ldr_i, ldr_i, strb_i, strb_i, ldrb_i, ldrb_i, strh_i, strh_i, ldrh_i, ldrh_i,
-    str_sp, str_sp, ldr_sp, ldr_sp, adr, adr, add_sp, add_sp, entry44, /* 44 */
-    push, entry46,                                                     /* 46 */
-    entry47,                                                           /* 47 */
-    stm, stm, ldm, ldm, b_c, b_c, b_c, entry55,                        /* 55 */
-    b, b, exmemwb_error, exmemwb_error, bl,                            /* 60 ignore mrs */
-    bl,                                                                /* 61 ignore udef */
-    exmemwb_error, exmemwb_error};
-
-uint32_t exmemwb(uint16_t instruction, decode_result const *decoded)
+uint32_t exmemwb(decoded_instruction const *instruction)
 {
-  insn = instruction;
-
-  uint32_t insnTicks = executeJumpTable[instruction >> 10](decoded);
-
-  // Update the SYSTICK unit and look for resets
-  if(SYSTICK.control & 0x1) {
-    if(insnTicks >= SYSTICK.value) {
-      // Ignore resets due to reads
-      if(SYSTICK.value > 0)
-        SYSTICK.control |= 0x00010000;
-
-      SYSTICK.value = SYSTICK.reload - insnTicks + SYSTICK.value;
-    } else
-      SYSTICK.value -= insnTicks;
+  if(current_machine->tracer != nullptr) {
+    return exmemwb_traced(instruction->execute, instruction->instruction, &instruction->decoded);
   }
 
+  uint32_t insnTicks = instruction->execute(&instruction->decoded);
+  count_instruction(current_machine, instruction->instruction, insnTicks);
+  advance_cycles(insnTicks);
+
   return insnTicks;
-}
-}
+}}
@@ -2,6 +2,7 @@
 #define THUMBULATOR_CPU_FLAGS_H
 
 #include "thumbulator/cpu.hpp"
+#include "thumbulator/machine.hpp"
 
 namespace thumbulator {
 
@@ -15,68 +16,61 @@ namespace thumbulator {
 #define FLAG_C_MASK (1 << FLAG_C_INDEX)
 #define FLAG_V_MASK (1 << FLAG_V_INDEX)
 
-// GPRs with special functions
-#define GPR_SP 13
-#define GPR_LR 14
-#define cpu_get_sp() cpu_get_gpr(GPR_SP)
-#define cpu_set_sp(x) (cpu_set_gpr(GPR_SP, (x)))
-#define cpu_get_lr() cpu_get_gpr(GPR_LR)
-#define cpu_set_lr(x) cpu_set_gpr(GPR_LR, (x))
-
 // Get, set, and compute the CPU flags
-#define cpu_get_flag_z() ((cpu.apsr & FLAG_Z_MASK) >> FLAG_Z_INDEX)
-#define cpu_get_flag_n() ((cpu.apsr & FLAG_N_MASK) >> FLAG_N_INDEX)
-#define cpu_get_flag_c() ((cpu.apsr & FLAG_C_MASK) >> FLAG_C_INDEX)
-#define cpu_get_flag_v() ((cpu.apsr & FLAG_V_MASK) >> FLAG_V_INDEX)
-#define cpu_set_flag_z(x) cpu.apsr = ((((x)&0x1) << FLAG_Z_INDEX) | (cpu.apsr & ~FLAG_Z_MASK))
-#define cpu_set_flag_n(x) cpu.apsr = ((((x)&0x1) << FLAG_N_INDEX) | (cpu.apsr & ~FLAG_N_MASK))
-#define cpu_set_flag_c(x) cpu.apsr = ((((x)&0x1) << FLAG_C_INDEX) | (cpu.apsr & ~FLAG_C_MASK))
-#define cpu_set_flag_v(x) cpu.apsr = ((((x)&0x1) << FLAG_V_INDEX) | (cpu.apsr & ~FLAG_V_MASK))
+#define cpu_get_flag_z() (current_machine->cpu.flag_z == 0)
+#define cpu_get_flag_n() (current_machine->cpu.flag_n >> 31)
+#define cpu_get_flag_c() (current_machine->cpu.flag_c)
+#define cpu_get_flag_v() (current_machine->cpu.flag_v >> 31)
+#define cpu_set_flag_z(x) current_machine->cpu.flag_z = ((x)&0x1) ^ 0x1
+#define cpu_set_flag_n(x) current_machine->cpu.flag_n = ((x)&0x1) << 31
+#define cpu_set_flag_c(x) current_machine->cpu.flag_c = ((x)&0x1)
+#define cpu_set_flag_v(x) current_machine->cpu.flag_v = ((x)&0x1) << 31
 
-#define do_zflag(x) cpu_set_flag_z(((x) == 0) ? 1 : 0)
-#define do_nflag(x) cpu_set_flag_n((x) >> 31)
-#define do_vflag(a, b, r) \
-  cpu_set_flag_v(         \
-      (((a) >> 31) & ((b) >> 31) & ~((r) >> 31)) | (~((a) >> 31) & ~((b) >> 31) & ((r) >> 31)))
+#define do_zflag(x) current_machine->cpu.flag_z = (x)
+#define do_nflag(x) current_machine->cpu.flag_n = (x)
+#define do_vflag(a, b, r) current_machine->cpu.flag_v = ~((a) ^ (b)) & ((a) ^ (r))
 
-static void do_cflag(uint32_t a, uint32_t b, uint32_t carry)
+static inline void do_cflag(uint32_t a, uint32_t b, uint32_t carry)
 {
-  uint32_t result;
+  cpu_set_flag_c((static_cast<uint64_t>(a) + b + carry) >> 32);
+}
 
-  result = (a & 0x7FFFFFFF) + (b & 0x7FFFFFFF) + carry; //carry in
-  result = (result >> 31) + (a >> 31) + (b >> 31);      //carry out
-  cpu_set_flag_c(result >> 1);
+// Pack the flags into the APSR, or unpack them from it
+static inline uint32_t cpu_get_apsr()
+{
+  return (cpu_get_flag_n() << FLAG_N_INDEX) | (cpu_get_flag_z() << FLAG_Z_INDEX) |
+         (cpu_get_flag_c() << FLAG_C_INDEX) | (cpu_get_flag_v() << FLAG_V_INDEX);
 }
 
-#define cpu_get_apsr() (cpu.apsr)
-#define cpu_set_apsr(x) cpu.apsr = (x)
+static inline void cpu_set_apsr(uint32_t apsr)
+{
+  cpu_set_flag_n(apsr >> FLAG_N_INDEX);
+  cpu_set_flag_z(apsr >> FLAG_Z_INDEX);
+  cpu_set_flag_c(apsr >> FLAG_C_INDEX);
+  cpu_set_flag_v(apsr >> FLAG_V_INDEX);
+}
 
 // Other SPR
 #define CPU_MODE_HANDLER 0
 #define CPU_MODE_THREAD 1
-#define cpu_mode_is_handler() (cpu.mode == 0x0)
-#define cpu_mode_is_thread() (cpu.mode == 0x1)
-#define cpu_mode_handler() cpu.mode = (0x0)
-#define cpu_mode_thread() cpu.mode = (0x1)
-#define cpu_get_ipsr() (cpu.ipsr)
-#define cpu_set_ipsr(x) cpu.ipsr = (x & 0x1F)
+#define cpu_mode_is_handler() (current_machine->cpu.mode == 0x0)
+#define cpu_mode_is_thread() (current_machine->cpu.mode == 0x1)
+#define cpu_mode_handler() current_machine->cpu.mode = (0x0)
+#define cpu_mode_thread() current_machine->cpu.mode = (0x1)
+#define cpu_get_ipsr() (current_machine->cpu.ipsr)
+#define cpu_set_ipsr(x) current_machine->cpu.ipsr = (x & 0x1F)
 #define CPU_STACK_MAIN 0
 #define CPU_STACK_PROCESS 1
-#define cpu_stack_is_main() ((cpu.control & 0x2) == 0x0)
+#define cpu_stack_is_main() ((current_machine->cpu.control & 0x2) == 0x0)
 #define cpu_stack_is_process() (~cpu_stack_is_main())
-#define cpu_stack_use_main() cpu.control = (cpu.control & ~0x2)
-#define cpu_stack_use_process() cpu.control = (cpu.control | 0x2)
-
-// Sign extension
-#define zeroExtend32(x) (x)
-#define signExtend32(x, n) \
-  (((((x) >> ((n)-1)) & 0x1) != 0) ? (~((unsigned int)0) << (n)) | (x) : (x))
+#define cpu_stack_use_main() current_machine->cpu.control = (current_machine->cpu.control & ~0x2)
+#define cpu_stack_use_process() current_machine->cpu.control = (current_machine->cpu.control | 0x2)
 
 // Special write to PC
-#define alu_write_pc(x)    \
-  do {                     \
-    BRANCH_WAS_TAKEN = 1;  \
-    cpu_set_pc((x) | 0x1); \
+#define alu_write_pc(x)                    \
+  do {                                     \
+    current_machine->branch_was_taken = 1; \
+    cpu_set_pc((x) | 0x1);                 \
   } while(0)
 }
 #endif //THUMBULATOR_CPU_FLAGS_H
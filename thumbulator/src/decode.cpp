@@ -1,17 +1,18 @@
 #include "thumbulator/decode.hpp"
 
 #include "thumbulator/cpu.hpp"
+#include "thumbulator/exit.hpp"
 #include "thumbulator/memory.hpp"
 
 #include "cpu_flags.hpp"
-#include "exit.hpp"
+#include "decode_table.hpp"
 
 namespace thumbulator {
 
 // Various decodings
-decode_result decode_3lo(const uint16_t pInsn)
+static constexpr decode_result decode_3lo(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = pInsn & 0x7;
   decoded.Rn = (pInsn >> 3) & 0x7;
@@ -20,9 +21,9 @@ decode_result decode_3lo(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_2loimm5(const uint16_t pInsn)
+static constexpr decode_result decode_2loimm5(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = pInsn & 0x7;
   decoded.Rm = (pInsn >> 3) & 0x7;
@@ -32,9 +33,9 @@ decode_result decode_2loimm5(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_2loimm3(const uint16_t pInsn)
+static constexpr decode_result decode_2loimm3(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = pInsn & 0x7;
   decoded.Rm = (pInsn >> 3) & 0x7; // Just to be safe
@@ -44,9 +45,9 @@ decode_result decode_2loimm3(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_2lo(const uint16_t pInsn)
+static constexpr decode_result decode_2lo(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = pInsn & 0x7;
   decoded.Rm = (pInsn >> 3) & 0x7;
@@ -55,9 +56,9 @@ decode_result decode_2lo(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_imm8lo(const uint16_t pInsn)
+static constexpr decode_result decode_imm8lo(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = (pInsn >> 8) & 0x7;
   decoded.Rm = decoded.Rd; // Just to be safe
@@ -67,18 +68,18 @@ decode_result decode_imm8lo(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_imm8(const uint16_t pInsn)
+static constexpr decode_result decode_imm8(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.imm = pInsn & 0xFF;
 
   return decoded;
 }
 
-decode_result decode_imm8c(const uint16_t pInsn)
+static constexpr decode_result decode_imm8c(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.imm = pInsn & 0xFF;
   decoded.cond = (pInsn >> 8) & 0xF;
@@ -86,9 +87,9 @@ decode_result decode_imm8c(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_imm7(const uint16_t pInsn)
+static constexpr decode_result decode_imm7(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = GPR_SP;
   decoded.imm = pInsn & 0x7F;
@@ -96,18 +97,18 @@ decode_result decode_imm7(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_imm11(const uint16_t pInsn)
+static constexpr decode_result decode_imm11(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.imm = pInsn & 0x7FF;
 
   return decoded;
 }
 
-decode_result decode_reglistlo(const uint16_t pInsn)
+static constexpr decode_result decode_reglistlo(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rn = (pInsn >> 8) & 0x7;
   decoded.register_list = pInsn & 0xFF;
@@ -115,30 +116,27 @@ decode_result decode_reglistlo(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_pop(const uint16_t pInsn)
+static constexpr decode_result decode_pop(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.register_list = ((pInsn & 0x100) << 7) | (pInsn & 0xFF);
 
   return decoded;
 }
 
-decode_result decode_push(const uint16_t pInsn)
+static constexpr decode_result decode_push(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.register_list = (pInsn & 0xFF) | ((pInsn & 0x100) << 6);
 
   return decoded;
 }
 
-decode_result decode_bl(const uint16_t pInsn)
+static decode_result decode_bl(const uint16_t pInsn, const uint16_t secondHalf)
 {
-  decode_result decoded;
-
-  uint16_t secondHalf;
-  fetch_instruction(cpu_get_pc() - 0x2, &secondHalf);
+  decode_result decoded{};
 
   uint32_t S = (pInsn >> 10) & 0x1;
   uint32_t J1 = (secondHalf >> 13) & 0x1;
@@ -153,18 +151,18 @@ decode_result decode_bl(const uint16_t pInsn)
   return decoded;
 }
 
-decode_result decode_1all(const uint16_t pInsn)
+static constexpr decode_result decode_1all(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rm = (pInsn >> 3) & 0xF;
 
   return decoded;
 }
 
-decode_result decode_mov_r(const uint16_t pInsn)
+static constexpr decode_result decode_mov_r(const uint16_t pInsn)
 {
-  decode_result decoded;
+  decode_result decoded{};
 
   decoded.Rd = (pInsn & 0x7) | ((pInsn & 0x80) >> 4);
   decoded.Rn = decoded.Rd;
@@ -173,72 +171,214 @@ decode_result decode_mov_r(const uint16_t pInsn)
   return decoded;
 }
 
-// Stop simulation if we cannot decode the instruction
-decode_result decode_error(const uint16_t pInsn)
+// Handlers that need more opcode bits than the first 6
+static constexpr execute_handler_id data_processing_handlers[16] = {EXECUTE_ANDS, EXECUTE_EORS,
+    EXECUTE_LSLS_R, EXECUTE_LSRS_R, EXECUTE_ASRS_R, EXECUTE_ADCS, EXECUTE_SBCS, EXECUTE_RORS,
+    EXECUTE_TST, EXECUTE_RSBS, EXECUTE_CMP_R, EXECUTE_ERROR, EXECUTE_ORRS, EXECUTE_MULS,
+    EXECUTE_BICS, EXECUTE_MVNS};
+
+static constexpr execute_handler_id special_data_handlers[8] = {
+    EXECUTE_ADD_R,                /* (110 - 113) */
+    EXECUTE_ADD_R, EXECUTE_CMP_R, /* (114 - 117) */
+    EXECUTE_CMP_R, EXECUTE_MOV_R, /* (118 - 11B) */
+    EXECUTE_MOV_R, EXECUTE_BX,    /* (11C - 11D) */
+    EXECUTE_BLX                   /* (11E - 11F) */
+};
+
+static constexpr execute_handler_id misc_handlers44[16] = {EXECUTE_ADD_SP, /* (2C0 - 2C1) */
+    EXECUTE_ADD_SP, EXECUTE_SUB_SP,                                        /* (2C2 - 2C3) */
+    EXECUTE_SUB_SP, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_SXTH,
+    EXECUTE_SXTB, EXECUTE_UXTH, EXECUTE_UXTB, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR,
+    EXECUTE_ERROR};
+
+static constexpr execute_handler_id misc_handlers46[16] = {EXECUTE_ERROR, EXECUTE_ERROR,
+    EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR,
+    EXECUTE_REV, EXECUTE_REV16, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR, EXECUTE_ERROR,
+    EXECUTE_ERROR, EXECUTE_ERROR};
+
+static constexpr decode_entry entry(execute_handler_id handler, decode_result decoded)
+{
+  return decode_entry{handler, decoded.Rd, decoded.Rm, decoded.Rn,
+      static_cast<uint8_t>(decoded.cond), static_cast<uint16_t>(decoded.imm),
+      static_cast<uint16_t>(decoded.register_list)};
+}
+
+// Picks one of two handlers by bit 9 of the instruction
+static constexpr execute_handler_id by_bit9(
+    const uint16_t pInsn, execute_handler_id clear, execute_handler_id set)
 {
-  fprintf(stderr, "Error: Malformed instruction: Unable to decode: 0x%4.4X at 0x%08X\n", pInsn,
-      cpu_get_pc() - 4);
-  terminate_simulation(1);
+  return ((pInsn >> 9) & 0x1) != 0 ? set : clear;
 }
 
-// Decode functions that require more opcode bits than the first 6
-decode_result (*decodeJumpTable17[4])(const uint16_t pInsn) = {
-    decode_mov_r,               /* 01_0001_0XXX (110 - 117) */
-    decode_mov_r, decode_mov_r, /* 01_0001_10XX (118 - 11B) */
-    decode_1all                 /* 01_0001_11XX (11C - 11F) */
-};
+// The handler and decoding of an instruction, from the first 6 opcode bits and as many more as
+// the instruction needs
+static constexpr decode_entry decode_entry_of(const uint16_t pInsn)
+{
+  switch(pInsn >> 10) {
+  case 0:
+  case 1:
+    return entry(EXECUTE_LSLS_I, decode_2loimm5(pInsn));
+  case 2:
+  case 3:
+    return entry(EXECUTE_LSRS_I, decode_2loimm5(pInsn));
+  case 4:
+  case 5:
+    return entry(EXECUTE_ASRS_I, decode_2loimm5(pInsn));
+  case 6:
+    return entry(by_bit9(pInsn, EXECUTE_ADDS_R, EXECUTE_SUBS), decode_3lo(pInsn));
+  case 7:
+    return entry(by_bit9(pInsn, EXECUTE_ADDS_I3, EXECUTE_SUBS_I3), decode_2loimm3(pInsn));
+  case 8:
+  case 9:
+    return entry(EXECUTE_MOVS_I, decode_imm8lo(pInsn));
+  case 10:
+  case 11:
+    return entry(EXECUTE_CMP_I, decode_imm8lo(pInsn));
+  case 12:
+  case 13:
+    return entry(EXECUTE_ADDS_I8, decode_imm8lo(pInsn));
+  case 14:
+  case 15:
+    return entry(EXECUTE_SUBS_I8, decode_imm8lo(pInsn));
+  case 16: /* A5.2.2 - these are all decoded the same */
+    return entry(data_processing_handlers[(pInsn >> 6) & 0xF], decode_2lo(pInsn));
+  case 17: {
+    auto const handler = special_data_handlers[(pInsn >> 7) & 0x7];
+    if(((pInsn >> 8) & 0x3) == 0x3) {
+      return entry(handler, decode_1all(pInsn)); /* 01_0001_11XX (11C - 11F) */
+    }
+    return entry(handler, decode_mov_r(pInsn));
+  }
+  case 18:
+  case 19:
+    return entry(EXECUTE_LDR_LIT, decode_imm8lo(pInsn));
+  case 20:
+    return entry(by_bit9(pInsn, EXECUTE_STR_R, EXECUTE_STRH_R), decode_3lo(pInsn));
+  case 21:
+    return entry(by_bit9(pInsn, EXECUTE_STRB_R, EXECUTE_LDRSB_R), decode_3lo(pInsn));
+  case 22:
+    return entry(by_bit9(pInsn, EXECUTE_LDR_R, EXECUTE_LDRH_R), decode_3lo(pInsn));
+  case 23:
+    return entry(by_bit9(pInsn, EXECUTE_LDRB_R, EXECUTE_LDRSH_R), decode_3lo(pInsn));
+  case 24:
+  case 25:
+    return entry(EXECUTE_STR_I, decode_2loimm5(pInsn));
+  case 26:
+  case 27:
+    return entry(EXECUTE_LDR_I, decode_2loimm5(pInsn));
+  case 28:
+  case 29:
+    return entry(EXECUTE_STRB_I, decode_2loimm5(pInsn));
+  case 30:
+  case 31:
+    return entry(EXECUTE_LDRB_I, decode_2loimm5(pInsn));
+  case 32:
+  case 33:
+    return entry(EXECUTE_STRH_I, decode_2loimm5(pInsn));
+  case 34:
+  case 35:
+    return entry(EXECUTE_LDRH_I, decode_2loimm5(pInsn));
+  case 36:
+  case 37:
+    return entry(EXECUTE_STR_SP, decode_imm8lo(pInsn));
+  case 38:
+  case 39:
+    return entry(EXECUTE_LDR_SP, decode_imm8lo(pInsn));
+  case 40:
+  case 41:
+    return entry(EXECUTE_ADR, decode_imm8lo(pInsn));
+  case 42:
+  case 43:
+    return entry(EXECUTE_ADD_SP, decode_imm8lo(pInsn));
+  case 44: {
+    auto const handler = misc_handlers44[(pInsn >> 6) & 0xF];
+    switch((pInsn >> 8) & 0x3) {
+    case 0:
+      return entry(handler, decode_imm7(pInsn)); /* 10_1100_00XX (2C0 - 2C3) */
+    case 2:
+      return entry(handler, decode_2lo(pInsn)); /* 10_1100_10XX (2C8 - 2CB) */
+    default:
+      return entry(EXECUTE_UNDEFINED, decode_result{});
+    }
+  }
+  case 45:
+    return entry(EXECUTE_PUSH, decode_push(pInsn));
+  case 46:
+    return entry(misc_handlers46[(pInsn >> 6) & 0xF], decode_2lo(pInsn));
+  case 47:
+    switch((pInsn >> 8) & 0x3) {
+    case 0:
+    case 1:
+      return entry(EXECUTE_POP, decode_pop(pInsn)); /* 10_1111_0XXX (2F0 - 2F7) */
+    case 2:
+      return entry(EXECUTE_BREAKPOINT, decode_imm8(pInsn)); /* 10_1111_10XX (2F8 - 2FB) */
+    default:
+      return entry(EXECUTE_UNDEFINED, decode_result{});
+    }
+  case 48:
+  case 49:
+    return entry(EXECUTE_STM, decode_reglistlo(pInsn));
+  case 50:
+  case 51:
+    return entry(EXECUTE_LDM, decode_reglistlo(pInsn));
+  case 52:
+  case 53:
+  case 54:
+    return entry(EXECUTE_B_C, decode_imm8c(pInsn));
+  case 55:
+    if((pInsn & 0x0300) != 0x0300) {
+      return entry(EXECUTE_B_C, decode_imm8c(pInsn));
+    }
+    if(pInsn == 0xDF01) {
+      return entry(EXECUTE_EXIT_SIMULATION, decode_imm8c(pInsn));
+    }
+    return entry(EXECUTE_ERROR, decode_imm8c(pInsn));
+  case 56:
+  case 57:
+    return entry(EXECUTE_B, decode_imm11(pInsn));
+  case 60: /* Ignore other possible decodings */
+  case 61: /* Ignore other possible decodings */
+    // The immediate is put together by decode, from both halves
+    return entry(EXECUTE_BL, decode_result{});
+  default:
+    return entry(EXECUTE_UNDEFINED, decode_result{});
+  }
+}
+
+static constexpr decode_table build_decode_table()
+{
+  decode_table table{};
+  for(uint32_t instruction = 0; instruction < 0x10000; ++instruction) {
+    table.entries[instruction] = decode_entry_of(static_cast<uint16_t>(instruction));
+  }
+
+  return table;
+}
 
-decode_result (*decodeJumpTable44[4])(const uint16_t pInsn) = {
-    decode_imm7,              /* 10_1100_00XX (2C0 - 2C3) */
-    decode_error, decode_2lo, /* 10_1100_10XX (2C8 - 2CB) */
-    decode_error};
-
-decode_result (*decodeJumpTable47[4])(const uint16_t pInsn) = {
-    decode_pop,              /* 10_1111_0XXX (2F0 - 2F7) */
-    decode_pop, decode_imm8, /* 10_1111_10XX (2F8 - 2FB) */
-    decode_error};
-
-decode_result decode_17(const uint16_t pInsn)
-{
-  decodeJumpTable17[(pInsn >> 8) & 0x3](pInsn);
-}
-decode_result decode_44(const uint16_t pInsn)
-{
-  decodeJumpTable44[(pInsn >> 8) & 0x3](pInsn);
-}
-decode_result decode_47(const uint16_t pInsn)
-{
-  decodeJumpTable47[(pInsn >> 8) & 0x3](pInsn);
-}
-
-// Use a table of function pointers indexed by the instruction
-// to make decoding fast
-// Indices 16, 17, 44, 47, 60, and 62 have multiple conflicting
-// decodings that need to be resolved outside the jump table
-decode_result (*decodeJumpTable[64])(const uint16_t pInsn) = {decode_2loimm5, decode_2loimm5,
-    decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_3lo, decode_2loimm3,
-    decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo,
-    decode_imm8lo, decode_imm8lo, decode_2lo, /* A5.2.2 - these are all decoded the same */
-    decode_17,                                /* 17 */
-    decode_imm8lo, decode_imm8lo, decode_3lo, decode_3lo, decode_3lo, decode_3lo, decode_2loimm5,
-    decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5,
-    decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_2loimm5, decode_imm8lo,
-    decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo, decode_imm8lo,
-    decode_imm8lo, decode_44,           /* 44 */
-    decode_push, decode_2lo, decode_47, /* 47 */
-    decode_reglistlo, decode_reglistlo, decode_reglistlo, decode_reglistlo, decode_imm8c,
-    decode_imm8c, decode_imm8c, decode_imm8c, decode_imm11, decode_imm11, decode_error, /* 58 */
-    decode_error,                                                                       /* 59 */
-    decode_bl, /* Ignore other possible decodings */
-    decode_bl, /* Ignore other possible decodings */
-    decode_error, decode_error};
-
-// Decoding is a matter of indexing the decode jump tabel
-// using the first 6 instruction opcode bits and then
-// executing the function pointed to
-// The decode functions update the global decode structure
-decode_result decode(const uint16_t instruction)
-{
-  return decodeJumpTable[instruction >> 10](instruction);
+// Every instruction is decoded while compiling, so decoding is a single lookup
+constexpr decode_table decode_entries = build_decode_table();
+
+decode_result decode(const uint16_t instruction, const uint16_t second_half)
+{
+  auto const &entry = decode_entries.entries[instruction];
+  switch(entry.handler) {
+  case EXECUTE_UNDEFINED:
+    // Stop simulation if we cannot decode the instruction
+    terminate_simulation(FAULT_UNDEFINED_INSTRUCTION);
+  case EXECUTE_BL:
+    return decode_bl(instruction, second_half);
+  default:
+    break;
+  }
+
+  decode_result decoded;
+  decoded.Rd = entry.Rd;
+  decoded.Rm = entry.Rm;
+  decoded.Rn = entry.Rn;
+  decoded.imm = entry.imm;
+  decoded.cond = entry.cond;
+  decoded.register_list = entry.register_list;
+
+  return decoded;
 }
 }
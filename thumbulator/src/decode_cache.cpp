@@ -0,0 +1,133 @@
+#include "thumbulator/decode_cache.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/disassemble.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory.hpp"
+#include "thumbulator/memory_policy.hpp"
+#include "thumbulator/translation.hpp"
+
+#include "machine_caches.hpp"
+
+#include <algorithm>
+
+namespace thumbulator {
+
+void decode_into(uint32_t address, decoded_instruction *entry)
+{
+  fetch_instruction(address, &entry->instruction);
+  uint16_t second_half = 0;
+  if(is_32bit_instruction(entry->instruction)) {
+    fetch_instruction(address + 0x2, &second_half);
+  }
+  entry->decoded = decode(entry->instruction, second_half);
+  entry->execute = resolve_handler(entry->instruction);
+  // PC seen is PC + 4
+  entry->pc = address + 0x4;
+}
+
+memory_region *find_cached_ram_code(uint32_t address, uint32_t *offset)
+{
+  auto *const target = current_machine;
+
+  // Fetches through the memory policy have to happen every time the instruction executes
+  auto const *const unhooked = &memory_handlers_of<no_memory_policy>::table;
+  if(target->ram.contains(address) && target->memory_instructions == unhooked) {
+    *offset = cached_code_bytes(target->flash.size_bytes(), 0) + (address - RAM_START);
+
+    return &target->ram;
+  }
+
+  return nullptr;
+}
+
+void invalidate_code(void *target, uint32_t address, uint32_t bytes)
+{
+  machine_binding binding(static_cast<machine *>(target));
+  invalidate_decode_cache(address, bytes);
+  invalidate_translations(address, bytes);
+}
+
+// Make the page holding the specified cached address the current one
+static void enter_decode_page(
+    decode_cache *cache, memory_region *region, uint32_t address, uint32_t offset)
+{
+  auto &page = cache->pages[offset / DECODE_CACHE_PAGE_BYTES];
+  if(page == nullptr) {
+    page.reset(new decoded_instruction[DECODE_CACHE_PAGE_ENTRIES]());
+  }
+
+  cache->current_start = address - offset % DECODE_CACHE_PAGE_BYTES;
+  cache->current_page = page.get();
+  cache->current_region = region;
+}
+
+decoded_instruction const *fetch_decoded(uint32_t address)
+{
+  auto &cache = *current_machine->decoded;
+
+  auto offset = address - cache.current_start;
+  if(offset >= DECODE_CACHE_PAGE_BYTES || cache.current_page == nullptr) {
+    uint32_t code_offset;
+    auto *const region = find_cached_code(address, &code_offset);
+    if(region == nullptr) {
+      decode_into(address, &cache.uncached);
+
+      return &cache.uncached;
+    }
+
+    enter_decode_page(&cache, region, address, code_offset);
+    offset = address - cache.current_start;
+  }
+
+  auto *entry = &cache.current_page[offset >> 1];
+  if(entry->execute == nullptr) {
+    decode_into(address, entry);
+
+    // Modifying the instruction, or the second half of BL, drops the entry again
+    auto &region = *cache.current_region;
+    region.mark_code(address);
+    if(is_32bit_instruction(entry->instruction) && region.contains(address + 0x2)) {
+      region.mark_code(address + 0x2);
+    }
+  }
+
+  return entry;
+}
+
+void invalidate_decode_cache(uint32_t address, uint32_t bytes)
+{
+  uint32_t offset;
+  auto const *const region = find_cached_code(address, &offset);
+  if(region == nullptr) {
+    return;
+  }
+
+  auto &cache = *current_machine->decoded;
+
+  // Offsets from the start of the memory, and where the memory starts in the cache
+  auto const first = (address - region->start()) & ~0x3;
+  auto const end = std::min(address - region->start() + bytes, region->size_bytes());
+  auto const base = offset - (address - region->start());
+
+  // A BL in the preceding halfword reads its second half from the first word
+  for(auto byte = first == 0 ? first : first - 2; byte < end; byte += 2) {
+    auto &page = cache.pages[(base + byte) / DECODE_CACHE_PAGE_BYTES];
+    if(page != nullptr) {
+      page[((base + byte) % DECODE_CACHE_PAGE_BYTES) >> 1].execute = nullptr;
+    }
+  }
+}
+
+void flush_decode_cache()
+{
+  auto &cache = *current_machine->decoded;
+  cache.current_page = nullptr;
+  for(auto &page : cache.pages) {
+    page.reset();
+  }
+
+  // Whether fetches go through the memory policy is decided when entering a region
+  current_machine->fetch.size = 0;
+}
+}
@@ -0,0 +1,125 @@
+#ifndef THUMBULATOR_DECODE_TABLE_HPP
+#define THUMBULATOR_DECODE_TABLE_HPP
+
+#include "thumbulator/decode.hpp"
+
+#include <cstdint>
+
+namespace thumbulator {
+
+/**
+ * The handlers an instruction can be decoded to, see execute_handlers.
+ *
+ * The memory instructions come last, in the order of the members of memory_handlers.
+ */
+enum execute_handler_id : uint8_t {
+  EXECUTE_ADCS,
+  EXECUTE_ADDS_I3,
+  EXECUTE_ADDS_I8,
+  EXECUTE_ADDS_R,
+  EXECUTE_ADD_R,
+  EXECUTE_ADD_SP,
+  EXECUTE_ADR,
+  EXECUTE_SUBS_I3,
+  EXECUTE_SUBS_I8,
+  EXECUTE_SUBS,
+  EXECUTE_SUB_SP,
+  EXECUTE_SBCS,
+  EXECUTE_RSBS,
+  EXECUTE_MULS,
+  EXECUTE_CMP_I,
+  EXECUTE_CMP_R,
+  EXECUTE_TST,
+  EXECUTE_B,
+  EXECUTE_B_C,
+  EXECUTE_BLX,
+  EXECUTE_BX,
+  EXECUTE_BL,
+  EXECUTE_ANDS,
+  EXECUTE_BICS,
+  EXECUTE_EORS,
+  EXECUTE_ORRS,
+  EXECUTE_MVNS,
+  EXECUTE_ASRS_I,
+  EXECUTE_ASRS_R,
+  EXECUTE_LSLS_I,
+  EXECUTE_LSRS_I,
+  EXECUTE_LSLS_R,
+  EXECUTE_LSRS_R,
+  EXECUTE_RORS,
+  EXECUTE_MOVS_I,
+  EXECUTE_MOV_R,
+  EXECUTE_SXTB,
+  EXECUTE_SXTH,
+  EXECUTE_UXTB,
+  EXECUTE_UXTH,
+  EXECUTE_REV,
+  EXECUTE_REV16,
+  EXECUTE_BREAKPOINT,
+  EXECUTE_ERROR,
+  EXECUTE_EXIT_SIMULATION,
+  // Not executed, decoding these instructions fails
+  EXECUTE_UNDEFINED,
+  EXECUTE_LDM,
+  EXECUTE_STM,
+  EXECUTE_POP,
+  EXECUTE_PUSH,
+  EXECUTE_LDR_I,
+  EXECUTE_LDR_SP,
+  EXECUTE_LDR_LIT,
+  EXECUTE_LDR_R,
+  EXECUTE_LDRB_I,
+  EXECUTE_LDRB_R,
+  EXECUTE_LDRH_I,
+  EXECUTE_LDRH_R,
+  EXECUTE_LDRSB_R,
+  EXECUTE_LDRSH_R,
+  EXECUTE_STR_I,
+  EXECUTE_STR_SP,
+  EXECUTE_STR_R,
+  EXECUTE_STRB_I,
+  EXECUTE_STRB_R,
+  EXECUTE_STRH_I,
+  EXECUTE_STRH_R,
+  EXECUTE_HANDLER_COUNT
+};
+
+/**
+ * The first of the memory instructions.
+ */
+#define EXECUTE_FIRST_MEMORY EXECUTE_LDM
+
+/**
+ * The handler of each execute_handler_id, with the memory instructions of no_memory_policy.
+ */
+extern execute_handler const execute_handlers[EXECUTE_HANDLER_COUNT];
+
+/**
+ * What the decode stage makes of a 16-bit instruction, packed to keep the table small.
+ *
+ * The second half of BL is not known from the first, so its immediate is left for decode.
+ */
+struct decode_entry {
+  execute_handler_id handler;
+  uint8_t Rd;
+  uint8_t Rm;
+  uint8_t Rn;
+  uint8_t cond;
+  uint16_t imm;
+  uint16_t register_list;
+};
+
+/**
+ * The decoding of every 16-bit instruction, indexed by the instruction.
+ */
+struct decode_table {
+  decode_entry entries[0x10000];
+};
+
+/**
+ * Generated while compiling decode.cpp.
+ */
+extern decode_table const decode_entries;
+}
+
+#endif //THUMBULATOR_DECODE_TABLE_HPP
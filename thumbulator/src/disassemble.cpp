@@ -0,0 +1,271 @@
+#include "thumbulator/disassemble.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace thumbulator {
+
+static char const *const register_names[16] = {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+    "r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc"};
+
+static char const *const condition_names[14] = {
+    "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le"};
+
+static std::string format(char const *format, ...)
+{
+  char text[96];
+
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(text, sizeof(text), format, arguments);
+  va_end(arguments);
+
+  return text;
+}
+
+// {r0, r4, lr} from the low registers in the list and an optional extra register
+static std::string register_list(uint32_t list, char const *extra)
+{
+  std::string text = "{";
+  for(int i = 0; i < 8; ++i) {
+    if((list >> i) & 0x1) {
+      text += text.size() > 1 ? ", " : "";
+      text += register_names[i];
+    }
+  }
+
+  if(extra != nullptr) {
+    text += text.size() > 1 ? ", " : "";
+    text += extra;
+  }
+
+  return text + "}";
+}
+
+static uint32_t sign_extend(uint32_t value, int bits)
+{
+  auto const sign = uint32_t{1} << (bits - 1);
+
+  return (value ^ sign) - sign;
+}
+
+// Shifts, add and subtract, move and compare
+static std::string disassemble_basic(uint16_t insn)
+{
+  auto const rd = insn & 0x7;
+  auto const rn = (insn >> 3) & 0x7;
+  auto const imm5 = (insn >> 6) & 0x1F;
+
+  switch(insn >> 11) {
+  case 0:
+    if(imm5 == 0) {
+      return format("movs r%u, r%u", rd, rn);
+    }
+    return format("lsls r%u, r%u, #%u", rd, rn, imm5);
+  case 1:
+    return format("lsrs r%u, r%u, #%u", rd, rn, imm5 == 0 ? 32 : imm5);
+  case 2:
+    return format("asrs r%u, r%u, #%u", rd, rn, imm5 == 0 ? 32 : imm5);
+  case 3: {
+    auto const operand = (insn >> 6) & 0x7;
+    auto const *const name = ((insn >> 9) & 0x1) != 0 ? "subs" : "adds";
+    if(((insn >> 10) & 0x1) != 0) {
+      return format("%s r%u, r%u, #%u", name, rd, rn, operand);
+    }
+    return format("%s r%u, r%u, r%u", name, rd, rn, operand);
+  }
+  default: {
+    static char const *const names[4] = {"movs", "cmp", "adds", "subs"};
+    return format("%s r%u, #%u", names[(insn >> 11) & 0x3], (insn >> 8) & 0x7, insn & 0xFF);
+  }
+  }
+}
+
+// Data processing on low registers, and the operations on high registers
+static std::string disassemble_data_processing(uint16_t insn)
+{
+  if((insn >> 10) == 0x10) {
+    static char const *const names[16] = {"ands", "eors", "lsls", "lsrs", "asrs", "adcs", "sbcs",
+        "rors", "tst", "rsbs", "cmp", "cmn", "orrs", "muls", "bics", "mvns"};
+    auto const operation = (insn >> 6) & 0xF;
+    auto const rd = insn & 0x7;
+    auto const rm = (insn >> 3) & 0x7;
+    if(operation == 9) {
+      return format("rsbs r%u, r%u, #0", rd, rm);
+    }
+    if(operation == 13) {
+      return format("muls r%u, r%u, r%u", rd, rm, rd);
+    }
+    return format("%s r%u, r%u", names[operation], rd, rm);
+  }
+
+  auto const rd = (insn & 0x7) | ((insn >> 4) & 0x8);
+  auto const rm = (insn >> 3) & 0xF;
+  switch((insn >> 8) & 0x3) {
+  case 0:
+    return format("add %s, %s", register_names[rd], register_names[rm]);
+  case 1:
+    return format("cmp %s, %s", register_names[rd], register_names[rm]);
+  case 2:
+    return format("mov %s, %s", register_names[rd], register_names[rm]);
+  default:
+    return format("%s %s", ((insn >> 7) & 0x1) != 0 ? "blx" : "bx", register_names[rm]);
+  }
+}
+
+// Loads and stores of single registers
+static std::string disassemble_load_store(uint32_t address, uint16_t insn)
+{
+  auto const rt = insn & 0x7;
+  auto const rn = (insn >> 3) & 0x7;
+
+  if((insn >> 11) == 0x9) {
+    auto const target = ((address + 4) & ~0x3u) + (insn & 0xFF) * 4;
+    return format("ldr r%u, [pc, #%u] ; 0x%08X", (insn >> 8) & 0x7, (insn & 0xFF) * 4, target);
+  }
+
+  if((insn >> 12) == 0x5) {
+    static char const *const names[8] = {
+        "str", "strh", "strb", "ldrsb", "ldr", "ldrh", "ldrb", "ldrsh"};
+    return format("%s r%u, [r%u, r%u]", names[(insn >> 9) & 0x7], rt, rn, (insn >> 6) & 0x7);
+  }
+
+  if((insn >> 12) == 0x9) {
+    auto const *const name = ((insn >> 11) & 0x1) != 0 ? "ldr" : "str";
+    return format("%s r%u, [sp, #%u]", name, (insn >> 8) & 0x7, (insn & 0xFF) * 4);
+  }
+
+  static char const *const names[6] = {"str", "ldr", "strb", "ldrb", "strh", "ldrh"};
+  static uint32_t const scales[6] = {4, 4, 1, 1, 2, 2};
+  auto const form = (insn >> 11) - 0xC;
+  return format("%s r%u, [r%u, #%u]", names[form], rt, rn, ((insn >> 6) & 0x1F) * scales[form]);
+}
+
+// Miscellaneous 16-bit instructions
+static std::string disassemble_misc(uint16_t insn)
+{
+  auto const rd = insn & 0x7;
+  auto const rm = (insn >> 3) & 0x7;
+
+  switch(insn >> 8) {
+  case 0xB0:
+    return format("%s sp, #%u", ((insn >> 7) & 0x1) != 0 ? "sub" : "add", (insn & 0x7F) * 4);
+  case 0xB2: {
+    static char const *const names[4] = {"sxth", "sxtb", "uxth", "uxtb"};
+    return format("%s r%u, r%u", names[(insn >> 6) & 0x3], rd, rm);
+  }
+  case 0xB4:
+  case 0xB5:
+    return "push " + register_list(insn & 0xFF, ((insn >> 8) & 0x1) != 0 ? "lr" : nullptr);
+  case 0xB6:
+    if((insn & 0xFFEF) == 0xB662) {
+      return ((insn >> 4) & 0x1) != 0 ? "cpsid i" : "cpsie i";
+    }
+    break;
+  case 0xBA: {
+    static char const *const names[4] = {"rev", "rev16", nullptr, "revsh"};
+    auto const *const name = names[(insn >> 6) & 0x3];
+    if(name != nullptr) {
+      return format("%s r%u, r%u", name, rd, rm);
+    }
+    break;
+  }
+  case 0xBC:
+  case 0xBD:
+    return "pop " + register_list(insn & 0xFF, ((insn >> 8) & 0x1) != 0 ? "pc" : nullptr);
+  case 0xBE:
+    return format("bkpt #%u", insn & 0xFF);
+  case 0xBF: {
+    static char const *const names[5] = {"nop", "yield", "wfe", "wfi", "sev"};
+    if((insn & 0xF) == 0 && ((insn >> 4) & 0xF) < 5) {
+      return names[(insn >> 4) & 0xF];
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  return format(".hword 0x%04X", insn);
+}
+
+// Load and store multiple, and branches
+static std::string disassemble_control(uint32_t address, uint16_t insn)
+{
+  auto const rn = (insn >> 8) & 0x7;
+
+  switch(insn >> 11) {
+  case 0x18:
+    return format("stm r%u!, ", rn) + register_list(insn & 0xFF, nullptr);
+  case 0x19: {
+    // Loading the base register leaves it without write back
+    auto const *const write_back = ((insn >> rn) & 0x1) != 0 ? "" : "!";
+    return format("ldm r%u%s, ", rn, write_back) + register_list(insn & 0xFF, nullptr);
+  }
+  case 0x1C:
+    return format("b 0x%08X", address + 4 + (sign_extend(insn & 0x7FF, 11) << 1));
+  default: {
+    auto const condition = (insn >> 8) & 0xF;
+    if(condition == 0xE) {
+      return format("udf #%u", insn & 0xFF);
+    }
+    if(condition == 0xF) {
+      return format("svc #%u", insn & 0xFF);
+    }
+    auto const target = address + 4 + (sign_extend(insn & 0xFF, 8) << 1);
+    return format("b%s 0x%08X", condition_names[condition], target);
+  }
+  }
+}
+
+static std::string disassemble_32bit(uint32_t address, uint16_t first, uint16_t second)
+{
+  if((first >> 11) == 0x1E && (second & 0xD000) == 0xD000) {
+    auto const s = (first >> 10) & 0x1;
+    auto const i1 = ~(((second >> 13) & 0x1) ^ s) & 0x1;
+    auto const i2 = ~(((second >> 11) & 0x1) ^ s) & 0x1;
+    auto const imm =
+        (s << 23) | (i1 << 22) | (i2 << 21) | ((first & 0x3FF) << 11) | (second & 0x7FF);
+
+    return format("bl 0x%08X", address + 4 + (sign_extend(imm, 24) << 1));
+  }
+
+  return format(".hword 0x%04X, 0x%04X", first, second);
+}
+
+std::string disassemble(uint32_t address, uint32_t opcode)
+{
+  auto const insn = static_cast<uint16_t>(opcode);
+
+  if(is_32bit_instruction(insn)) {
+    return disassemble_32bit(address, insn, static_cast<uint16_t>(opcode >> 16));
+  }
+
+  switch(insn >> 12) {
+  case 0x0:
+  case 0x1:
+  case 0x2:
+  case 0x3:
+    return disassemble_basic(insn);
+  case 0x4:
+    if((insn >> 11) == 0x9) {
+      return disassemble_load_store(address, insn);
+    }
+    return disassemble_data_processing(insn);
+  case 0xA:
+    if((insn >> 11) == 0x14) {
+      auto const target = ((address + 4) & ~0x3u) + (insn & 0xFF) * 4;
+      return format("adr r%u, 0x%08X", (insn >> 8) & 0x7, target);
+    }
+    return format("add r%u, sp, #%u", (insn >> 8) & 0x7, (insn & 0xFF) * 4);
+  case 0xB:
+    return disassemble_misc(insn);
+  case 0xC:
+  case 0xD:
+  case 0xE:
+    return disassemble_control(address, insn);
+  default:
+    return disassemble_load_store(address, insn);
+  }
+}
+}
@@ -0,0 +1,36 @@
+#include "events.hpp"
+
+#include "run_control.hpp"
+#include "sampling.hpp"
+#include "systick.hpp"
+
+namespace thumbulator {
+
+// What happens at the deadline of each event, indexed by machine_event
+static void (*const event_handlers[EVENT_COUNT])() = {
+    systick_wrap, take_sample, cycle_budget_reached};
+
+void schedule_event(machine_event event, uint64_t cycle)
+{
+  auto &events = current_machine->events;
+  events.deadlines[event] = cycle;
+
+  events.next = EVENT_NEVER;
+  for(auto const deadline : events.deadlines) {
+    events.next = deadline < events.next ? deadline : events.next;
+  }
+}
+
+void run_due_events()
+{
+  auto const &events = current_machine->events;
+
+  for(int event = 0; event < EVENT_COUNT; ++event) {
+    if(events.deadlines[event] <= current_machine->cycle_count) {
+      // Handlers reschedule their event if it repeats
+      schedule_event(static_cast<machine_event>(event), EVENT_NEVER);
+      event_handlers[event]();
+    }
+  }
+}
+}
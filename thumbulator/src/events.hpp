@@ -0,0 +1,43 @@
+#ifndef THUMBULATOR_EVENTS_HPP
+#define THUMBULATOR_EVENTS_HPP
+
+#include "thumbulator/machine.hpp"
+
+namespace thumbulator {
+
+/**
+ * Schedule an event of the machine bound to the calling thread, replacing its previous deadline.
+ *
+ * @param event The event to schedule.
+ * @param cycle The value of cycle_count at or after which the event happens, or EVENT_NEVER.
+ */
+void schedule_event(machine_event event, uint64_t cycle);
+
+/**
+ * Handle the events whose deadline has passed.
+ */
+void run_due_events();
+
+/**
+ * Account for the cycles of an executed instruction, and handle the events they reach.
+ */
+inline void advance_cycles(uint32_t cycles)
+{
+  auto *const bound = current_machine;
+
+  bound->cycle_count += cycles;
+  if(bound->cycle_count >= bound->events.next) {
+    run_due_events();
+  }
+}
+
+/**
+ * Whether or not a number of cycles can be executed without reaching an event.
+ */
+inline bool before_next_event(uint64_t cycles)
+{
+  return current_machine->events.next - current_machine->cycle_count > cycles;
+}
+}
+
+#endif //THUMBULATOR_EVENTS_HPP
@@ -0,0 +1,42 @@
+#include "thumbulator/exit.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/machine.hpp"
+
+#include <cstdio>
+#include <string>
+
+namespace thumbulator {
+
+static char const *const fault_descriptions[] = {"Undefined instruction",
+    "Unsupported instruction", "Malformed instruction", "Interworking not supported",
+    "Instruction fetch out of range", "Load out of range", "Store out of range"};
+
+static std::string describe(fault_kind kind, uint32_t pc, uint32_t address)
+{
+  char text[96];
+  snprintf(text, sizeof(text), "%s at pc=0x%08X, address=0x%08X", fault_descriptions[kind], pc,
+      address);
+
+  return text;
+}
+
+simulation_fault::simulation_fault(fault_kind kind, uint32_t pc, uint32_t address)
+    : std::runtime_error(describe(kind, pc, address))
+    , kind(kind)
+    , pc(pc)
+    , address(address)
+{
+}
+
+void terminate_simulation(fault_kind kind, uint32_t address)
+{
+  throw simulation_fault(kind, (cpu_get_pc() - 0x4) & ~0x1u, address);
+}
+
+void terminate_simulation(fault_kind kind)
+{
+  auto const pc = (cpu_get_pc() - 0x4) & ~0x1u;
+  throw simulation_fault(kind, pc, pc);
+}
+}
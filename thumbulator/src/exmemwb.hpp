@@ -0,0 +1,63 @@
+#ifndef THUMBULATOR_EXMEMWB_HPP
+#define THUMBULATOR_EXMEMWB_HPP
+
+#include "thumbulator/decode.hpp"
+#include "thumbulator/memory_policy.hpp"
+
+namespace thumbulator {
+
+// Handlers for the execute, memory, and write-back stages of each instruction
+// The memory instructions are templates over the memory policy, see exmemwb_mem.hpp
+uint32_t adcs(decode_result const *);
+uint32_t adds_i3(decode_result const *);
+uint32_t adds_i8(decode_result const *);
+uint32_t adds_r(decode_result const *);
+uint32_t add_r(decode_result const *);
+uint32_t add_sp(decode_result const *);
+uint32_t adr(decode_result const *);
+uint32_t subs_i3(decode_result const *);
+uint32_t subs_i8(decode_result const *);
+uint32_t subs(decode_result const *);
+uint32_t sub_sp(decode_result const *);
+uint32_t sbcs(decode_result const *);
+uint32_t rsbs(decode_result const *);
+uint32_t muls(decode_result const *);
+uint32_t cmn(decode_result const *);
+uint32_t cmp_i(decode_result const *);
+uint32_t cmp_r(decode_result const *);
+uint32_t tst(decode_result const *);
+uint32_t b(decode_result const *);
+uint32_t b_c(decode_result const *);
+uint32_t blx(decode_result const *);
+uint32_t bx(decode_result const *);
+uint32_t bl(decode_result const *);
+uint32_t ands(decode_result const *);
+uint32_t bics(decode_result const *);
+uint32_t eors(decode_result const *);
+uint32_t orrs(decode_result const *);
+uint32_t mvns(decode_result const *);
+uint32_t asrs_i(decode_result const *);
+uint32_t asrs_r(decode_result const *);
+uint32_t lsls_i(decode_result const *);
+uint32_t lsrs_i(decode_result const *);
+uint32_t lsls_r(decode_result const *);
+uint32_t lsrs_r(decode_result const *);
+uint32_t rors(decode_result const *);
+uint32_t movs_i(decode_result const *);
+uint32_t mov_r(decode_result const *);
+uint32_t movs_r(decode_result const *);
+uint32_t sxtb(decode_result const *);
+uint32_t sxth(decode_result const *);
+uint32_t uxtb(decode_result const *);
+uint32_t uxth(decode_result const *);
+uint32_t rev(decode_result const *);
+uint32_t rev16(decode_result const *);
+uint32_t revsh(decode_result const *);
+uint32_t breakpoint(decode_result const *);
+uint32_t exmemwb_error(decode_result const *);
+uint32_t exmemwb_exit_simulation(decode_result const *);
+
+// The handler of an instruction from the decode table, without the hooks of the memory policy
+execute_handler resolve_entry(uint16_t instruction);
+}
+#endif //THUMBULATOR_EXMEMWB_HPP
@@ -1,8 +1,8 @@
+#include "thumbulator/exit.hpp"
 #include "thumbulator/memory.hpp"
+#include "thumbulator/trace.hpp"
 
 #include "cpu_flags.hpp"
-#include "exit.hpp"
-#include "trace.hpp"
 
 namespace thumbulator {
 
@@ -92,8 +92,7 @@ uint32_t add_r(decode_result const *decoded)
   // Check for malformed instruction
   if(decoded->Rd == 15 && decoded->Rm == 15) {
     //UNPREDICTABLE
-    fprintf(stderr, "Error: Instruction format error.\n");
-    terminate_simulation(1);
+    terminate_simulation(FAULT_MALFORMED_INSTRUCTION);
   }
 
   uint32_t opA = cpu_get_gpr(decoded->Rd);
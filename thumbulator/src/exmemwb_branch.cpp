@@ -1,8 +1,11 @@
+#include "thumbulator/exit.hpp"
 #include "thumbulator/memory.hpp"
+#include "thumbulator/sampler.hpp"
+#include "thumbulator/trace.hpp"
 
 #include "cpu_flags.hpp"
-#include "exit.hpp"
-#include "trace.hpp"
+#include "exmemwb.hpp"
+#include "fusion.hpp"
 
 namespace thumbulator {
 
@@ -82,7 +85,7 @@ uint32_t b(decode_result const *decoded)
 
   uint32_t result = offset + cpu_get_pc();
   cpu_set_pc(result);
-  BRANCH_WAS_TAKEN = 1;
+  current_machine->branch_was_taken = 1;
 
   return TIMING_BRANCH;
 }
@@ -165,8 +168,7 @@ uint32_t b_c(decode_result const *decoded)
       taken = 1;
     break;
   default:
-    fprintf(stderr, "Error: Malformed instruction!");
-    terminate_simulation(1);
+    terminate_simulation(FAULT_MALFORMED_INSTRUCTION);
   }
 
   if(taken == 0) {
@@ -177,7 +179,7 @@ uint32_t b_c(decode_result const *decoded)
   uint32_t pc = cpu_get_pc();
   uint32_t result = offset + pc;
   cpu_set_pc(result);
-  BRANCH_WAS_TAKEN = 1;
+  current_machine->branch_was_taken = 1;
 
   return TIMING_BRANCH;
 }
@@ -190,13 +192,16 @@ uint32_t blx(decode_result const *decoded)
   uint32_t address = cpu_get_gpr(decoded->Rm);
 
   if((address & 0x1) == 0) {
-    fprintf(stderr, "Error: Interworking not supported: 0x%8.8X\n", address);
-    terminate_simulation(1);
+    terminate_simulation(FAULT_INTERWORKING, address);
   }
 
   cpu_set_lr(cpu_get_pc() - 0x2);
   cpu_set_pc(address);
-  BRANCH_WAS_TAKEN = 1;
+  current_machine->branch_was_taken = 1;
+
+  if(current_machine->sampler != nullptr) {
+    current_machine->sampler->call(cpu_get_lr() & ~0x1u, cpu_get_sp());
+  }
 
   return TIMING_BRANCH;
 }
@@ -210,8 +215,7 @@ uint32_t bx(decode_result const *decoded)
   uint32_t address = cpu_get_gpr(decoded->Rm);
 
   if((address & 0x1) == 0) {
-    fprintf(stderr, "Error: Interworking not supported: 0x%8.8X\n", address);
-    terminate_simulation(1);
+    terminate_simulation(FAULT_INTERWORKING, address);
   }
 
   if((address >> 28) == 0xF) {
@@ -220,7 +224,11 @@ uint32_t bx(decode_result const *decoded)
     cpu_set_pc(address);
   }
 
-  BRANCH_WAS_TAKEN = 1;
+  current_machine->branch_was_taken = 1;
+
+  if(current_machine->sampler != nullptr) {
+    current_machine->sampler->return_to(address & ~0x1u, cpu_get_sp());
+  }
 
   return TIMING_BRANCH;
 }
@@ -237,8 +245,25 @@ uint32_t bl(decode_result const *decoded)
 
   cpu_set_lr(cpu_get_pc());
   cpu_set_pc(result);
-  BRANCH_WAS_TAKEN = 1;
+  current_machine->branch_was_taken = 1;
+
+  if(current_machine->sampler != nullptr) {
+    current_machine->sampler->call(cpu_get_lr() & ~0x1u, cpu_get_sp());
+  }
 
   return TIMING_BRANCH_LINK;
 }
+
+///--- Fused pairs, see fusion.hpp --------------------------------------------///
+
+// Instantiated here so that the compares and the conditional branch are inlined
+template uint32_t fused<cmp_i, b_c>(decode_result const *);
+template uint32_t fused<cmp_r, b_c>(decode_result const *);
+template uint32_t fused<tst, b_c>(decode_result const *);
+template uint32_t fused<subs_i8, b_c>(decode_result const *);
+template uint32_t fused<adds_i8, b_c>(decode_result const *);
+template uint32_t fused<adds_i3, cmp_i>(decode_result const *);
+template uint32_t fused<adds_i3, cmp_r>(decode_result const *);
+template uint32_t fused<adds_i8, cmp_i>(decode_result const *);
+template uint32_t fused<adds_i8, cmp_r>(decode_result const *);
 }
@@ -1,7 +1,7 @@
 #include "thumbulator/memory.hpp"
+#include "thumbulator/trace.hpp"
 
 #include "cpu_flags.hpp"
-#include "trace.hpp"
 
 namespace thumbulator {
 
@@ -1,12 +1,21 @@
+#include "thumbulator/machine.hpp"
 #include "thumbulator/memory.hpp"
+#include "thumbulator/semihosting.hpp"
+#include "thumbulator/trace.hpp"
 
 #include "cpu_flags.hpp"
-#include "trace.hpp"
 
 namespace thumbulator {
 
 uint32_t breakpoint(decode_result const *decoded)
 {
+  TRACE_INSTRUCTION("bkpt #0x%02X\n", decoded->imm);
+
+  auto *const host = current_machine->semihosting;
+  if(host != nullptr && decoded->imm == SEMIHOSTING_BKPT) {
+    cpu_set_gpr(0, host->call(cpu_get_gpr(0), cpu_get_gpr(1)));
+  }
+
   return 0;
 }
 
@@ -0,0 +1,125 @@
+#include "fusion.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/trace.hpp"
+
+#include "exmemwb.hpp"
+
+namespace thumbulator {
+
+// Instantiated in exmemwb_branch.cpp, where the compares and the conditional branch are defined
+extern template uint32_t fused<cmp_i, b_c>(decode_result const *);
+extern template uint32_t fused<cmp_r, b_c>(decode_result const *);
+extern template uint32_t fused<tst, b_c>(decode_result const *);
+extern template uint32_t fused<subs_i8, b_c>(decode_result const *);
+extern template uint32_t fused<adds_i8, b_c>(decode_result const *);
+extern template uint32_t fused<adds_i3, cmp_i>(decode_result const *);
+extern template uint32_t fused<adds_i3, cmp_r>(decode_result const *);
+extern template uint32_t fused<adds_i8, cmp_i>(decode_result const *);
+extern template uint32_t fused<adds_i8, cmp_r>(decode_result const *);
+
+// Execute a pair whose first instruction loads through the memory policy, which can stop a run
+template <execute_handler Second>
+uint32_t fused_load(decode_result const *decoded)
+{
+  auto const *const second = fused_second(decoded);
+  auto const ticks = second[-1].execute(decoded);
+  if(current_machine->run.pending_stop != STOP_NONE) {
+    return ticks;
+  }
+
+  cpu_set_pc(second->pc);
+  return ticks + Second(&second->decoded);
+}
+
+struct fusion {
+  execute_handler first;
+  execute_handler second;
+  execute_handler fused;
+};
+
+// Compares, bit tests and loop counters followed by a conditional branch, constants built in two
+// steps, and counters compared against their bound
+static fusion const fusions[] = {{cmp_i, b_c, fused<cmp_i, b_c>}, {cmp_r, b_c, fused<cmp_r, b_c>},
+    {tst, b_c, fused<tst, b_c>}, {subs_i8, b_c, fused<subs_i8, b_c>},
+    {adds_i8, b_c, fused<adds_i8, b_c>}, {movs_i, lsls_i, fused<movs_i, lsls_i>},
+    {adds_i3, cmp_i, fused<adds_i3, cmp_i>}, {adds_i3, cmp_r, fused<adds_i3, cmp_r>},
+    {adds_i8, cmp_i, fused<adds_i8, cmp_i>}, {adds_i8, cmp_r, fused<adds_i8, cmp_r>}};
+
+// Loads followed by an addition, the first handler depends on the memory policy
+static fusion const load_fusions[] = {{nullptr, adds_i3, fused_load<adds_i3>},
+    {nullptr, adds_i8, fused_load<adds_i8>}, {nullptr, adds_r, fused_load<adds_r>}};
+
+// Arithmetic and logic on low registers and the stack pointer, which only reads and writes
+// registers other than the PC
+static execute_handler const isolated_handlers[] = {adcs, adds_i3, adds_i8, adds_r, add_sp,
+    subs_i3, subs_i8, subs, sub_sp, sbcs, rsbs, muls, cmn, cmp_i, tst, ands, bics, eors, orrs,
+    mvns, asrs_i, asrs_r, lsls_i, lsrs_i, lsls_r, lsrs_r, rors, movs_i, movs_r, sxtb, sxth, uxtb,
+    uxth, rev, rev16, revsh};
+
+static bool is_isolated(execute_handler execute)
+{
+  // Traced instructions print the PC
+  if(ENABLE_INSTRUCTION_TRACE) {
+    return false;
+  }
+
+  for(auto const candidate : isolated_handlers) {
+    if(execute == candidate) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool is_word_load(execute_handler execute)
+{
+  auto const *const handlers = current_machine->memory_instructions;
+
+  return execute == handlers->ldr_i || execute == handlers->ldr_sp ||
+         execute == handlers->ldr_lit || execute == handlers->ldr_r;
+}
+
+// The handler of the fused pair, nullptr if the instructions are not fused
+static execute_handler find_fusion(
+    decoded_instruction const &first, decoded_instruction const &second)
+{
+  for(auto const &candidate : fusions) {
+    if(first.execute == candidate.first && second.execute == candidate.second) {
+      return candidate.fused;
+    }
+  }
+
+  if(is_word_load(first.execute)) {
+    for(auto const &candidate : load_fusions) {
+      if(second.execute == candidate.second) {
+        return candidate.fused;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+std::vector<block_step> fuse_instructions(std::vector<decoded_instruction> const &instructions)
+{
+  std::vector<block_step> steps;
+
+  auto const count = static_cast<uint32_t>(instructions.size());
+  for(uint32_t i = 0; i < count; ++i) {
+    auto const pair = i + 1 < count ? find_fusion(instructions[i], instructions[i + 1]) : nullptr;
+    auto const &first = instructions[i];
+    if(pair != nullptr) {
+      steps.push_back({pair, first.decoded, first.pc, &instructions[i + 1], i + 1, false});
+      ++i;
+    } else {
+      steps.push_back(
+          {first.execute, first.decoded, first.pc, nullptr, i + 1, is_isolated(first.execute)});
+    }
+  }
+
+  return steps;
+}
+}
@@ -0,0 +1,96 @@
+#ifndef THUMBULATOR_FUSION_HPP
+#define THUMBULATOR_FUSION_HPP
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/decode_cache.hpp"
+#include "thumbulator/machine.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace thumbulator {
+
+/**
+ * A step of a translated block: one instruction, or a pair of adjacent instructions fused into a
+ * single handler.
+ */
+struct block_step {
+  /**
+   * The handler of the step, called with decoded.
+   */
+  execute_handler execute;
+
+  /**
+   * The result of the decode stage of the first instruction.
+   */
+  decode_result decoded;
+
+  /**
+   * The value of the program counter while the first instruction executes.
+   */
+  uint32_t pc;
+
+  /**
+   * The second instruction of a fused pair, nullptr for a single instruction.
+   */
+  decoded_instruction const *second;
+
+  /**
+   * Number of instructions of the block executed when the first instruction of the step stops
+   * the run or stores into translated code, counting that instruction.
+   */
+  uint32_t executed_to_stop;
+
+  /**
+   * Whether the step cannot stop a run or fault, and does not use the program counter or the
+   * cycle count, so neither has to be up to date while it executes.
+   */
+  bool isolated;
+};
+
+/**
+ * The second instruction of the fused pair whose step holds the specified decode result.
+ */
+inline decoded_instruction const *fused_second(decode_result const *decoded)
+{
+  auto const *const step = reinterpret_cast<block_step const *>(
+      reinterpret_cast<char const *>(decoded) - offsetof(block_step, decoded));
+
+  return step->second;
+}
+
+/**
+ * Execute a fused pair whose first instruction cannot stop a run.
+ *
+ * Pairs are instantiated next to the definitions of their handlers where possible, so that the
+ * handlers are inlined.
+ */
+template <execute_handler First, execute_handler Second>
+uint32_t fused(decode_result const *decoded)
+{
+  auto const *const second = fused_second(decoded);
+  auto const ticks = First(decoded);
+
+  cpu_set_pc(second->pc);
+  return ticks + Second(&second->decoded);
+}
+
+/**
+ * Split the instructions of a block into steps, fusing common pairs of adjacent instructions.
+ *
+ * A fused pair behaves like its two instructions executed one after the other and returns their
+ * combined cycles, except that the second instruction is skipped if the first one stops the
+ * run_until in progress. The second instruction of a pair never stops a run or faults.
+ *
+ * Fused pairs point to their second instruction, so the steps are only valid as long as the
+ * instructions are not modified. Only single instructions are isolated.
+ *
+ * @param instructions The instructions of the block.
+ *
+ * @return The steps covering every instruction, in order.
+ */
+std::vector<block_step> fuse_instructions(std::vector<decoded_instruction> const &instructions);
+}
+
+#endif //THUMBULATOR_FUSION_HPP
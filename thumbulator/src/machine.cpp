@@ -0,0 +1,64 @@
+#include "thumbulator/machine.hpp"
+
+#include "thumbulator/memory_policy.hpp"
+
+#include "machine_caches.hpp"
+#include "systick.hpp"
+
+#include <stdexcept>
+
+namespace thumbulator {
+
+THUMBULATOR_THREAD_LOCAL machine *current_machine = nullptr;
+
+no_memory_policy no_hooks;
+
+// Memories are made of whole words and must not overlap what comes after them
+static uint32_t checked_size(uint32_t size_bytes, uint32_t max_size_bytes)
+{
+  if(size_bytes == 0 || size_bytes % 4 != 0 || size_bytes > max_size_bytes) {
+    throw std::invalid_argument("Invalid memory size.");
+  }
+
+  return size_bytes;
+}
+
+machine::machine(uint32_t ram_size_bytes, uint32_t flash_size_bytes)
+    : cpu{}
+    , systick{}
+    , cycle_count(0)
+    , events{}
+    , run{}
+    , fetch{}
+    , branch_was_taken(false)
+    , exit_instruction_encountered(false)
+    , ram(RAM_START, checked_size(ram_size_bytes, RAM_MAX_SIZE_BYTES))
+    , flash(FLASH_START, checked_size(flash_size_bytes, FLASH_MAX_SIZE_BYTES))
+    , semihosting(nullptr)
+    , tracer(nullptr)
+    , sampler(nullptr)
+#if defined(THUMBULATOR_PROFILE)
+    , profile{}
+#endif
+    , snapshot{}
+    , decoded(new decode_cache(cached_code_bytes(flash.size_bytes(), ram.size_bytes())))
+    , translations(new translation_cache(cached_code_bytes(flash.size_bytes(), ram.size_bytes())))
+{
+  events.next = EVENT_NEVER;
+  for(auto &deadline : events.deadlines) {
+    deadline = EVENT_NEVER;
+  }
+
+  // Stores into cached code drop it from the caches
+  ram.watch_code(invalidate_code, this);
+  flash.watch_code(invalidate_code, this);
+
+  // Reading the UART takes its input, so partial stores merge into 0
+  map_peripheral(this, UART_ADDRESS, 4, {load_uart, nullptr, store_uart, &uart});
+  map_peripheral(this, SYSTICK_ADDRESS, 16, {load_systick, peek_systick, store_systick, nullptr});
+
+  use_memory_policy(this, &no_hooks);
+}
+
+machine::~machine() = default;
+}
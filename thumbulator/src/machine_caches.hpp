@@ -0,0 +1,169 @@
+#ifndef THUMBULATOR_MACHINE_CACHES_HPP
+#define THUMBULATOR_MACHINE_CACHES_HPP
+
+#include "thumbulator/decode_cache.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory.hpp"
+
+#include "fusion.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace thumbulator {
+
+// The decode cache is split into pages that are allocated the first time code in them is executed
+#define DECODE_CACHE_PAGE_BYTES (1 << 12)
+#define DECODE_CACHE_PAGE_ENTRIES (DECODE_CACHE_PAGE_BYTES >> 1)
+
+// Code pages are the pages of the memories, so stores can tell whether they modify cached code
+static_assert(DECODE_CACHE_PAGE_BYTES == MEMORY_PAGE_BYTES, "Code pages must be memory pages");
+
+/**
+ * Number of bytes of code the caches of a machine cover, FLASH in whole pages followed by RAM.
+ */
+inline uint32_t cached_code_bytes(uint32_t flash_size_bytes, uint32_t ram_size_bytes)
+{
+  auto const flash_pages = (flash_size_bytes + MEMORY_PAGE_BYTES - 1) / MEMORY_PAGE_BYTES;
+
+  return flash_pages * MEMORY_PAGE_BYTES + ram_size_bytes;
+}
+
+/**
+ * Find where the caches keep code in RAM, see find_cached_code.
+ */
+memory_region *find_cached_ram_code(uint32_t address, uint32_t *offset);
+
+/**
+ * Find where the caches keep the code at an address.
+ *
+ * Code in RAM is only cached while the memory policy does not see instruction fetches.
+ *
+ * @param address The address of an instruction.
+ * @param offset Set to the offset of the address in the caches, see cached_code_bytes.
+ *
+ * @return The memory holding the address, nullptr if code at the address is not cached.
+ */
+inline memory_region *find_cached_code(uint32_t address, uint32_t *offset)
+{
+  auto &flash = current_machine->flash;
+  if(flash.contains(address)) {
+    *offset = address - FLASH_START;
+
+    return &flash;
+  }
+
+  return find_cached_ram_code(address, offset);
+}
+
+/**
+ * Drop the decoded and translated code of a machine overlapping modified bytes.
+ *
+ * The code hook of the memories of every machine, see memory_region::watch_code.
+ *
+ * @param target The machine.
+ * @param address The address of the first modified byte.
+ * @param bytes Number of modified bytes.
+ */
+void invalidate_code(void *target, uint32_t address, uint32_t bytes);
+
+/**
+ * The instructions of a machine that already went through the fetch and decode stages.
+ */
+struct decode_cache {
+  explicit decode_cache(uint32_t code_bytes)
+      : pages((static_cast<uint64_t>(code_bytes) + DECODE_CACHE_PAGE_BYTES - 1) /
+              DECODE_CACHE_PAGE_BYTES)
+      , current_start(0)
+      , current_page(nullptr)
+      , current_region(nullptr)
+      , uncached{}
+  {
+  }
+
+  std::vector<std::unique_ptr<decoded_instruction[]>> pages;
+
+  /**
+   * The page instructions were last fetched from, its address, and the memory holding it, so
+   * that fetches from the same page skip the page lookup. nullptr while there is no such page.
+   */
+  uint32_t current_start;
+  decoded_instruction *current_page;
+  memory_region *current_region;
+
+  /**
+   * Instructions outside of FLASH are decoded into this entry every time.
+   */
+  decoded_instruction uncached;
+};
+
+// Blocks are found through pages indexed by the cached code offset of their first instruction
+#define TRANSLATION_PAGE_BYTES (1 << 12)
+#define TRANSLATION_PAGE_ENTRIES (TRANSLATION_PAGE_BYTES >> 1)
+
+/**
+ * A basic block translated into a sequence of pre-bound handler calls.
+ */
+struct translated_block {
+  /**
+   * Address of the first instruction.
+   */
+  uint32_t start;
+
+  /**
+   * Address one past the last instruction.
+   */
+  uint32_t end;
+
+  std::vector<decoded_instruction> instructions;
+
+  /**
+   * The instructions with common pairs fused, run while no event can happen in the block.
+   */
+  std::vector<block_step> steps;
+
+  /**
+   * The blocks that last ran after this one, after a branch that was not taken and one that was.
+   */
+  translated_block *successors[2];
+
+  /**
+   * The generation of the translations when each successor was found, as retiring blocks
+   * invalidates the successors.
+   */
+  uint32_t successor_generations[2];
+};
+
+using translation_page = std::unique_ptr<translated_block>[];
+
+/**
+ * The basic blocks of a machine translated by execute_block.
+ */
+struct translation_cache {
+  explicit translation_cache(uint32_t code_bytes)
+      : pages((static_cast<uint64_t>(code_bytes) + TRANSLATION_PAGE_BYTES - 1) /
+              TRANSLATION_PAGE_BYTES)
+  {
+  }
+
+  std::vector<std::unique_ptr<translation_page>> pages;
+
+  /**
+   * Invalidated blocks may still be executing, so they are freed before the next block runs.
+   */
+  std::vector<std::unique_ptr<translated_block>> retired;
+
+  /**
+   * The block record_block is recording, nullptr while not recording.
+   */
+  translated_block const *recording = nullptr;
+
+  /**
+   * Incremented when an invalidation retires blocks or overlaps the block being recorded, so
+   * recording can detect that its block went stale.
+   */
+  uint32_t generation = 0;
+};
+}
+
+#endif //THUMBULATOR_MACHINE_CACHES_HPP
@@ -1,145 +1,478 @@
 #include "thumbulator/memory.hpp"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define THUMBULATOR_MMAP 1
+#endif
+
+#include "thumbulator/exit.hpp"
+#include "thumbulator/exmemwb_mem.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory_policy.hpp"
+#include "thumbulator/state_file.hpp"
 
 #include "cpu_flags.hpp"
-#include "exit.hpp"
+#include "run_control.hpp"
 
 namespace thumbulator {
 
-uint32_t RAM[RAM_SIZE_BYTES >> 2];
+// A bit per word, rounded up to whole pages so that pages can be scanned without bounds checks
+static uint64_t *allocate_dirty_words(uint32_t size_bytes)
+{
+  auto const pages = (static_cast<size_t>(size_bytes) + MEMORY_PAGE_BYTES - 1) / MEMORY_PAGE_BYTES;
+  // calloc leaves large blocks to the lazily committed zero pages of the host
+  auto *bits = static_cast<uint64_t *>(std::calloc(pages * MEMORY_PAGE_WORDS / 64, 8));
+  if(bits == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  return bits;
+}
 
-std::function<uint32_t(uint32_t, uint32_t)> ram_load_hook;
-std::function<uint32_t(uint32_t, uint32_t, uint32_t)> ram_store_hook;
+#if defined(THUMBULATOR_MMAP)
+// Anonymous mappings are committed one page at a time, the first time a page is touched
+static uint32_t *map_zeroed(void *address, size_t bytes)
+{
+  auto const flags = MAP_PRIVATE | MAP_ANONYMOUS | (address != nullptr ? MAP_FIXED : 0);
+  void *mapping = mmap(address, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
 
-uint32_t FLASH_MEMORY[FLASH_SIZE_BYTES >> 2];
+  return mapping == MAP_FAILED ? nullptr : static_cast<uint32_t *>(mapping);
+}
 
-uint32_t ram_load(uint32_t address, bool false_read)
+memory_region::memory_region(uint32_t start, uint32_t size_bytes)
+    : base(start)
+    , size(size_bytes)
+    , pages_to_save(((size_bytes + MEMORY_PAGE_BYTES - 1) / MEMORY_PAGE_BYTES + 63) / 64)
+    , code_pages(pages_to_save.size())
+    , watched_pages(pages_to_save.size())
+    , dirty_words(allocate_dirty_words(size_bytes))
+    , dirty_page_bits(pages_to_save.size())
 {
-  auto data = RAM[(address & RAM_ADDRESS_MASK) >> 2];
+  auto const page_bytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  mapped_bytes = (static_cast<size_t>(size) + page_bytes - 1) / page_bytes * page_bytes;
 
-  if(!false_read && ram_load_hook != nullptr) {
-    data = ram_load_hook(address, data);
+  words = map_zeroed(nullptr, mapped_bytes);
+  if(words == nullptr) {
+    throw std::bad_alloc();
   }
+}
 
-  return data;
+memory_region::~memory_region()
+{
+  munmap(words, mapped_bytes);
+  std::free(dirty_words);
 }
 
-void ram_store(uint32_t address, uint32_t value)
+void memory_region::clear()
 {
-  if(ram_store_hook != nullptr) {
-    auto const old_value = ram_load(address, true);
+  discard_saved_pages();
+  clear_dirty();
 
-    value = ram_store_hook(address, old_value, value);
+  // Replacing the mapping drops the committed pages, untouched pages are not visited at all
+  if(map_zeroed(words, mapped_bytes) == nullptr) {
+    std::memset(words, 0, mapped_bytes);
   }
 
-  RAM[(address & RAM_ADDRESS_MASK) >> 2] = value;
+  forget_code();
 }
 
-// Memory access functions assume that RAM has a higher address than Flash
-void fetch_instruction(uint32_t address, uint16_t *value)
+void memory_region::map_file(int descriptor, size_t bytes)
 {
-  uint32_t fromMem;
+  auto const page_bytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto const pages_bytes = (bytes + page_bytes - 1) / page_bytes * page_bytes;
+  if(pages_bytes > mapped_bytes) {
+    throw std::runtime_error("File does not fit in memory.");
+  }
 
-  if(address >= RAM_START) {
-    if(address >= (RAM_START + RAM_SIZE_BYTES)) {
-      fprintf(
-          stderr, "Error: ILR Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
-    }
+  discard_saved_pages();
+  clear_dirty();
+
+  auto const flags = MAP_PRIVATE | MAP_FIXED;
+  if(mmap(words, pages_bytes, PROT_READ | PROT_WRITE, flags, descriptor, 0) == MAP_FAILED) {
+    throw std::runtime_error("Could not map file into memory.");
+  }
 
-    fromMem = ram_load(address, false);
+  forget_code();
+}
+#else
+memory_region::memory_region(uint32_t start, uint32_t size_bytes)
+    : base(start)
+    , size(size_bytes)
+    , mapped_bytes(size_bytes)
+    , words(static_cast<uint32_t *>(std::calloc(size_bytes, 1)))
+    , pages_to_save(((size_bytes + MEMORY_PAGE_BYTES - 1) / MEMORY_PAGE_BYTES + 63) / 64)
+    , code_pages(pages_to_save.size())
+    , watched_pages(pages_to_save.size())
+    , dirty_words(allocate_dirty_words(size_bytes))
+    , dirty_page_bits(pages_to_save.size())
+{
+  if(words == nullptr) {
+    throw std::bad_alloc();
+  }
+}
+
+memory_region::~memory_region()
+{
+  std::free(words);
+  std::free(dirty_words);
+}
+
+void memory_region::clear()
+{
+  discard_saved_pages();
+  clear_dirty();
+  std::memset(words, 0, mapped_bytes);
+  forget_code();
+}
+
+void memory_region::map_file(int descriptor, size_t bytes)
+{
+  throw std::runtime_error("Mapping files is not supported on this platform.");
+}
+#endif
+
+void memory_region::clear_dirty()
+{
+  for(auto const page : dirty_page_list) {
+    std::memset(&dirty_words[page * MEMORY_PAGE_WORDS / 64], 0, MEMORY_PAGE_WORDS / 8);
+    dirty_page_bits[page >> 6] &= ~(uint64_t{1} << (page & 63));
+  }
+
+  dirty_page_list.clear();
+  dirty_count = 0;
+}
+
+void memory_region::save_pages()
+{
+  if(saving) {
+    // Only the pages saved last time need to be saved again
+    for(auto const page : saved_pages) {
+      pages_to_save[page >> 6] |= uint64_t{1} << (page & 63);
+    }
   } else {
-    if(address >= (FLASH_START + FLASH_SIZE_BYTES)) {
-      fprintf(
-          stderr, "Error: ILF Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
+    std::fill(pages_to_save.begin(), pages_to_save.end(), ~uint64_t{0});
+    saving = true;
+  }
+
+  update_watched_pages();
+  saved_pages.clear();
+  saved_contents.clear();
+}
+
+size_t memory_region::restore_pages()
+{
+  for(size_t i = 0; i < saved_pages.size(); ++i) {
+    auto const offset = saved_pages[i] * MEMORY_PAGE_BYTES;
+    auto const bytes = std::min<size_t>(MEMORY_PAGE_BYTES, size - offset);
+    std::memcpy(&words[offset >> 2], &saved_contents[i * MEMORY_PAGE_WORDS], bytes);
+
+    auto const page = saved_pages[i];
+    if(((code_pages[page >> 6] >> (page & 63)) & 0x1) != 0) {
+      code_modified(page);
     }
+  }
+
+  return saved_pages.size();
+}
+
+void memory_region::discard_saved_pages()
+{
+  std::fill(pages_to_save.begin(), pages_to_save.end(), 0);
+  update_watched_pages();
+  saved_pages.clear();
+  saved_pages.shrink_to_fit();
+  saved_contents.clear();
+  saved_contents.shrink_to_fit();
+  saving = false;
+}
 
-    fromMem = FLASH_MEMORY[(address & FLASH_ADDRESS_MASK) >> 2];
+void memory_region::save_page(uint32_t page)
+{
+  pages_to_save[page >> 6] &= ~(uint64_t{1} << (page & 63));
+  watched_pages[page >> 6] = pages_to_save[page >> 6] | code_pages[page >> 6];
+
+  auto const offset = page * MEMORY_PAGE_BYTES;
+  auto const bytes = std::min<size_t>(MEMORY_PAGE_BYTES, size - offset);
+  saved_pages.push_back(page);
+  saved_contents.resize(saved_contents.size() + MEMORY_PAGE_WORDS);
+  auto *const copy = &saved_contents[saved_contents.size() - MEMORY_PAGE_WORDS];
+  std::memcpy(copy, &words[offset >> 2], bytes);
+}
+
+void memory_region::page_written(uint32_t offset)
+{
+  auto const page = offset / MEMORY_PAGE_BYTES;
+  auto const bit = uint64_t{1} << (page & 63);
+  if((pages_to_save[page >> 6] & bit) != 0) {
+    save_page(page);
   }
 
-  // Data 32-bits, but instruction 16-bits
-  *value = ((address & 0x2) != 0) ? (uint16_t)(fromMem >> 16) : (uint16_t)fromMem;
+  if((code_pages[page >> 6] & bit) != 0 && code_hook != nullptr) {
+    code_hook(code_hook_context, base + (offset & ~0x3u), 4);
+  }
 }
 
-void load(uint32_t address, uint32_t *value, uint32_t false_read)
+uint8_t *memory_region::writable_bytes(uint32_t address, uint32_t bytes)
 {
-  if(address >= RAM_START) {
-    if(address >= (RAM_START + RAM_SIZE_BYTES)) {
-      // Check for UART
-      if(address == 0xE0000000) {
-        *value = 0;
-        return;
-      }
-
-      // Check for SYSTICK
-      if((address >> 4) == 0xE000E01) {
-        *value = ((uint32_t *)&SYSTICK)[(address >> 2) & 0x3];
-        if(address == 0xE000E010)
-          SYSTICK.control &= 0x00010000;
-
-        return;
-      }
-
-      fprintf(
-          stderr, "Error: DLR Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
+  auto const offset = address - base;
+  auto const end = offset + bytes;
+  for(auto page = offset / MEMORY_PAGE_BYTES; bytes != 0 && page <= (end - 1) / MEMORY_PAGE_BYTES;
+      ++page) {
+    auto const bit = uint64_t{1} << (page & 63);
+    if((watched_pages[page >> 6] & bit) == 0) {
+      continue;
     }
 
-    *value = ram_load(address, false_read == 1);
-  } else {
-    if(address >= (FLASH_START + FLASH_SIZE_BYTES)) {
-      fprintf(
-          stderr, "Error: DLF Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
+    if((pages_to_save[page >> 6] & bit) != 0) {
+      save_page(page);
     }
 
-    *value = FLASH_MEMORY[(address & FLASH_ADDRESS_MASK) >> 2];
+    if((code_pages[page >> 6] & bit) != 0 && code_hook != nullptr) {
+      auto const first = std::max(offset, page * MEMORY_PAGE_BYTES);
+      auto const last = std::min(end, (page + 1) * MEMORY_PAGE_BYTES);
+      code_hook(code_hook_context, base + first, last - first);
+    }
   }
+
+  return reinterpret_cast<uint8_t *>(words) + offset;
 }
 
-void store(uint32_t address, uint32_t value)
+void memory_region::code_modified(uint32_t page)
+{
+  if(code_hook != nullptr) {
+    auto const offset = page * MEMORY_PAGE_BYTES;
+    auto const bytes = std::min<uint32_t>(MEMORY_PAGE_BYTES, size - offset);
+    code_hook(code_hook_context, base + offset, bytes);
+  }
+}
+
+// All of the memory changed, so all of the cached code is stale
+void memory_region::forget_code()
 {
-  if(address >= RAM_START) {
-    if(address >= (RAM_START + RAM_SIZE_BYTES)) {
-      // Check for UART
-      if(address == 0xE0000000) {
-        return;
-      }
-
-      // Check for SYSTICK
-      if((address >> 4) == 0xE000E01 && address != 0xE000E01C) {
-        if(address == 0xE000E010) {
-          SYSTICK.control = (value & 0x1FFFD) | 0x4; // No external tick source, no interrupt
-
-          if(value & 0x2) {
-            fprintf(stderr, "Warning: SYSTICK interrupts not implemented, ignoring\n");
-          }
-        } else if(address == 0xE000E014) {
-          SYSTICK.reload = value & 0xFFFFFF;
-        } else if(address == 0xE000E018) {
-          // Reads clears current value
-          SYSTICK.value = 0;
-        }
-
-        return;
-      }
-
-      fprintf(
-          stderr, "Error: DSR Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
+  for(uint32_t group = 0; group < code_pages.size(); ++group) {
+    for(auto bits = code_pages[group]; bits != 0; bits &= bits - 1) {
+      code_modified(group * 64 + static_cast<uint32_t>(__builtin_ctzll(bits)));
     }
+  }
 
-    ram_store(address, value);
-  } else {
-    if(address >= (FLASH_START + FLASH_SIZE_BYTES)) {
-      fprintf(
-          stderr, "Error: DSF Memory access out of range: 0x%8.8X, pc=%x\n", address, cpu_get_pc());
-      terminate_simulation(1);
+  std::fill(code_pages.begin(), code_pages.end(), 0);
+  update_watched_pages();
+}
+
+void memory_region::update_watched_pages()
+{
+  for(size_t group = 0; group < watched_pages.size(); ++group) {
+    watched_pages[group] = pages_to_save[group] | code_pages[group];
+  }
+}
+
+static bool is_zero(uint32_t const *words, size_t count)
+{
+  uint32_t bits = 0;
+  for(size_t i = 0; i < count; ++i) {
+    bits |= words[i];
+  }
+
+  return bits == 0;
+}
+
+void memory_region::write_state(FILE *out) const
+{
+  write_state_value(out, base);
+  write_state_value(out, size);
+
+  // The contents, by page, leaving out the pages of zeros
+  std::vector<uint32_t> pages;
+  for(uint32_t page = 0; page * MEMORY_PAGE_BYTES < size; ++page) {
+    auto const bytes = std::min<uint32_t>(MEMORY_PAGE_BYTES, size - page * MEMORY_PAGE_BYTES);
+    if(!is_zero(&words[page * MEMORY_PAGE_WORDS], bytes >> 2)) {
+      pages.push_back(page);
     }
+  }
+
+  write_state_value(out, static_cast<uint32_t>(pages.size()));
+  for(auto const page : pages) {
+    auto const bytes = std::min<uint32_t>(MEMORY_PAGE_BYTES, size - page * MEMORY_PAGE_BYTES);
+    write_state_value(out, page);
+    write_state_bytes(out, &words[page * MEMORY_PAGE_WORDS], bytes);
+  }
 
-    FLASH_MEMORY[(address & FLASH_ADDRESS_MASK) >> 2] = value;
+  // The saved pages, all other pages are to be saved while saving
+  write_state_value(out, static_cast<uint8_t>(saving));
+  write_state_value(out, static_cast<uint32_t>(saved_pages.size()));
+  for(size_t i = 0; i < saved_pages.size(); ++i) {
+    write_state_value(out, saved_pages[i]);
+    write_state_bytes(out, &saved_contents[i * MEMORY_PAGE_WORDS], MEMORY_PAGE_BYTES);
   }
+
+  // The dirty words of the dirty pages, in the order the pages were dirtied
+  write_state_value(out, static_cast<uint32_t>(dirty_page_list.size()));
+  for(auto const page : dirty_page_list) {
+    write_state_value(out, page);
+    write_state_bytes(out, &dirty_words[page * MEMORY_PAGE_WORDS / 64], MEMORY_PAGE_WORDS / 8);
+  }
+}
+
+void memory_region::read_state(FILE *in)
+{
+  auto const read_base = read_state_value<uint32_t>(in);
+  auto const read_size = read_state_value<uint32_t>(in);
+  if(read_base != base || read_size != size) {
+    throw std::runtime_error("State file holds a memory of another size.");
+  }
+
+  clear();
+
+  auto const page_count = (size + MEMORY_PAGE_BYTES - 1) / MEMORY_PAGE_BYTES;
+  auto const read_page = [&]() {
+    auto const page = read_state_value<uint32_t>(in);
+    if(page >= page_count) {
+      throw std::runtime_error("State file holds a page outside of the memory.");
+    }
+
+    return page;
+  };
+
+  auto const pages = read_state_value<uint32_t>(in);
+  for(uint32_t i = 0; i < pages; ++i) {
+    auto const page = read_page();
+    auto const bytes = std::min<uint32_t>(MEMORY_PAGE_BYTES, size - page * MEMORY_PAGE_BYTES);
+    read_state_bytes(in, &words[page * MEMORY_PAGE_WORDS], bytes);
+  }
+
+  saving = read_state_value<uint8_t>(in) != 0;
+  if(saving) {
+    std::fill(pages_to_save.begin(), pages_to_save.end(), ~uint64_t{0});
+  }
+
+  auto const saved = read_state_value<uint32_t>(in);
+  saved_contents.resize(static_cast<size_t>(saved) * MEMORY_PAGE_WORDS);
+  for(uint32_t i = 0; i < saved; ++i) {
+    auto const page = read_page();
+    read_state_bytes(in, &saved_contents[i * MEMORY_PAGE_WORDS], MEMORY_PAGE_BYTES);
+    saved_pages.push_back(page);
+    pages_to_save[page >> 6] &= ~(uint64_t{1} << (page & 63));
+  }
+  update_watched_pages();
+
+  auto const dirty = read_state_value<uint32_t>(in);
+  for(uint32_t i = 0; i < dirty; ++i) {
+    auto const page = read_page();
+    auto *const bits = &dirty_words[page * MEMORY_PAGE_WORDS / 64];
+    read_state_bytes(in, bits, MEMORY_PAGE_WORDS / 8);
+    for(uint32_t group = 0; group < MEMORY_PAGE_WORDS / 64; ++group) {
+      dirty_count += static_cast<size_t>(__builtin_popcountll(bits[group]));
+    }
+
+    dirty_page_bits[page >> 6] |= uint64_t{1} << (page & 63);
+    dirty_page_list.push_back(page);
+  }
+}
+
+// Calls the hooks of whichever memory policy the machine uses
+struct type_erased_policy {
+  uint32_t ram_load(uint32_t address, uint32_t data)
+  {
+    return current_machine->ram_load_hook(current_machine->memory_policy, address, data);
+  }
+
+  uint32_t ram_store(uint32_t address, uint32_t old_value, uint32_t value)
+  {
+    return current_machine->ram_store_hook(
+        current_machine->memory_policy, address, old_value, value);
+  }
+};
+
+// Move the fetch window to the region holding the specified address
+static void enter_fetch_region(uint32_t address)
+{
+  auto *const target = current_machine;
+
+  memory_region *region;
+  if(target->flash.contains(address)) {
+    region = &target->flash;
+  } else if(target->ram.contains(address)) {
+    region = &target->ram;
+  } else {
+    terminate_simulation(FAULT_FETCH_OUT_OF_RANGE, address);
+  }
+
+  target->fetch.start = region->start();
+  target->fetch.size = region->size_bytes();
+  target->fetch.words = region->data();
+  // Without hooks the memory policy passes fetches from RAM through unchanged
+  auto const *const unhooked = &memory_handlers_of<no_memory_policy>::table;
+  target->fetch.hooked = region == &target->ram && target->memory_instructions != unhooked;
+}
+
+void fetch_instruction(uint32_t address, uint16_t *value)
+{
+  auto const &window = current_machine->fetch;
+  if(address - window.start >= window.size) {
+    enter_fetch_region(address);
+  }
+
+  uint32_t fromMem = window.words[(address - window.start) >> 2];
+  if(window.hooked) {
+    fromMem = type_erased_policy().ram_load(address, fromMem);
+  }
+
+  // Data 32-bits, but instruction 16-bits
+  *value = ((address & 0x2) != 0) ? (uint16_t)(fromMem >> 16) : (uint16_t)fromMem;
+}
+
+void load(uint32_t address, uint32_t *value, uint32_t false_read)
+{
+  type_erased_policy policy;
+  load(&policy, address, value, false_read);
+}
+
+void store(uint32_t address, uint32_t value)
+{
+  type_erased_policy policy;
+  store(&policy, address, value);
+}
+
+void load_peripheral(uint32_t address, uint32_t *value, uint32_t false_read)
+{
+  auto const *device = current_machine->peripherals.find(address);
+  if(device != nullptr && false_read == 1) {
+    // Byte and halfword stores must not change the register they merge into by reading it
+    *value = device->peek == nullptr ? 0 : device->peek(device->context, address);
+    return;
+  }
+
+  if(device == nullptr || device->load == nullptr) {
+    terminate_simulation(FAULT_LOAD_OUT_OF_RANGE, address);
+  }
+
+  note_peripheral_access();
+  *value = device->load(device->context, address);
+}
+
+void store_outside_ram(uint32_t address, uint32_t value)
+{
+  auto &flash = current_machine->flash;
+  if(flash.contains(address)) {
+    // Code cached from the page is dropped through the code hook of FLASH
+    flash.writable_word(address) = value;
+    return;
+  }
+
+  auto const *device = current_machine->peripherals.find(address);
+  if(device == nullptr || device->store == nullptr) {
+    terminate_simulation(FAULT_STORE_OUT_OF_RANGE, address);
+  }
+
+  note_peripheral_access();
+  device->store(device->context, address, value);
 }
 }
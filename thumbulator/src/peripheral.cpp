@@ -0,0 +1,84 @@
+#include "thumbulator/peripheral.hpp"
+
+#include "thumbulator/machine.hpp"
+
+#include <stdexcept>
+
+namespace thumbulator {
+
+// The upper bits of an address select a table of pages, the middle ones the page in it
+#define PERIPHERAL_TABLE_SHIFT 22
+#define PERIPHERAL_TABLES (1 << (32 - PERIPHERAL_TABLE_SHIFT))
+#define PERIPHERAL_TABLE_PAGES (1 << (PERIPHERAL_TABLE_SHIFT - PERIPHERAL_PAGE_SHIFT))
+
+// Whether or not two ranges of addresses, neither of them empty nor wrapping around, overlap
+static bool overlaps(uint32_t start, uint32_t size, uint32_t other_start, uint32_t other_size)
+{
+  return start - other_start < other_size || other_start - start < size;
+}
+
+peripheral_bus::peripheral_bus() : pages(new std::unique_ptr<uint32_t[]>[PERIPHERAL_TABLES])
+{
+}
+
+void peripheral_bus::map(uint32_t start, uint32_t size_bytes, peripheral_device const &device)
+{
+  if(size_bytes == 0 || size_bytes - 1 > UINT32_MAX - start) {
+    throw std::invalid_argument("Invalid peripheral address range.");
+  }
+
+  for(auto const &mapped : mappings) {
+    if(overlaps(start, size_bytes, mapped.start, mapped.size)) {
+      throw std::invalid_argument("Peripheral address range already in use.");
+    }
+  }
+
+  auto const index = static_cast<uint32_t>(mappings.size());
+  mappings.push_back({start, size_bytes, device});
+
+  auto const first_page = start >> PERIPHERAL_PAGE_SHIFT;
+  auto const last_page = (start + (size_bytes - 1)) >> PERIPHERAL_PAGE_SHIFT;
+  for(auto page = first_page; page <= last_page; ++page) {
+    auto &table = pages[page / PERIPHERAL_TABLE_PAGES];
+    if(!table) {
+      table.reset(new uint32_t[PERIPHERAL_TABLE_PAGES]());
+    }
+
+    auto &first = table[page % PERIPHERAL_TABLE_PAGES];
+    links.push_back({index, first});
+    first = static_cast<uint32_t>(links.size());
+  }
+}
+
+peripheral_device const *peripheral_bus::find(uint32_t address) const
+{
+  auto const page = address >> PERIPHERAL_PAGE_SHIFT;
+  auto const &table = pages[page / PERIPHERAL_TABLE_PAGES];
+  if(!table) {
+    return nullptr;
+  }
+
+  for(auto link = table[page % PERIPHERAL_TABLE_PAGES]; link != 0; link = links[link - 1].next) {
+    auto const &mapped = mappings[links[link - 1].mapping];
+    if(address - mapped.start < mapped.size) {
+      return &mapped.device;
+    }
+  }
+
+  return nullptr;
+}
+
+void map_peripheral(
+    machine *target, uint32_t start, uint32_t size_bytes, peripheral_device const &device)
+{
+  if(size_bytes != 0 && size_bytes - 1 <= UINT32_MAX - start) {
+    for(auto const *region : {&target->ram, &target->flash}) {
+      if(overlaps(start, size_bytes, region->start(), region->size_bytes())) {
+        throw std::invalid_argument("Peripheral address range overlaps a memory.");
+      }
+    }
+  }
+
+  target->peripherals.map(start, size_bytes, device);
+}
+}
@@ -0,0 +1,138 @@
+#include "thumbulator/profile.hpp"
+
+#include "thumbulator/exmemwb_mem.hpp"
+#include "thumbulator/machine.hpp"
+
+#include "exmemwb.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace thumbulator {
+
+void reset_profile()
+{
+#if defined(THUMBULATOR_PROFILE)
+  current_machine->profile = execution_profile{};
+#endif
+}
+
+#if defined(THUMBULATOR_PROFILE)
+struct handler_name {
+  execute_handler handler;
+  char const *name;
+};
+
+#define HANDLER(handler) {handler, #handler}
+#define MEMORY_HANDLER(member) {memory_handlers_of<no_memory_policy>::table.member, #member}
+
+static handler_name const handler_names[] = {HANDLER(adcs), HANDLER(adds_i3), HANDLER(adds_i8),
+    HANDLER(adds_r), HANDLER(add_r), HANDLER(add_sp), HANDLER(adr), HANDLER(subs_i3),
+    HANDLER(subs_i8), HANDLER(subs), HANDLER(sub_sp), HANDLER(sbcs), HANDLER(rsbs), HANDLER(muls),
+    HANDLER(cmn), HANDLER(cmp_i), HANDLER(cmp_r), HANDLER(tst), HANDLER(b), HANDLER(b_c),
+    HANDLER(blx), HANDLER(bx), HANDLER(bl), HANDLER(ands), HANDLER(bics), HANDLER(eors),
+    HANDLER(orrs), HANDLER(mvns), HANDLER(asrs_i), HANDLER(asrs_r), HANDLER(lsls_i),
+    HANDLER(lsrs_i), HANDLER(lsls_r), HANDLER(lsrs_r), HANDLER(rors), HANDLER(movs_i),
+    HANDLER(mov_r), HANDLER(movs_r), HANDLER(sxtb), HANDLER(sxth), HANDLER(uxtb), HANDLER(uxth),
+    HANDLER(rev), HANDLER(rev16), HANDLER(revsh), HANDLER(breakpoint), HANDLER(exmemwb_error),
+    HANDLER(exmemwb_exit_simulation), MEMORY_HANDLER(ldm), MEMORY_HANDLER(stm),
+    MEMORY_HANDLER(pop), MEMORY_HANDLER(push), MEMORY_HANDLER(ldr_i), MEMORY_HANDLER(ldr_sp),
+    MEMORY_HANDLER(ldr_lit), MEMORY_HANDLER(ldr_r), MEMORY_HANDLER(ldrb_i),
+    MEMORY_HANDLER(ldrb_r), MEMORY_HANDLER(ldrh_i), MEMORY_HANDLER(ldrh_r),
+    MEMORY_HANDLER(ldrsb_r), MEMORY_HANDLER(ldrsh_r), MEMORY_HANDLER(str_i),
+    MEMORY_HANDLER(str_sp), MEMORY_HANDLER(str_r), MEMORY_HANDLER(strb_i), MEMORY_HANDLER(strb_r),
+    MEMORY_HANDLER(strh_i), MEMORY_HANDLER(strh_r)};
+
+#undef HANDLER
+#undef MEMORY_HANDLER
+
+static char const *name_of(execute_handler handler)
+{
+  for(auto const &entry : handler_names) {
+    if(entry.handler == handler) {
+      return entry.name;
+    }
+  }
+
+  return "unknown";
+}
+
+struct profile_line {
+  char label[32];
+  profile_counter counter;
+};
+
+static void print_lines(FILE *out, char const *title, std::vector<profile_line> lines,
+    profile_counter const &total)
+{
+  std::sort(lines.begin(), lines.end(), [](profile_line const &a, profile_line const &b) {
+    return a.counter.executions > b.counter.executions;
+  });
+
+  fprintf(out, "%-30s %16s %7s %16s %7s\n", title, "executions", "%", "cycles", "%");
+  for(auto const &line : lines) {
+    if(line.counter.executions == 0) {
+      continue;
+    }
+
+    fprintf(out, "%-30s %16llu %6.2f%% %16llu %6.2f%%\n", line.label,
+        static_cast<unsigned long long>(line.counter.executions),
+        100.0 * line.counter.executions / total.executions,
+        static_cast<unsigned long long>(line.counter.cycles),
+        100.0 * line.counter.cycles / total.cycles);
+  }
+}
+#endif
+
+void print_profile(FILE *out)
+{
+#if defined(THUMBULATOR_PROFILE)
+  auto const &groups = current_machine->profile.groups;
+
+  profile_counter total{0, 0};
+  std::vector<profile_line> handlers;
+  std::vector<profile_line> slots(64);
+  for(uint32_t group = 0; group < PROFILE_GROUPS; ++group) {
+    auto const &counter = groups[group];
+    total.executions += counter.executions;
+    total.cycles += counter.cycles;
+
+    // The lowest bit only matters to tell the exit instruction from the other SVCs
+    auto const instruction = static_cast<uint16_t>((group << PROFILE_GROUP_SHIFT) | 0x1);
+    auto const *const name = name_of(resolve_entry(instruction));
+    auto it = std::find_if(handlers.begin(), handlers.end(),
+        [name](profile_line const &line) { return std::strcmp(line.label, name) == 0; });
+    if(it == handlers.end()) {
+      handlers.push_back(profile_line{});
+      it = handlers.end() - 1;
+      snprintf(it->label, sizeof(it->label), "%s", name);
+    }
+    it->counter.executions += counter.executions;
+    it->counter.cycles += counter.cycles;
+
+    auto &slot = slots[instruction >> 10];
+    slot.counter.executions += counter.executions;
+    slot.counter.cycles += counter.cycles;
+  }
+
+  for(uint32_t slot = 0; slot < slots.size(); ++slot) {
+    snprintf(slots[slot].label, sizeof(slots[slot].label), "opcode[%u] %04X-%04X",
+        slot, slot << 10, (slot << 10) | 0x3FF);
+  }
+
+  if(total.executions == 0) {
+    fprintf(out, "Profile: no instructions executed\n");
+    return;
+  }
+
+  fprintf(out, "Profile: %llu instructions, %llu cycles\n",
+      static_cast<unsigned long long>(total.executions),
+      static_cast<unsigned long long>(total.cycles));
+  print_lines(out, "handler", handlers, total);
+  print_lines(out, "6-bit opcode", slots, total);
+#else
+  (void)out;
+#endif
+}
+}
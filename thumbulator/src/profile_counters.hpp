@@ -0,0 +1,26 @@
+#ifndef THUMBULATOR_PROFILE_COUNTERS_HPP
+#define THUMBULATOR_PROFILE_COUNTERS_HPP
+
+#include "thumbulator/machine.hpp"
+#include "thumbulator/profile.hpp"
+
+namespace thumbulator {
+
+/**
+ * Count an executed instruction in the profile of a machine, a no-op unless THUMBULATOR_PROFILE.
+ */
+inline void count_instruction(machine *bound, uint16_t instruction, uint32_t cycles)
+{
+#if defined(THUMBULATOR_PROFILE)
+  auto &counter = bound->profile.groups[instruction >> PROFILE_GROUP_SHIFT];
+  counter.executions++;
+  counter.cycles += cycles;
+#else
+  (void)bound;
+  (void)instruction;
+  (void)cycles;
+#endif
+}
+}
+
+#endif //THUMBULATOR_PROFILE_COUNTERS_HPP
@@ -0,0 +1,338 @@
+#include "thumbulator/program.hpp"
+
+#include "thumbulator/decode_cache.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory.hpp"
+#include "thumbulator/snapshot.hpp"
+#include "thumbulator/translation.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace thumbulator {
+
+// The parts of the ELF format used by the loader, see the System V ABI
+#define ELF_CLASS_32 1
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define ELF_TYPE_EXECUTABLE 2
+#define ELF_MACHINE_ARM 40
+#define ELF_SEGMENT_LOAD 1
+#define ELF_SECTION_SYMBOL_TABLE 2
+#define ELF_SYMBOL_OBJECT 1
+#define ELF_SYMBOL_FUNCTION 2
+
+struct elf_header {
+  uint8_t identification[16];
+  uint16_t type;
+  uint16_t machine;
+  uint32_t version;
+  uint32_t entry;
+  uint32_t program_header_offset;
+  uint32_t section_header_offset;
+  uint32_t flags;
+  uint16_t header_size;
+  uint16_t program_header_size;
+  uint16_t program_header_count;
+  uint16_t section_header_size;
+  uint16_t section_header_count;
+  uint16_t section_names_index;
+};
+
+struct elf_program_header {
+  uint32_t type;
+  uint32_t offset;
+  uint32_t virtual_address;
+  uint32_t physical_address;
+  uint32_t file_size;
+  uint32_t memory_size;
+  uint32_t flags;
+  uint32_t align;
+};
+
+struct elf_section_header {
+  uint32_t name;
+  uint32_t type;
+  uint32_t flags;
+  uint32_t address;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t link;
+  uint32_t info;
+  uint32_t address_align;
+  uint32_t entry_size;
+};
+
+struct elf_symbol {
+  uint32_t name;
+  uint32_t value;
+  uint32_t size;
+  uint8_t info;
+  uint8_t other;
+  uint16_t section_index;
+};
+
+// Copy a structure out of the file, which does not guarantee its alignment
+template <typename T>
+T read_at(uint8_t const *file, size_t file_bytes, size_t offset)
+{
+  if(offset > file_bytes || file_bytes - offset < sizeof(T)) {
+    throw std::runtime_error("Truncated ELF file.");
+  }
+
+  T value;
+  std::memcpy(&value, file + offset, sizeof(T));
+
+  return value;
+}
+
+// Whether a range of addresses lies within [start, start + size)
+static bool inside(uint32_t address, uint32_t bytes, uint32_t start, uint32_t size)
+{
+  return address >= start && address - start <= size && bytes <= size - (address - start);
+}
+
+program_image::program_image(char const *path)
+    : file(nullptr)
+    , file_bytes(0)
+    , flash_descriptor(-1)
+    , flash_bytes(0)
+{
+  auto const descriptor = open(path, O_RDONLY | O_CLOEXEC);
+  if(descriptor < 0) {
+    throw std::runtime_error("Could not open binary file.");
+  }
+
+  struct stat status;
+  if(fstat(descriptor, &status) != 0 || status.st_size == 0) {
+    close(descriptor);
+    throw std::runtime_error("Could not read binary file.");
+  }
+
+  file_bytes = static_cast<size_t>(status.st_size);
+  void *mapping = mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  if(mapping == MAP_FAILED) {
+    close(descriptor);
+    throw std::runtime_error("Could not map binary file.");
+  }
+  file = static_cast<uint8_t const *>(mapping);
+
+  try {
+    if(file_bytes >= 4 && std::memcmp(file, "\x7F" "ELF", 4) == 0) {
+      close(descriptor);
+      open_elf();
+      read_symbols();
+      prepare_flash(path);
+    } else {
+      // A raw image is mapped straight from the file
+      flash_descriptor = descriptor;
+      flash_bytes = std::min(file_bytes, static_cast<size_t>(FLASH_MAX_SIZE_BYTES));
+      auto const bytes = static_cast<uint32_t>(flash_bytes);
+      program_segments.push_back({FLASH_START, FLASH_START, bytes, bytes, 0});
+    }
+  } catch(...) {
+    release();
+    throw;
+  }
+}
+
+program_image::~program_image()
+{
+  release();
+}
+
+void program_image::release()
+{
+  if(flash_descriptor >= 0) {
+    close(flash_descriptor);
+    flash_descriptor = -1;
+  }
+
+  if(file != nullptr) {
+    munmap(const_cast<uint8_t *>(file), file_bytes);
+    file = nullptr;
+  }
+}
+
+void program_image::open_elf()
+{
+  auto const header = read_at<elf_header>(file, file_bytes, 0);
+  if(header.identification[4] != ELF_CLASS_32 ||
+      header.identification[5] != ELF_DATA_LITTLE_ENDIAN || header.machine != ELF_MACHINE_ARM) {
+    throw std::runtime_error("Not a 32-bit little-endian ARM ELF file.");
+  }
+
+  if(header.type != ELF_TYPE_EXECUTABLE) {
+    throw std::runtime_error("ELF file is not an executable.");
+  }
+
+  for(uint32_t i = 0; i < header.program_header_count; ++i) {
+    auto const offset = header.program_header_offset + i * header.program_header_size;
+    auto const segment = read_at<elf_program_header>(file, file_bytes, offset);
+    if(segment.type != ELF_SEGMENT_LOAD || segment.memory_size == 0) {
+      continue;
+    }
+
+    if(segment.file_size > segment.memory_size || segment.offset > file_bytes ||
+        segment.file_size > file_bytes - segment.offset) {
+      throw std::runtime_error("Malformed ELF segment.");
+    }
+
+    program_segments.push_back({segment.virtual_address, segment.physical_address,
+        segment.file_size, segment.memory_size, segment.offset});
+  }
+
+  if(program_segments.empty()) {
+    throw std::runtime_error("ELF file has nothing to load.");
+  }
+}
+
+void program_image::read_symbols()
+{
+  auto const header = read_at<elf_header>(file, file_bytes, 0);
+
+  for(uint32_t i = 0; i < header.section_header_count; ++i) {
+    auto const offset = header.section_header_offset + i * header.section_header_size;
+    auto const table = read_at<elf_section_header>(file, file_bytes, offset);
+    if(table.type != ELF_SECTION_SYMBOL_TABLE || table.link >= header.section_header_count) {
+      continue;
+    }
+
+    auto const names = read_at<elf_section_header>(
+        file, file_bytes, header.section_header_offset + table.link * header.section_header_size);
+    if(names.offset > file_bytes || names.size > file_bytes - names.offset) {
+      throw std::runtime_error("Malformed ELF string table.");
+    }
+
+    for(uint32_t entry = 0; entry < table.size / sizeof(elf_symbol); ++entry) {
+      auto const symbol =
+          read_at<elf_symbol>(file, file_bytes, table.offset + entry * sizeof(elf_symbol));
+      auto const type = symbol.info & 0xF;
+      if((type != ELF_SYMBOL_FUNCTION && type != ELF_SYMBOL_OBJECT) || symbol.name == 0 ||
+          symbol.name >= names.size) {
+        continue;
+      }
+
+      auto const *name = reinterpret_cast<char const *>(file + names.offset + symbol.name);
+      auto const length = strnlen(name, names.size - symbol.name);
+      auto const function = type == ELF_SYMBOL_FUNCTION;
+      // Thumb functions have the lowest bit of their address set
+      auto const address = function ? symbol.value & ~0x1u : symbol.value;
+
+      program_symbols.push_back({std::string(name, length), address, symbol.size, function});
+    }
+  }
+
+  std::sort(program_symbols.begin(), program_symbols.end(),
+      [](program_symbol const &a, program_symbol const &b) { return a.address < b.address; });
+}
+
+void program_image::prepare_flash(char const *path)
+{
+  for(auto const &segment : program_segments) {
+    auto const in_flash =
+        inside(segment.load_address, segment.file_bytes, FLASH_START, FLASH_MAX_SIZE_BYTES);
+    auto const in_ram =
+        inside(segment.address, segment.memory_bytes, RAM_START, RAM_MAX_SIZE_BYTES);
+    if(!in_flash && !in_ram) {
+      throw std::runtime_error("ELF segment outside of FLASH and RAM.");
+    }
+
+    if(in_flash && segment.file_bytes > 0) {
+      auto const end = size_t{segment.load_address - FLASH_START} + segment.file_bytes;
+      flash_bytes = std::max(flash_bytes, end);
+    }
+  }
+
+#if defined(__linux__)
+  flash_descriptor = memfd_create(path, MFD_CLOEXEC);
+#else
+  auto *temporary = std::tmpfile();
+  flash_descriptor = temporary == nullptr ? -1 : dup(fileno(temporary));
+  if(temporary != nullptr) {
+    std::fclose(temporary);
+  }
+#endif
+  if(flash_descriptor < 0 || ftruncate(flash_descriptor, static_cast<off_t>(flash_bytes)) != 0) {
+    throw std::runtime_error("Could not create FLASH image.");
+  }
+
+  if(flash_bytes == 0) {
+    return;
+  }
+
+  auto const protection = PROT_READ | PROT_WRITE;
+  void *image = mmap(nullptr, flash_bytes, protection, MAP_SHARED, flash_descriptor, 0);
+  if(image == MAP_FAILED) {
+    throw std::runtime_error("Could not map FLASH image.");
+  }
+
+  for(auto const &segment : program_segments) {
+    if(inside(segment.load_address, segment.file_bytes, FLASH_START, FLASH_MAX_SIZE_BYTES)) {
+      std::memcpy(static_cast<uint8_t *>(image) + (segment.load_address - FLASH_START),
+          file + segment.file_offset, segment.file_bytes);
+    }
+  }
+
+  munmap(image, flash_bytes);
+}
+
+program_symbol const *program_image::find_symbol(uint32_t address) const
+{
+  // The last symbol starting at or before the address
+  auto it = std::upper_bound(program_symbols.begin(), program_symbols.end(), address,
+      [](uint32_t value, program_symbol const &symbol) { return value < symbol.address; });
+
+  while(it != program_symbols.begin()) {
+    --it;
+    if(address - it->address < std::max(it->size, 1u)) {
+      return &*it;
+    }
+
+    if(it->size != 0) {
+      break;
+    }
+  }
+
+  return nullptr;
+}
+
+void program_image::load(machine *target) const
+{
+  if(flash_bytes > target->flash.size_bytes()) {
+    throw std::runtime_error("Program does not fit in FLASH.");
+  }
+
+  target->flash.clear();
+  if(flash_bytes > 0) {
+    target->flash.map_file(flash_descriptor, flash_bytes);
+  }
+
+  // Segments that run from RAM get their initial contents there, like the startup code would
+  for(auto const &segment : program_segments) {
+    if(!inside(segment.address, segment.memory_bytes, RAM_START, RAM_MAX_SIZE_BYTES)) {
+      continue;
+    }
+
+    if(!inside(segment.address, segment.memory_bytes, RAM_START, target->ram.size_bytes())) {
+      throw std::runtime_error("Program does not fit in RAM.");
+    }
+
+    auto *const start =
+        reinterpret_cast<uint8_t *>(target->ram.data()) + (segment.address - RAM_START);
+    std::memcpy(start, file + segment.file_offset, segment.file_bytes);
+    std::memset(start + segment.file_bytes, 0, segment.memory_bytes - segment.file_bytes);
+  }
+
+  machine_binding binding(target);
+  drop_snapshot();
+  flush_decode_cache();
+  flush_translations();
+}
+}
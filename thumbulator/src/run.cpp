@@ -0,0 +1,80 @@
+#include "thumbulator/run.hpp"
+
+#include "thumbulator/machine.hpp"
+#include "thumbulator/translation.hpp"
+
+#include "events.hpp"
+#include "run_control.hpp"
+
+#include <algorithm>
+
+namespace thumbulator {
+
+void cycle_budget_reached()
+{
+  stop_run(STOP_CYCLE_BUDGET);
+}
+
+void request_stop()
+{
+  stop_run(STOP_REQUESTED);
+}
+
+// Put the machine back to running outside of run_until
+static void end_run()
+{
+  auto &run = current_machine->run;
+  run.running = false;
+  run.stop_on_peripheral_access = false;
+  run.pending_stop = STOP_NONE;
+
+  schedule_event(EVENT_CYCLE_BUDGET, EVENT_NEVER);
+}
+
+run_result run_until(run_limits const &limits)
+{
+  auto *const bound = current_machine;
+  bound->run.running = true;
+  bound->run.stop_on_peripheral_access = limits.stop_on_peripheral_access;
+  bound->run.pending_stop = STOP_NONE;
+
+  // The budget event stops the run at the instruction that reaches it, even within a block
+  auto const start = bound->cycle_count;
+  auto const has_cycle_budget = limits.cycles != UINT64_MAX && limits.cycles < EVENT_NEVER - start;
+  if(has_cycle_budget) {
+    schedule_event(EVENT_CYCLE_BUDGET, start + limits.cycles);
+  }
+
+  run_result result{0, 0, STOP_NONE};
+  try {
+    while(result.reason == STOP_NONE) {
+      if(bound->exit_instruction_encountered) {
+        result.reason = STOP_EXIT;
+      } else if(result.cycles >= limits.cycles) {
+        result.reason = STOP_CYCLE_BUDGET;
+      } else if(result.instructions >= limits.instructions) {
+        result.reason = STOP_INSTRUCTION_BUDGET;
+      } else {
+        auto const remaining = limits.instructions - result.instructions;
+        auto const longest = std::min<uint64_t>(remaining, MAX_CHAINED_INSTRUCTIONS);
+        auto const executed = execute_block(static_cast<uint32_t>(longest));
+        result.instructions += executed.instructions;
+        result.cycles += executed.cycles;
+
+        if(bound->exit_instruction_encountered) {
+          result.reason = STOP_EXIT;
+        } else {
+          result.reason = bound->run.pending_stop;
+        }
+      }
+    }
+  } catch(...) {
+    end_run();
+    throw;
+  }
+
+  end_run();
+
+  return result;
+}
+}
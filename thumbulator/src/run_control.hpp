@@ -0,0 +1,35 @@
+#ifndef THUMBULATOR_RUN_CONTROL_HPP
+#define THUMBULATOR_RUN_CONTROL_HPP
+
+#include "thumbulator/machine.hpp"
+
+namespace thumbulator {
+
+/**
+ * Make the run_until in progress stop after the executing instruction, keeping the first reason.
+ */
+inline void stop_run(stop_reason reason)
+{
+  auto &run = current_machine->run;
+  if(run.running && run.pending_stop == STOP_NONE) {
+    run.pending_stop = reason;
+  }
+}
+
+/**
+ * Note an access to a peripheral, which stops the run if asked to.
+ */
+inline void note_peripheral_access()
+{
+  if(current_machine->run.stop_on_peripheral_access) {
+    stop_run(STOP_PERIPHERAL_ACCESS);
+  }
+}
+
+/**
+ * Stop the run_until in progress because its cycle budget was reached.
+ */
+void cycle_budget_reached();
+}
+
+#endif //THUMBULATOR_RUN_CONTROL_HPP
@@ -0,0 +1,131 @@
+#include "thumbulator/sampler.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/program.hpp"
+
+#include "events.hpp"
+#include "sampling.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace thumbulator {
+
+pc_sampler::pc_sampler(uint64_t period_cycles)
+    : period_cycles(period_cycles)
+    , sample_count(0)
+{
+  if(period_cycles == 0) {
+    throw std::invalid_argument("The sampling period must be at least one cycle.");
+  }
+}
+
+void pc_sampler::drop_returned_frames(uint32_t sp)
+{
+  // The stack grows down, so calls made with a lower stack pointer have returned
+  while(!stack.empty() && stack.back().sp < sp) {
+    stack.pop_back();
+  }
+}
+
+void pc_sampler::call(uint32_t return_address, uint32_t sp)
+{
+  drop_returned_frames(sp);
+  stack.push_back({return_address, sp});
+}
+
+void pc_sampler::return_to(uint32_t address, uint32_t sp)
+{
+  for(auto i = stack.size(); i > 0; --i) {
+    if(stack[i - 1].return_address == address) {
+      stack.resize(i - 1);
+      break;
+    }
+  }
+
+  drop_returned_frames(sp);
+}
+
+void pc_sampler::sample(uint32_t pc, uint32_t sp)
+{
+  drop_returned_frames(sp);
+
+  std::vector<uint32_t> addresses;
+  addresses.reserve(stack.size() + 1);
+  for(auto const &caller : stack) {
+    addresses.push_back(caller.return_address);
+  }
+  addresses.push_back(pc);
+
+  ++stacks[addresses];
+  ++sample_count;
+}
+
+static std::string function_name(program_image const &program, uint32_t address)
+{
+  auto const *const symbol = program.find_symbol(address);
+  if(symbol != nullptr) {
+    return symbol->name;
+  }
+
+  char text[16];
+  snprintf(text, sizeof(text), "0x%08X", address);
+
+  return text;
+}
+
+void pc_sampler::write_folded(FILE *out, program_image const &program) const
+{
+  // Different addresses within the same functions fold into one line
+  std::map<std::string, uint64_t> folded;
+  for(auto const &entry : stacks) {
+    auto const &addresses = entry.first;
+
+    std::string line;
+    for(size_t i = 0; i < addresses.size(); ++i) {
+      // Return addresses follow the call, which is in the calling function
+      auto const last = i + 1 == addresses.size();
+      line += function_name(program, last ? addresses[i] : addresses[i] - 0x2);
+      line += last ? "" : ";";
+    }
+
+    folded[line] += entry.second;
+  }
+
+  for(auto const &entry : folded) {
+    fprintf(out, "%s %llu\n", entry.first.c_str(), static_cast<unsigned long long>(entry.second));
+  }
+}
+
+void take_sample()
+{
+  auto *const bound = current_machine;
+  if(bound->sampler == nullptr) {
+    return;
+  }
+
+  // The PC is the executed instruction + 4, or the target of the branch it took
+  auto const pc = cpu_get_pc();
+  auto const next = bound->branch_was_taken ? pc & ~0x1u : (pc - 0x2) & ~0x1u;
+  bound->sampler->sample(next, cpu_get_sp());
+
+  schedule_event(EVENT_SAMPLE, bound->cycle_count + bound->sampler->period());
+}
+
+void start_sampling(machine *target, pc_sampler *sampler)
+{
+  machine_binding binding(target);
+
+  target->sampler = sampler;
+  schedule_event(EVENT_SAMPLE, target->cycle_count + sampler->period());
+}
+
+void stop_sampling(machine *target)
+{
+  machine_binding binding(target);
+
+  target->sampler = nullptr;
+  schedule_event(EVENT_SAMPLE, EVENT_NEVER);
+}
+}
@@ -0,0 +1,12 @@
+#ifndef THUMBULATOR_SAMPLING_HPP
+#define THUMBULATOR_SAMPLING_HPP
+
+namespace thumbulator {
+
+/**
+ * Record a sample of the machine bound to the calling thread, and schedule the next one.
+ */
+void take_sample();
+}
+
+#endif //THUMBULATOR_SAMPLING_HPP
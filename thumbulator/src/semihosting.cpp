@@ -0,0 +1,326 @@
+#include "thumbulator/semihosting.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/exit.hpp"
+#include "thumbulator/machine.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+namespace thumbulator {
+
+#define SEMIHOSTING_ERROR 0xFFFFFFFF
+
+// Handles of files come after those of the console
+#define SEMIHOSTING_FIRST_FILE 2
+
+// The modes of SYS_OPEN, by their number
+static char const *const open_modes[] = {
+    "r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b"};
+
+// The memory holding a range of addresses, the simulation cannot go on without one
+static memory_region &memory_of(uint32_t address, uint32_t bytes, fault_kind fault)
+{
+  for(auto *region : {&current_machine->ram, &current_machine->flash}) {
+    if(region->contains(address) && bytes <= region->size_bytes() - (address - region->start())) {
+      return *region;
+    }
+  }
+
+  terminate_simulation(fault, address);
+}
+
+static uint8_t const *bytes_at(uint32_t address, uint32_t bytes)
+{
+  static uint8_t const nothing = 0;
+  if(bytes == 0) {
+    return &nothing;
+  }
+
+  auto &region = memory_of(address, bytes, FAULT_LOAD_OUT_OF_RANGE);
+
+  return reinterpret_cast<uint8_t const *>(region.data()) + (address - region.start());
+}
+
+static uint8_t *writable_bytes_at(uint32_t address, uint32_t bytes)
+{
+  static uint8_t nothing = 0;
+  if(bytes == 0) {
+    return &nothing;
+  }
+
+  return memory_of(address, bytes, FAULT_STORE_OUT_OF_RANGE).writable_bytes(address, bytes);
+}
+
+// Bytes written into RAM leave their words dirty, like stores do
+static void mark_dirty(uint32_t address, uint32_t bytes)
+{
+  auto &ram = current_machine->ram;
+  if(bytes == 0 || !ram.contains(address)) {
+    return;
+  }
+
+  for(uint32_t offset = 0; offset < bytes + (address & 0x3); offset += 4) {
+    ram.mark_dirty((address & ~0x3u) + offset);
+  }
+}
+
+static uint32_t word_at(uint32_t address)
+{
+  uint32_t value;
+  std::memcpy(&value, bytes_at(address, 4), 4);
+
+  return value;
+}
+
+static void set_word_at(uint32_t address, uint32_t value)
+{
+  std::memcpy(writable_bytes_at(address, 4), &value, 4);
+  mark_dirty(address, 4);
+}
+
+semihosting_host::semihosting_host(std::string command_line)
+    : command_line(std::move(command_line))
+    , error(0)
+    , exit_called(false)
+    , reason(0)
+{
+}
+
+semihosting_host::~semihosting_host()
+{
+  for(auto *open_file : files) {
+    if(open_file != nullptr) {
+      std::fclose(open_file);
+    }
+  }
+}
+
+uint32_t semihosting_host::call(uint32_t operation, uint32_t parameter)
+{
+  auto &console = current_machine->uart;
+
+  switch(operation) {
+  case SYS_OPEN:
+    return open(word_at(parameter), word_at(parameter + 4), word_at(parameter + 8));
+  case SYS_CLOSE:
+    return close(word_at(parameter));
+  case SYS_WRITEC:
+    console.put(static_cast<char>(*bytes_at(parameter, 1)));
+    return 0;
+  case SYS_WRITE0: {
+    auto &region = memory_of(parameter, 1, FAULT_LOAD_OUT_OF_RANGE);
+    auto const *text = reinterpret_cast<char const *>(bytes_at(parameter, 1));
+    auto const *end = static_cast<char const *>(
+        std::memchr(text, 0, region.size_bytes() - (parameter - region.start())));
+    if(end == nullptr) {
+      terminate_simulation(FAULT_LOAD_OUT_OF_RANGE, region.start() + region.size_bytes());
+    }
+
+    console.write(text, static_cast<size_t>(end - text));
+    return 0;
+  }
+  case SYS_WRITE:
+    return write(word_at(parameter), word_at(parameter + 4), word_at(parameter + 8));
+  case SYS_READ:
+    return read(word_at(parameter), word_at(parameter + 4), word_at(parameter + 8));
+  case SYS_READC:
+    return console.get();
+  case SYS_ISERROR:
+    return static_cast<int32_t>(word_at(parameter)) < 0 ? 1 : 0;
+  case SYS_ISTTY: {
+    auto const handle = word_at(parameter);
+    if(handle < SEMIHOSTING_FIRST_FILE) {
+      return 1;
+    }
+
+    return file(handle) != nullptr ? 0 : SEMIHOSTING_ERROR;
+  }
+  case SYS_SEEK:
+    return seek(word_at(parameter), word_at(parameter + 4));
+  case SYS_FLEN:
+    return length(word_at(parameter));
+  case SYS_CLOCK:
+    // Centiseconds of simulated time, so that runs are reproducible
+    return static_cast<uint32_t>(current_machine->cycle_count / (CPU_FREQ / 100));
+  case SYS_TIME:
+    return static_cast<uint32_t>(std::time(nullptr));
+  case SYS_ERRNO:
+    return static_cast<uint32_t>(error);
+  case SYS_GET_CMDLINE:
+    return get_command_line(parameter);
+  case SYS_EXIT:
+    exit_called = true;
+    reason = parameter;
+    current_machine->exit_instruction_encountered = true;
+    return 0;
+  default:
+    error = ENOSYS;
+    return SEMIHOSTING_ERROR;
+  }
+}
+
+// The file open under a handle, nullptr if there is none
+FILE *semihosting_host::file(uint32_t handle) const
+{
+  if(handle >= SEMIHOSTING_FIRST_FILE && handle - SEMIHOSTING_FIRST_FILE < files.size()) {
+    return files[handle - SEMIHOSTING_FIRST_FILE];
+  }
+
+  return nullptr;
+}
+
+uint32_t semihosting_host::open(uint32_t name, uint32_t mode, uint32_t length)
+{
+  if(mode >= sizeof(open_modes) / sizeof(open_modes[0])) {
+    error = EINVAL;
+    return SEMIHOSTING_ERROR;
+  }
+
+  std::string const path(reinterpret_cast<char const *>(bytes_at(name, length)), length);
+  if(path == ":tt") {
+    return mode < 4 ? SEMIHOSTING_CONSOLE_INPUT : SEMIHOSTING_CONSOLE_OUTPUT;
+  }
+
+  auto *const opened = std::fopen(path.c_str(), open_modes[mode]);
+  if(opened == nullptr) {
+    error = errno;
+    return SEMIHOSTING_ERROR;
+  }
+
+  // Reuse the handles of closed files
+  auto const slot = std::find(files.begin(), files.end(), nullptr);
+  if(slot != files.end()) {
+    *slot = opened;
+    return static_cast<uint32_t>(slot - files.begin()) + SEMIHOSTING_FIRST_FILE;
+  }
+
+  files.push_back(opened);
+  return static_cast<uint32_t>(files.size() - 1) + SEMIHOSTING_FIRST_FILE;
+}
+
+uint32_t semihosting_host::close(uint32_t handle)
+{
+  if(handle < SEMIHOSTING_FIRST_FILE) {
+    return 0;
+  }
+
+  auto *const open_file = file(handle);
+  if(open_file == nullptr) {
+    error = EBADF;
+    return SEMIHOSTING_ERROR;
+  }
+
+  files[handle - SEMIHOSTING_FIRST_FILE] = nullptr;
+  if(std::fclose(open_file) != 0) {
+    error = errno;
+    return SEMIHOSTING_ERROR;
+  }
+
+  return 0;
+}
+
+// The result is the number of bytes that were not written
+uint32_t semihosting_host::write(uint32_t handle, uint32_t data, uint32_t bytes)
+{
+  auto const *const source = bytes_at(data, bytes);
+  if(handle == SEMIHOSTING_CONSOLE_OUTPUT) {
+    current_machine->uart.write(reinterpret_cast<char const *>(source), bytes);
+    return 0;
+  }
+
+  auto *const open_file = file(handle);
+  if(open_file == nullptr) {
+    error = EBADF;
+    return bytes;
+  }
+
+  auto const written = std::fwrite(source, 1, bytes, open_file);
+  if(written != bytes) {
+    error = errno;
+  }
+
+  return bytes - static_cast<uint32_t>(written);
+}
+
+// The result is the number of bytes that were not read
+uint32_t semihosting_host::read(uint32_t handle, uint32_t data, uint32_t bytes)
+{
+  auto *const open_file = file(handle);
+  if(handle != SEMIHOSTING_CONSOLE_INPUT && open_file == nullptr) {
+    error = EBADF;
+    return bytes;
+  }
+
+  auto *const target = writable_bytes_at(data, bytes);
+  size_t received = 0;
+  if(open_file == nullptr) {
+    received = current_machine->uart.read(reinterpret_cast<char *>(target), bytes);
+  } else {
+    received = std::fread(target, 1, bytes, open_file);
+    if(received != bytes && std::ferror(open_file) != 0) {
+      error = errno;
+    }
+  }
+  mark_dirty(data, static_cast<uint32_t>(received));
+
+  return bytes - static_cast<uint32_t>(received);
+}
+
+uint32_t semihosting_host::seek(uint32_t handle, uint32_t position)
+{
+  auto *const open_file = file(handle);
+  if(open_file == nullptr) {
+    error = EBADF;
+    return SEMIHOSTING_ERROR;
+  }
+
+  if(std::fseek(open_file, static_cast<long>(position), SEEK_SET) != 0) {
+    error = errno;
+    return SEMIHOSTING_ERROR;
+  }
+
+  return 0;
+}
+
+uint32_t semihosting_host::length(uint32_t handle)
+{
+  auto *const open_file = file(handle);
+  if(open_file == nullptr) {
+    error = EBADF;
+    return SEMIHOSTING_ERROR;
+  }
+
+  auto const position = std::ftell(open_file);
+  if(position < 0 || std::fseek(open_file, 0, SEEK_END) != 0) {
+    error = errno;
+    return SEMIHOSTING_ERROR;
+  }
+
+  auto const end = std::ftell(open_file);
+  std::fseek(open_file, position, SEEK_SET);
+
+  return static_cast<uint32_t>(end);
+}
+
+// Copy the command line into the buffer of the parameter block, setting its length
+uint32_t semihosting_host::get_command_line(uint32_t parameter)
+{
+  auto const buffer = word_at(parameter);
+  auto const capacity = word_at(parameter + 4);
+  if(command_line.size() >= capacity) {
+    error = EINVAL;
+    return SEMIHOSTING_ERROR;
+  }
+
+  auto const bytes = static_cast<uint32_t>(command_line.size() + 1);
+  std::memcpy(writable_bytes_at(buffer, bytes), command_line.c_str(), bytes);
+  mark_dirty(buffer, bytes);
+  set_word_at(parameter + 4, bytes - 1);
+
+  return 0;
+}
+}
@@ -0,0 +1,48 @@
+#include "thumbulator/snapshot.hpp"
+
+#include "thumbulator/machine.hpp"
+
+namespace thumbulator {
+
+void take_snapshot()
+{
+  auto &snapshot = current_machine->snapshot;
+  snapshot.taken = true;
+  snapshot.cpu = current_machine->cpu;
+  snapshot.systick = current_machine->systick;
+  snapshot.cycle_count = current_machine->cycle_count;
+  snapshot.events = current_machine->events;
+  snapshot.exit_instruction_encountered = current_machine->exit_instruction_encountered;
+
+  current_machine->ram.save_pages();
+  current_machine->flash.save_pages();
+}
+
+bool restore_snapshot()
+{
+  auto const &snapshot = current_machine->snapshot;
+  if(!snapshot.taken) {
+    return false;
+  }
+
+  current_machine->cpu = snapshot.cpu;
+  current_machine->systick = snapshot.systick;
+  current_machine->cycle_count = snapshot.cycle_count;
+  current_machine->events = snapshot.events;
+  current_machine->exit_instruction_encountered = snapshot.exit_instruction_encountered;
+  current_machine->branch_was_taken = false;
+
+  // Code cached from the restored pages is dropped through the code hooks of the memories
+  current_machine->ram.restore_pages();
+  current_machine->flash.restore_pages();
+
+  return true;
+}
+
+void drop_snapshot()
+{
+  current_machine->snapshot.taken = false;
+  current_machine->ram.discard_saved_pages();
+  current_machine->flash.discard_saved_pages();
+}
+}
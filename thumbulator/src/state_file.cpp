@@ -0,0 +1,116 @@
+#include "thumbulator/state_file.hpp"
+
+#include "thumbulator/machine.hpp"
+
+#include "events.hpp"
+
+namespace thumbulator {
+
+/**
+ * The part of a state file that is not in the memories.
+ */
+struct state_registers {
+  cpu_state cpu;
+
+  system_tick systick;
+
+  uint64_t cycle_count;
+
+  /**
+   * The deadline of EVENT_SYSTICK, the other events belong to whoever scheduled them.
+   */
+  uint64_t systick_deadline;
+
+  snapshot_registers snapshot;
+
+  bool exit_instruction_encountered;
+};
+
+struct state_file_header {
+  char magic[8];
+  uint32_t version;
+
+  /**
+   * The size of state_registers, which tells apart builds that lay the registers out otherwise.
+   */
+  uint32_t registers_bytes;
+};
+
+void save_state(FILE *out)
+{
+  state_file_header header{};
+  std::memcpy(header.magic, STATE_FILE_MAGIC, sizeof(header.magic));
+  header.version = STATE_FILE_VERSION;
+  header.registers_bytes = sizeof(state_registers);
+  write_state_value(out, header);
+
+  state_registers registers{};
+  registers.cpu = current_machine->cpu;
+  registers.systick = current_machine->systick;
+  registers.cycle_count = current_machine->cycle_count;
+  registers.systick_deadline = current_machine->events.deadlines[EVENT_SYSTICK];
+  registers.snapshot = current_machine->snapshot;
+  registers.exit_instruction_encountered = current_machine->exit_instruction_encountered;
+  write_state_value(out, registers);
+
+  current_machine->ram.write_state(out);
+  current_machine->flash.write_state(out);
+}
+
+// The registers written by write_cpu_state, the general-purpose ones and 12 others
+static_assert(sizeof(cpu_state) == 28 * sizeof(uint32_t), "A register of the CPU is not written");
+
+void write_cpu_state(FILE *out, cpu_state const &cpu)
+{
+  for(auto const value : cpu.gpr) {
+    write_state_value(out, value);
+  }
+
+  uint32_t const registers[] = {cpu.flag_n, cpu.flag_z, cpu.flag_c, cpu.flag_v, cpu.ipsr, cpu.espr,
+      cpu.primask, cpu.control, cpu.sp_main, cpu.sp_process, cpu.mode, cpu.exceptmask};
+  for(auto const value : registers) {
+    write_state_value(out, value);
+  }
+}
+
+cpu_state read_cpu_state(FILE *in)
+{
+  cpu_state cpu{};
+  for(auto &value : cpu.gpr) {
+    value = read_state_value<uint32_t>(in);
+  }
+
+  uint32_t *const registers[] = {&cpu.flag_n, &cpu.flag_z, &cpu.flag_c, &cpu.flag_v, &cpu.ipsr,
+      &cpu.espr, &cpu.primask, &cpu.control, &cpu.sp_main, &cpu.sp_process, &cpu.mode,
+      &cpu.exceptmask};
+  for(auto *value : registers) {
+    *value = read_state_value<uint32_t>(in);
+  }
+
+  return cpu;
+}
+
+void load_state(FILE *in)
+{
+  auto const header = read_state_value<state_file_header>(in);
+  if(std::memcmp(header.magic, STATE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != STATE_FILE_VERSION ||
+      header.registers_bytes != sizeof(state_registers)) {
+    throw std::runtime_error("Not a state file of this simulator.");
+  }
+
+  auto const registers = read_state_value<state_registers>(in);
+
+  // Code cached from the memories is dropped through their code hooks
+  current_machine->ram.read_state(in);
+  current_machine->flash.read_state(in);
+
+  current_machine->cpu = registers.cpu;
+  current_machine->systick = registers.systick;
+  current_machine->cycle_count = registers.cycle_count;
+  current_machine->snapshot = registers.snapshot;
+  current_machine->exit_instruction_encountered = registers.exit_instruction_encountered;
+  current_machine->branch_was_taken = false;
+  schedule_event(EVENT_SYSTICK, registers.systick_deadline);
+}
+}
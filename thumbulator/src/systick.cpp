@@ -0,0 +1,118 @@
+#include "systick.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/exit.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/peripheral.hpp"
+
+#include "events.hpp"
+
+#include <cstdio>
+
+namespace thumbulator {
+
+#define SYSTICK_ENABLE 0x1
+#define SYSTICK_COUNTFLAG 0x00010000
+
+// The value of the timer at the current cycle
+static uint32_t current_value()
+{
+  auto const &systick = current_machine->systick;
+  if((systick.control & SYSTICK_ENABLE) == 0) {
+    return systick.value;
+  }
+
+  return systick.value - static_cast<uint32_t>(current_machine->cycle_count - systick.value_cycle);
+}
+
+// Count down from a value starting at the current cycle, and schedule reaching zero
+static void count_from(uint32_t value)
+{
+  auto &systick = current_machine->systick;
+  systick.value = value;
+  systick.value_cycle = current_machine->cycle_count;
+
+  if((systick.control & SYSTICK_ENABLE) != 0) {
+    schedule_event(EVENT_SYSTICK, systick.value_cycle + value);
+  } else {
+    schedule_event(EVENT_SYSTICK, EVENT_NEVER);
+  }
+}
+
+void systick_reset()
+{
+  auto &systick = current_machine->systick;
+  systick.control = 0x4;
+  systick.reload = 0x0;
+  systick.calib = CPU_FREQ / 100 | 0x80000000;
+  count_from(0x0);
+}
+
+uint32_t load_systick(void *, uint32_t address)
+{
+  auto &systick = current_machine->systick;
+
+  if(address == SYSTICK_ADDRESS) {
+    auto const control = systick.control;
+    auto const value = current_value();
+    systick.control &= SYSTICK_COUNTFLAG;
+    count_from(value);
+
+    return control;
+  }
+
+  return peek_systick(nullptr, address);
+}
+
+uint32_t peek_systick(void *, uint32_t address)
+{
+  auto const &systick = current_machine->systick;
+
+  switch((address >> 2) & 0x3) {
+  case 0:
+    return systick.control;
+  case 1:
+    return systick.reload;
+  case 2:
+    return current_value();
+  default:
+    return systick.calib;
+  }
+}
+
+void store_systick(void *, uint32_t address, uint32_t value)
+{
+  auto &systick = current_machine->systick;
+
+  if(address == SYSTICK_ADDRESS) {
+    auto const current = current_value();
+    systick.control = (value & 0x1FFFD) | 0x4; // No external tick source, no interrupt
+    count_from(current);
+
+    if(value & 0x2) {
+      fprintf(stderr, "Warning: SYSTICK interrupts not implemented, ignoring\n");
+    }
+  } else if(address == SYSTICK_ADDRESS + 0x4) {
+    systick.reload = value & 0xFFFFFF;
+  } else if(address == SYSTICK_ADDRESS + 0x8) {
+    // Writes clear the current value
+    count_from(0);
+  } else if(address == SYSTICK_ADDRESS + 0xC) {
+    terminate_simulation(FAULT_STORE_OUT_OF_RANGE, address);
+  }
+}
+
+void systick_wrap()
+{
+  auto &systick = current_machine->systick;
+
+  // Ignore resets due to writes
+  if(systick.value > 0) {
+    systick.control |= SYSTICK_COUNTFLAG;
+  }
+
+  // The cycles of the last instruction past zero count from the reload value
+  auto const elapsed = static_cast<uint32_t>(current_machine->cycle_count - systick.value_cycle);
+  count_from(systick.reload + systick.value - elapsed);
+}
+}
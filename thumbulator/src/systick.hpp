@@ -0,0 +1,43 @@
+#ifndef THUMBULATOR_SYSTICK_HPP
+#define THUMBULATOR_SYSTICK_HPP
+
+#include <cstdint>
+
+namespace thumbulator {
+
+/**
+ * Reset the SYSTICK unit, disabling it.
+ */
+void systick_reset();
+
+/**
+ * Read a register of the SYSTICK unit, the load handler of its peripheral_device.
+ *
+ * @param address The address of the register, SYSTICK_ADDRESS to SYSTICK_ADDRESS + 0xC.
+ */
+uint32_t load_systick(void *, uint32_t address);
+
+/**
+ * Read a register of the SYSTICK unit without clearing COUNTFLAG, the peek handler of its
+ * peripheral_device.
+ *
+ * @param address The address of the register, SYSTICK_ADDRESS to SYSTICK_ADDRESS + 0xC.
+ */
+uint32_t peek_systick(void *, uint32_t address);
+
+/**
+ * Write a register of the SYSTICK unit, the store handler of its peripheral_device.
+ *
+ * The calibration register is read-only, stores to it are fatal.
+ *
+ * @param address The address of the register, SYSTICK_ADDRESS to SYSTICK_ADDRESS + 0x8.
+ */
+void store_systick(void *, uint32_t address, uint32_t value);
+
+/**
+ * Handle the timer reaching zero, at the end of the instruction that made it reach zero.
+ */
+void systick_wrap();
+}
+
+#endif //THUMBULATOR_SYSTICK_HPP
@@ -0,0 +1,94 @@
+#include "thumbulator/tracer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace thumbulator {
+
+// How long the writer sleeps when the ring buffer is empty
+#define TRACE_WRITER_IDLE std::chrono::microseconds(200)
+
+static size_t power_of_two_at_least(size_t value)
+{
+  size_t power = 1;
+  while(power < value) {
+    power <<= 1;
+  }
+
+  return power;
+}
+
+instruction_tracer::instruction_tracer(char const *path, size_t capacity)
+    : pending{}
+    , file(std::fopen(path, "wb"))
+    , capacity(power_of_two_at_least(capacity))
+    , records(new trace_record[this->capacity])
+    , head(0)
+    , known_tail(0)
+    , tail(0)
+    , stopping(false)
+{
+  if(file == nullptr) {
+    throw std::runtime_error("Could not create trace file.");
+  }
+
+  trace_file_header header{};
+  std::memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_FILE_VERSION;
+  header.record_bytes = sizeof(trace_record);
+  std::fwrite(&header, sizeof(header), 1, file);
+
+  writer = std::thread(&instruction_tracer::write_records, this);
+}
+
+instruction_tracer::~instruction_tracer()
+{
+  stopping.store(true, std::memory_order_release);
+  writer.join();
+
+  std::fclose(file);
+}
+
+void instruction_tracer::wait_for_room(uint64_t position)
+{
+  known_tail = tail.load(std::memory_order_acquire);
+  while(position - known_tail == capacity) {
+    std::this_thread::yield();
+    known_tail = tail.load(std::memory_order_acquire);
+  }
+}
+
+void instruction_tracer::write_records()
+{
+  auto written = tail.load(std::memory_order_relaxed);
+
+  while(true) {
+    // Records added before stopping was set are seen by the load of head after it
+    auto const stop = stopping.load(std::memory_order_acquire);
+    auto const added = head.load(std::memory_order_acquire);
+
+    if(written == added) {
+      if(stop) {
+        break;
+      }
+
+      std::this_thread::sleep_for(TRACE_WRITER_IDLE);
+      continue;
+    }
+
+    // The records may wrap around the end of the buffer
+    while(written != added) {
+      auto const first = written & (capacity - 1);
+      auto const count = std::min<uint64_t>(added - written, capacity - first);
+      std::fwrite(&records[first], sizeof(trace_record), count, file);
+
+      written += count;
+      tail.store(written, std::memory_order_release);
+    }
+  }
+
+  std::fflush(file);
+}
+}
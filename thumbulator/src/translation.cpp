@@ -0,0 +1,340 @@
+#include "thumbulator/translation.hpp"
+
+#include "thumbulator/cpu.hpp"
+#include "thumbulator/decode_cache.hpp"
+#include "thumbulator/machine.hpp"
+#include "thumbulator/memory.hpp"
+
+#include "cpu_flags.hpp"
+#include "events.hpp"
+#include "exmemwb.hpp"
+#include "machine_caches.hpp"
+#include "profile_counters.hpp"
+#include "run_control.hpp"
+
+#include <algorithm>
+
+namespace thumbulator {
+
+bool ends_block(decoded_instruction const &instruction)
+{
+  auto const execute = instruction.execute;
+
+  if(execute == b || execute == b_c || execute == bl || execute == bx || execute == blx) {
+    return true;
+  }
+
+  // Breakpoints may exit through semihosting
+  if(execute == exmemwb_exit_simulation || execute == exmemwb_error || execute == breakpoint) {
+    return true;
+  }
+
+  if(execute == current_machine->memory_instructions->pop) {
+    return (instruction.decoded.register_list & (1 << GPR_PC)) != 0;
+  }
+
+  if(execute == add_r || execute == mov_r) {
+    return instruction.decoded.Rd == GPR_PC;
+  }
+
+  return false;
+}
+
+// Advance to the next PC, like a single step does
+void finish_block()
+{
+  if(!current_machine->branch_was_taken) {
+    cpu_set_pc(cpu_get_pc() + 0x2);
+  } else {
+    cpu_set_pc(cpu_get_pc() + 0x4);
+  }
+}
+
+block_result step_instruction()
+{
+  auto const *instruction = fetch_decoded(cpu_get_pc() - 0x4);
+  auto const cycles = exmemwb(instruction);
+  finish_block();
+
+  return {1, cycles};
+}
+
+// Execute instructions one at a time, recording them into a new block
+block_result record_block(
+    memory_region const &region, uint32_t address, std::unique_ptr<translated_block> *slot)
+{
+  auto &translations = *current_machine->translations;
+  auto const generation = translations.generation;
+
+  auto const start = address & ~0x1;
+  std::unique_ptr<translated_block> block(new translated_block{
+      start, start, {}, {}, {nullptr, nullptr}, {0, 0}});
+  block_result result{0, 0};
+
+  // Invalidations look for stores into the block while it is recorded, until recording ends
+  struct recording_scope {
+    translation_cache &translations;
+    ~recording_scope()
+    {
+      translations.recording = nullptr;
+    }
+  } recording{translations};
+  translations.recording = block.get();
+
+  while(true) {
+    auto const *instruction = fetch_decoded(cpu_get_pc() - 0x4);
+    block->instructions.push_back(*instruction);
+    // BL is the only 32-bit instruction
+    block->end = ((instruction->pc - 0x4) & ~0x1) + (instruction->execute == bl ? 0x4 : 0x2);
+
+    result.instructions++;
+    result.cycles += exmemwb(instruction);
+
+    if(ends_block(*instruction) || block->instructions.size() == MAX_BLOCK_INSTRUCTIONS) {
+      break;
+    }
+
+    // A block cut short by a stop would end in the middle of a basic block, so it is not kept
+    if(current_machine->run.pending_stop != STOP_NONE) {
+      finish_block();
+
+      return result;
+    }
+
+    if(!region.contains(cpu_get_pc() + 0x2 - 0x4)) {
+      break;
+    }
+
+    cpu_set_pc(cpu_get_pc() + 0x2);
+  }
+
+  finish_block();
+
+  // Only keep the block if the code did not change while it was recorded
+  if(generation == translations.generation) {
+    block->steps = fuse_instructions(block->instructions);
+    *slot = std::move(block);
+  }
+
+  return result;
+}
+
+block_result run_block(translated_block &block)
+{
+  block_result result{static_cast<uint32_t>(block.instructions.size()), 0};
+
+  // Blocks that cannot reach an event do not look for one after every instruction
+  auto const most_cycles = uint64_t{MAX_INSTRUCTION_CYCLES} * block.instructions.size();
+  auto const uneventful = before_next_event(most_cycles);
+
+  // Stores into the block retire it, and it stops before running instructions that changed
+  auto &translations = *current_machine->translations;
+  auto const generation = translations.generation;
+
+  auto *const bound = current_machine;
+#if !defined(THUMBULATOR_PROFILE)
+  if(uneventful) {
+    // The PC and the cycle count are only brought up to date for the steps that use them
+    auto const start_cycles = bound->cycle_count;
+    auto pc_current = false;
+    for(auto const &step : block.steps) {
+      if(step.isolated) {
+        result.cycles += step.execute(&step.decoded);
+        pc_current = false;
+        continue;
+      }
+
+      cpu_set_pc(step.pc);
+      bound->cycle_count = start_cycles + result.cycles;
+      result.cycles += step.execute(&step.decoded);
+      pc_current = true;
+
+      // Only the first instruction of a fused pair can stop the run, which skips the second one,
+      // and fused pairs do not store
+      if(bound->run.pending_stop != STOP_NONE || translations.generation != generation) {
+        result.instructions = step.executed_to_stop;
+        break;
+      }
+    }
+
+    bound->cycle_count = start_cycles + result.cycles;
+    if(!pc_current) {
+      cpu_set_pc(block.instructions.back().pc);
+    }
+
+    finish_block();
+
+    return result;
+  }
+#endif
+
+  for(auto const &instruction : block.instructions) {
+    cpu_set_pc(instruction.pc);
+
+    auto const ticks = instruction.execute(&instruction.decoded);
+    count_instruction(bound, instruction.instruction, ticks);
+    // Handlers that read SYSTICK need the current cycle count
+    bound->cycle_count += ticks;
+    if(!uneventful && bound->cycle_count >= bound->events.next) {
+      run_due_events();
+    }
+    result.cycles += ticks;
+
+    if(bound->run.pending_stop != STOP_NONE || translations.generation != generation) {
+      result.instructions = static_cast<uint32_t>(&instruction - block.instructions.data()) + 1;
+      break;
+    }
+  }
+
+  finish_block();
+
+  return result;
+}
+
+// The translated block at the current PC, nullptr if there is none
+translated_block *find_block()
+{
+  uint32_t offset;
+  if(find_cached_code(cpu_get_pc() - 0x4, &offset) == nullptr) {
+    return nullptr;
+  }
+
+  auto const &page = current_machine->translations->pages[offset / TRANSLATION_PAGE_BYTES];
+  if(page == nullptr) {
+    return nullptr;
+  }
+
+  return page[(offset % TRANSLATION_PAGE_BYTES) >> 1].get();
+}
+
+// Run a block, then the translated blocks following it, until one has to be recorded first
+block_result run_chain(translated_block *block, uint32_t max_instructions)
+{
+  auto *const bound = current_machine;
+  auto &translations = *bound->translations;
+  auto result = run_block(*block);
+
+  // Blocks retired by the code are freed by the next execute_block, so they end the chain
+  auto const generation = translations.generation;
+  while(bound->run.pending_stop == STOP_NONE && !bound->exit_instruction_encountered &&
+      translations.generation == generation) {
+    auto const taken = bound->branch_was_taken ? 1 : 0;
+    auto *next = block->successors[taken];
+    if(next == nullptr || block->successor_generations[taken] != generation ||
+        next->start != ((cpu_get_pc() - 0x4) & ~0x1)) {
+      next = find_block();
+      if(next == nullptr) {
+        break;
+      }
+
+      block->successors[taken] = next;
+      block->successor_generations[taken] = generation;
+    }
+
+    if(result.instructions + next->instructions.size() > max_instructions) {
+      break;
+    }
+
+    bound->branch_was_taken = false;
+    auto const executed = run_block(*next);
+    result.instructions += executed.instructions;
+    result.cycles += executed.cycles;
+    block = next;
+  }
+
+  return result;
+}
+
+block_result execute_block()
+{
+  return execute_block(MAX_CHAINED_INSTRUCTIONS);
+}
+
+block_result execute_block(uint32_t max_instructions)
+{
+  auto &translations = *current_machine->translations;
+  translations.retired.clear();
+  current_machine->branch_was_taken = false;
+
+  // Only single steps record into the trace
+  auto const address = cpu_get_pc() - 0x4;
+  uint32_t offset;
+  auto const *const region = find_cached_code(address, &offset);
+  if(region == nullptr || current_machine->tracer != nullptr) {
+    return step_instruction();
+  }
+
+  auto &page = translations.pages[offset / TRANSLATION_PAGE_BYTES];
+  if(page == nullptr) {
+    page.reset(new std::unique_ptr<translated_block>[TRANSLATION_PAGE_ENTRIES]());
+  }
+
+  auto &slot = page[(offset % TRANSLATION_PAGE_BYTES) >> 1];
+  if(slot == nullptr) {
+    // The recorded block could be longer than allowed
+    if(max_instructions < MAX_BLOCK_INSTRUCTIONS) {
+      return step_instruction();
+    }
+
+    return record_block(*region, address, &slot);
+  }
+
+  if(slot->instructions.size() > max_instructions) {
+    return step_instruction();
+  }
+
+  return run_chain(slot.get(), max_instructions);
+}
+
+void invalidate_translations(uint32_t address, uint32_t bytes)
+{
+  uint32_t offset;
+  auto const *const region = find_cached_code(address, &offset);
+  if(region == nullptr) {
+    return;
+  }
+
+  auto &translations = *current_machine->translations;
+  auto const *const recording = translations.recording;
+  if(recording != nullptr && recording->start < address + bytes && recording->end > address) {
+    ++translations.generation;
+  }
+
+  // Offsets from the start of the memory, and where the memory starts in the cache
+  auto const first = (address - region->start()) & ~0x3;
+  auto const end = std::min(address - region->start() + bytes, region->size_bytes());
+  auto const base = offset - (address - region->start());
+
+  // A block starts at most MAX_BLOCK_INSTRUCTIONS halfwords before the first word it overlaps
+  auto const lowest = first >= 2 * MAX_BLOCK_INSTRUCTIONS ? first - 2 * MAX_BLOCK_INSTRUCTIONS : 0;
+  auto retired_any = false;
+  for(auto byte = lowest; byte < end; byte += 2) {
+    auto &page = translations.pages[(base + byte) / TRANSLATION_PAGE_BYTES];
+    if(page == nullptr) {
+      continue;
+    }
+
+    auto &slot = page[((base + byte) % TRANSLATION_PAGE_BYTES) >> 1];
+    if(slot != nullptr && slot->end > region->start() + first) {
+      translations.retired.push_back(std::move(slot));
+      retired_any = true;
+    }
+  }
+
+  // Recordings of other code stay valid
+  if(retired_any) {
+    ++translations.generation;
+  }
+}
+
+void flush_translations()
+{
+  auto &translations = *current_machine->translations;
+  for(auto &page : translations.pages) {
+    page.reset();
+  }
+
+  // The slot of a block being recorded is gone
+  ++translations.generation;
+}
+}
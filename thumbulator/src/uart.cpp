@@ -0,0 +1,65 @@
+#include "thumbulator/uart.hpp"
+
+#include <algorithm>
+
+namespace thumbulator {
+
+uart_port::uart_port() : sink(nullptr), input_read(0)
+{
+}
+
+uart_port::~uart_port()
+{
+  flush();
+}
+
+void uart_port::write_to(FILE *out)
+{
+  flush();
+  sink = out;
+  flush();
+}
+
+void uart_port::flush()
+{
+  if(sink != nullptr && !buffer.empty()) {
+    std::fwrite(buffer.data(), 1, buffer.size(), sink);
+    buffer.clear();
+  }
+}
+
+void uart_port::add_input(char const *data, size_t bytes)
+{
+  // Drop what was received already, so that the input does not grow forever
+  input.erase(0, input_read);
+  input_read = 0;
+  input.append(data, bytes);
+}
+
+void uart_port::write(char const *data, size_t bytes)
+{
+  buffer.append(data, bytes);
+  if(sink != nullptr && buffer.size() >= UART_BUFFER_BYTES) {
+    flush();
+  }
+}
+
+size_t uart_port::read(char *data, size_t bytes)
+{
+  auto const received = std::min(bytes, input.size() - input_read);
+  input.copy(data, received, input_read);
+  input_read += received;
+
+  return received;
+}
+
+uint32_t load_uart(void *port, uint32_t)
+{
+  return static_cast<uart_port *>(port)->get();
+}
+
+void store_uart(void *port, uint32_t, uint32_t value)
+{
+  static_cast<uart_port *>(port)->put(static_cast<char>(value & 0xFF));
+}
+}
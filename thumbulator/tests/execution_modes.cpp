@@ -0,0 +1,132 @@
+#include "test_program.hpp"
+
+#include <thumbulator/cpu.hpp>
+#include <thumbulator/decode_cache.hpp>
+#include <thumbulator/machine.hpp>
+#include <thumbulator/run.hpp>
+#include <thumbulator/translation.hpp>
+
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+enum class execution_mode { step, block, slices, peripheral_stops };
+
+char const *mode_name(execution_mode mode)
+{
+  switch(mode) {
+  case execution_mode::step:
+    return "step";
+  case execution_mode::block:
+    return "block";
+  case execution_mode::slices:
+    return "slices";
+  default:
+    return "peripheral stops";
+  }
+}
+
+template <size_t Halfwords>
+thumbulator_tests::program_outcome run_program(
+    execution_mode mode, uint16_t const (&image)[Halfwords])
+{
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+
+  thumbulator_tests::load_program(&target, image);
+
+  uint64_t instructions = 0;
+  uint64_t cycles = 0;
+  if(mode == execution_mode::step) {
+    while(!target.exit_instruction_encountered) {
+      target.branch_was_taken = false;
+      auto const *instruction = thumbulator::fetch_decoded(thumbulator::cpu_get_pc() - 0x4);
+      cycles += thumbulator::exmemwb(instruction);
+      thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + (target.branch_was_taken ? 0x4 : 0x2));
+      ++instructions;
+    }
+  } else if(mode == execution_mode::slices) {
+    // slices cut by cycles and by instructions in turns, which stop within blocks
+    thumbulator::run_limits limits{};
+    for(uint64_t slice = 0; !target.exit_instruction_encountered; ++slice) {
+      limits.cycles = (slice % 2) == 0 ? 97 : UINT64_MAX;
+      limits.instructions = (slice % 2) == 0 ? UINT64_MAX : 13;
+
+      auto const run = thumbulator::run_until(limits);
+      instructions += run.instructions;
+      cycles += run.cycles;
+    }
+  } else if(mode == execution_mode::peripheral_stops) {
+    // blocks cut short by a stop are not recorded, so the first run records them without stops
+    thumbulator::run_limits limits{};
+    limits.cycles = UINT64_MAX;
+    limits.instructions = 1000;
+    auto const recorded = thumbulator::run_until(limits);
+    instructions += recorded.instructions;
+    cycles += recorded.cycles;
+
+    // then every SysTick access ends a run in the middle of its block
+    limits.instructions = UINT64_MAX;
+    limits.stop_on_peripheral_access = true;
+    while(!target.exit_instruction_encountered) {
+      auto const run = thumbulator::run_until(limits);
+      instructions += run.instructions;
+      cycles += run.cycles;
+    }
+  } else {
+    while(!target.exit_instruction_encountered) {
+      auto const block = thumbulator::execute_block();
+      instructions += block.instructions;
+      cycles += block.cycles;
+    }
+  }
+
+  return thumbulator_tests::capture_outcome(target, instructions, cycles);
+}
+
+/**
+ * Check that a program ends in the same state after the same cycles in every mode.
+ *
+ * @param name The name of the program in reports.
+ * @param instructions Number of instructions the program executes.
+ */
+template <size_t Halfwords>
+bool check_modes(char const *name, uint64_t instructions, uint16_t const (&image)[Halfwords])
+{
+  auto const step = std::string(name) + " step";
+  auto const expected = run_program(execution_mode::step, image);
+  auto passed = thumbulator_tests::check_value(
+      step.c_str(), "instructions", instructions, expected.instructions);
+  passed &= thumbulator_tests::check_value(
+      step.c_str(), "cycles", expected.cycle_count, expected.cycles);
+
+  for(auto const mode :
+      {execution_mode::block, execution_mode::slices, execution_mode::peripheral_stops}) {
+    auto const run = std::string(name) + " " + mode_name(mode);
+    passed &= thumbulator_tests::same_outcome(run.c_str(), expected, run_program(mode, image));
+  }
+
+  return passed;
+}
+}
+
+/**
+ * Runs the test programs one instruction at a time, by translated block, in slices of run_until
+ * and in runs stopped at peripheral accesses, and checks that every mode ends in the same state
+ * after the same cycles.
+ */
+int main()
+{
+  auto passed = check_modes(
+      "test program", TEST_PROGRAM_INSTRUCTIONS, thumbulator_tests::test_program);
+
+  // the second call patches the function, which has to run the new instruction in every mode
+  auto const patched =
+      run_program(execution_mode::step, thumbulator_tests::self_modifying_program);
+  passed &= thumbulator_tests::check_value("self-modifying program step", "r5", 3, patched.gpr[5]);
+  passed &= check_modes("self-modifying program", SELF_MODIFYING_PROGRAM_INSTRUCTIONS,
+      thumbulator_tests::self_modifying_program);
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
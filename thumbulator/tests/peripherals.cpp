@@ -0,0 +1,181 @@
+#include "test_program.hpp"
+
+#include <thumbulator/decode_cache.hpp>
+#include <thumbulator/exit.hpp>
+#include <thumbulator/machine.hpp>
+#include <thumbulator/memory.hpp>
+#include <thumbulator/peripheral.hpp>
+
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+// Two devices in the same page, with a gap between them
+#define FIRST_DEVICE 0xF0000000
+#define SECOND_DEVICE 0xF0000008
+
+/**
+ * A device with a register of its own, which counts the loads and stores that reach it.
+ */
+struct test_device {
+  uint32_t value;
+  uint32_t loads;
+  uint32_t stores;
+};
+
+uint32_t load_test_device(void *context, uint32_t)
+{
+  auto *device = static_cast<test_device *>(context);
+  ++device->loads;
+
+  return device->value;
+}
+
+uint32_t peek_test_device(void *context, uint32_t)
+{
+  return static_cast<test_device *>(context)->value;
+}
+
+void store_test_device(void *context, uint32_t, uint32_t value)
+{
+  auto *device = static_cast<test_device *>(context);
+  ++device->stores;
+  device->value = value;
+}
+
+/**
+ * A raw image of a program that writes the reload register of the SYSTICK unit a word, a byte, and
+ * a halfword at a time, and reads it back into r0, which has to end at 0x00EF34AB.
+ */
+uint16_t const partial_store_program[] = {
+    0x0000, 0x4001, // initial SP: 0x40010000
+    0x0009, 0x0000, // reset vector: 0x8 in Thumb state
+    0x4D04,         // ldr r5, =SYSTICK_ADDRESS
+    0x4B05,         // ldr r3, =0x00123456
+    0x606B,         // str r3, [r5, #4]
+    0x23AB,         // movs r3, #0xAB
+    0x712B,         // strb r3, [r5, #4]
+    0x4B04,         // ldr r3, =0xBEEF
+    0x80EB,         // strh r3, [r5, #6]
+    0x6868,         // ldr r0, [r5, #4]
+    0xDF01,         // exit
+    0x0000,         // padding
+    0xE010, 0xE000, // SYSTICK_ADDRESS
+    0x3456, 0x0012, // 0x00123456
+    0xBEEF, 0x0000  // 0xBEEF
+};
+
+// Whether or not mapping a range to a machine is rejected
+bool map_fails(thumbulator::machine *target, uint32_t start, uint32_t size_bytes)
+{
+  try {
+    thumbulator::map_peripheral(
+        target, start, size_bytes, {load_test_device, nullptr, nullptr, nullptr});
+  } catch(std::invalid_argument const &) {
+    return true;
+  }
+
+  return false;
+}
+
+bool check_mapping_errors()
+{
+  thumbulator::machine target;
+  auto passed = true;
+
+  struct {
+    char const *what;
+    uint32_t start;
+    uint32_t size_bytes;
+  } const invalid[] = {
+      {"an empty range", FIRST_DEVICE, 0},
+      {"a range that wraps around", 0xFFFFFFF0, 0x20},
+      {"a range in RAM", RAM_START + 0x100, 4},
+      {"a range in FLASH", FLASH_START + 0x100, 4},
+      {"a range across the start of RAM", RAM_START - 2, 4},
+      {"a range over the UART", UART_ADDRESS + 2, 4},
+      {"a range over the SYSTICK unit", SYSTICK_ADDRESS - 4, 8},
+  };
+  for(auto const &range : invalid) {
+    passed &= thumbulator_tests::check_value(
+        range.what, "rejected", 1, map_fails(&target, range.start, range.size_bytes));
+  }
+
+  passed &= thumbulator_tests::check_value(
+      "a free range", "rejected", 0, map_fails(&target, FIRST_DEVICE, 4));
+  passed &= thumbulator_tests::check_value(
+      "a range over a new device", "rejected", 1, map_fails(&target, FIRST_DEVICE + 3, 4));
+
+  return passed;
+}
+
+bool check_dispatch()
+{
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+
+  test_device first{0x11111111, 0, 0};
+  test_device second{0x22222222, 0, 0};
+  thumbulator::map_peripheral(
+      &target, FIRST_DEVICE, 4, {load_test_device, peek_test_device, store_test_device, &first});
+  thumbulator::map_peripheral(
+      &target, SECOND_DEVICE, 4, {load_test_device, nullptr, store_test_device, &second});
+
+  uint32_t value = 0;
+  thumbulator::load(SECOND_DEVICE, &value, 0);
+  auto passed = thumbulator_tests::check_value("second device", "load", 0x22222222, value);
+  thumbulator::store(FIRST_DEVICE, 0x33333333);
+  passed &= thumbulator_tests::check_value("first device", "stored", 0x33333333, first.value);
+  passed &= thumbulator_tests::check_value("second device", "stored", 0x22222222, second.value);
+
+  // the false reads of partial stores peek, or read 0 from devices without peek
+  thumbulator::load(FIRST_DEVICE, &value, 1);
+  passed &= thumbulator_tests::check_value("first device", "false read", 0x33333333, value);
+  thumbulator::load(SECOND_DEVICE, &value, 1);
+  passed &= thumbulator_tests::check_value("second device", "false read", 0, value);
+  passed &= thumbulator_tests::check_value("first device", "loads", 0, first.loads);
+  passed &= thumbulator_tests::check_value("second device", "loads", 1, second.loads);
+
+  // the gap between the devices is not mapped, even though their page is
+  auto faulted = false;
+  try {
+    thumbulator::load(FIRST_DEVICE + 4, &value, 0);
+  } catch(thumbulator::simulation_fault const &fault) {
+    faulted = fault.kind == thumbulator::FAULT_LOAD_OUT_OF_RANGE;
+  }
+  passed &= thumbulator_tests::check_value("unmapped address", "faulted", 1, faulted);
+
+  return passed;
+}
+
+bool check_partial_stores()
+{
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+  thumbulator_tests::load_program(&target, partial_store_program);
+
+  while(!target.exit_instruction_encountered) {
+    target.branch_was_taken = false;
+    auto const *instruction = thumbulator::fetch_decoded(thumbulator::cpu_get_pc() - 0x4);
+    thumbulator::exmemwb(instruction);
+    thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + (target.branch_was_taken ? 0x4 : 0x2));
+  }
+
+  return thumbulator_tests::check_value(
+      "partial stores to SYSTICK", "reload", 0x00EF34AB, target.cpu.gpr[0]);
+}
+}
+
+/**
+ * Checks that mapping devices rejects invalid ranges, that accesses reach the device mapped at
+ * their address, and that byte and halfword stores to a device keep the other bytes.
+ */
+int main()
+{
+  auto passed = check_mapping_errors();
+  passed &= check_dispatch();
+  passed &= check_partial_stores();
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,135 @@
+#include "test_program.hpp"
+
+#include <thumbulator/machine.hpp>
+#include <thumbulator/run.hpp>
+#include <thumbulator/semihosting.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace {
+
+// The parameter blocks of the calls, and the buffer they read into and write from
+#define READ_BLOCK (RAM_START + 0x100)
+#define WRITE_BLOCK (RAM_START + 0x10C)
+#define CONSOLE_BUFFER (RAM_START + 0x200)
+
+#define EXIT_REASON 0x20026
+
+/**
+ * A raw image of a program that reads 2 bytes of console input with SYS_READ, writes them back with
+ * SYS_WRITE, reads the UART twice, stores '!' to it, and calls SYS_EXIT before an instruction that
+ * must not run.
+ */
+uint16_t const console_program[] = {
+    0x0000, 0x4001, // initial SP: 0x40010000
+    0x0009, 0x0000, // reset vector: 0x8 in Thumb state
+    0x4908,         // ldr r1, =READ_BLOCK
+    0x2006,         // movs r0, #SYS_READ
+    0xBEAB,         // bkpt #SEMIHOSTING_BKPT
+    0x1C04,         // adds r4, r0, #0
+    0x4907,         // ldr r1, =WRITE_BLOCK
+    0x2005,         // movs r0, #SYS_WRITE
+    0xBEAB,         // bkpt #SEMIHOSTING_BKPT
+    0x1C07,         // adds r7, r0, #0
+    0x4D06,         // ldr r5, =UART_ADDRESS
+    0x682E,         // ldr r6, [r5, #0]
+    0x682A,         // ldr r2, [r5, #0]
+    0x2321,         // movs r3, #'!'
+    0x602B,         // str r3, [r5, #0]
+    0x4905,         // ldr r1, =EXIT_REASON
+    0x2018,         // movs r0, #SYS_EXIT
+    0xBEAB,         // bkpt #SEMIHOSTING_BKPT
+    0x2455,         // movs r4, #0x55
+    0xDF01,         // exit
+    0x0100, 0x4000, // READ_BLOCK
+    0x010C, 0x4000, // WRITE_BLOCK
+    0x0000, 0xE000, // UART_ADDRESS
+    0x0026, 0x0002  // EXIT_REASON
+};
+
+using file_handle = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+// Everything written to a file so far
+std::string contents(FILE *file)
+{
+  std::fflush(file);
+  std::rewind(file);
+
+  std::string text;
+  for(int byte = std::fgetc(file); byte != EOF; byte = std::fgetc(file)) {
+    text.push_back(static_cast<char>(byte));
+  }
+
+  return text;
+}
+
+bool check_text(char const *what, std::string const &expected, std::string const &actual)
+{
+  if(expected != actual) {
+    std::fprintf(stderr, "%s is \"%s\" instead of \"%s\"\n", what, actual.c_str(),
+        expected.c_str());
+  }
+
+  return expected == actual;
+}
+}
+
+/**
+ * Runs a program that uses the console through semihosting and through the UART, and checks what
+ * it received, what it sent, where it exited, and that the UART hands its output to a file.
+ */
+int main()
+{
+  file_handle sink(std::tmpfile(), std::fclose);
+  if(!sink) {
+    std::fprintf(stderr, "Could not create a temporary output file.\n");
+    return EXIT_FAILURE;
+  }
+
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+  thumbulator::semihosting_host host;
+  target.semihosting = &host;
+  thumbulator_tests::load_program(&target, console_program);
+
+  uint32_t const read_block[] = {SEMIHOSTING_CONSOLE_INPUT, CONSOLE_BUFFER, 2};
+  uint32_t const write_block[] = {SEMIHOSTING_CONSOLE_OUTPUT, CONSOLE_BUFFER, 2};
+  for(uint32_t i = 0; i < 3; ++i) {
+    target.ram.word(READ_BLOCK + i * 4) = read_block[i];
+    target.ram.word(WRITE_BLOCK + i * 4) = write_block[i];
+  }
+  target.uart.add_input("hey", 3);
+
+  thumbulator::run_limits limits{};
+  limits.cycles = UINT64_MAX;
+  limits.instructions = UINT64_MAX;
+  auto const run = thumbulator::run_until(limits);
+
+  // SYS_READ and SYS_WRITE return the number of bytes they did not transfer
+  auto passed = thumbulator_tests::check_value("SYS_READ", "result", 0, target.cpu.gpr[4]);
+  passed &= thumbulator_tests::check_value(
+      "SYS_READ", "buffer", 0x6568, target.ram.word(CONSOLE_BUFFER) & 0xFFFF);
+  passed &= thumbulator_tests::check_value("SYS_WRITE", "result", 0, target.cpu.gpr[7]);
+  passed &= thumbulator_tests::check_value("UART load", "byte", 'y', target.cpu.gpr[6]);
+  passed &= thumbulator_tests::check_value(
+      "UART load after the input", "byte", UART_NO_INPUT, target.cpu.gpr[2]);
+
+  passed &= thumbulator_tests::check_value("SYS_EXIT", "exited", 1, host.exited());
+  passed &= thumbulator_tests::check_value("SYS_EXIT", "reason", EXIT_REASON, host.exit_reason());
+  passed &= thumbulator_tests::check_value("SYS_EXIT", "stop", thumbulator::STOP_EXIT, run.reason);
+  passed &= thumbulator_tests::check_value("SYS_EXIT", "instructions", 16, run.instructions);
+
+  // output stays in memory until the UART has a file, then goes to the file in chunks
+  passed &= check_text("the kept output", "he!", target.uart.output());
+  target.uart.write_to(sink.get());
+  passed &= check_text("the output of write_to", "he!", contents(sink.get()));
+  target.uart.put('x');
+  passed &= check_text("the output before flush", "he!", contents(sink.get()));
+  target.uart.flush();
+  passed &= check_text("the output after flush", "he!x", contents(sink.get()));
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
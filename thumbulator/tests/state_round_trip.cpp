@@ -0,0 +1,67 @@
+#include "test_program.hpp"
+
+#include <thumbulator/machine.hpp>
+#include <thumbulator/run.hpp>
+#include <thumbulator/state_file.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace {
+
+// Instructions to run before saving the state, in the middle of the inner loop
+#define INSTRUCTIONS_BEFORE_SAVE 54321
+
+// Run the machine bound to the calling thread to the exit instruction
+thumbulator_tests::program_outcome run_to_exit(thumbulator::machine &target)
+{
+  thumbulator::run_limits limits{};
+  limits.cycles = UINT64_MAX;
+  limits.instructions = UINT64_MAX;
+  auto const run = thumbulator::run_until(limits);
+
+  return thumbulator_tests::capture_outcome(target, run.instructions, run.cycles);
+}
+}
+
+/**
+ * Saves the state of a machine in the middle of the test program, and checks that a new machine
+ * resumed from the state finishes the program like the original one.
+ */
+int main()
+{
+  std::unique_ptr<FILE, int (*)(FILE *)> state(std::tmpfile(), std::fclose);
+  if(!state) {
+    std::fprintf(stderr, "Could not create a temporary state file.\n");
+    return EXIT_FAILURE;
+  }
+
+  thumbulator_tests::program_outcome expected;
+  {
+    thumbulator::machine original;
+    thumbulator::machine_binding binding(&original);
+    thumbulator_tests::load_test_program(&original);
+
+    thumbulator::run_limits limits{};
+    limits.cycles = UINT64_MAX;
+    limits.instructions = INSTRUCTIONS_BEFORE_SAVE;
+    thumbulator::run_until(limits);
+    thumbulator::save_state(state.get());
+
+    expected = run_to_exit(original);
+  }
+
+  std::rewind(state.get());
+
+  thumbulator::machine resumed;
+  thumbulator::machine_binding binding(&resumed);
+  thumbulator::load_state(state.get());
+  auto const actual = run_to_exit(resumed);
+
+  auto passed = thumbulator_tests::check_value("resumed", "instructions",
+      TEST_PROGRAM_INSTRUCTIONS - INSTRUCTIONS_BEFORE_SAVE, actual.instructions);
+  passed &= thumbulator_tests::same_outcome("resumed", expected, actual);
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
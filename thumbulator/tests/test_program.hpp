@@ -0,0 +1,223 @@
+#ifndef THUMBULATOR_TESTS_TEST_PROGRAM_HPP
+#define THUMBULATOR_TESTS_TEST_PROGRAM_HPP
+
+#include <thumbulator/cpu.hpp>
+#include <thumbulator/machine.hpp>
+#include <thumbulator/memory.hpp>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace thumbulator_tests {
+
+/**
+ * The address of the words the test program stores to.
+ */
+#define TEST_PROGRAM_DATA (RAM_START + 0x100)
+
+/**
+ * Number of instructions the test program executes, including the exit instruction.
+ *
+ * 9 to set up, 116 for each of the 1000 iterations plus 1 in every other one, and 2 to exit.
+ */
+#define TEST_PROGRAM_INSTRUCTIONS 116511
+
+/**
+ * A raw image of a program that calls a function with an inner loop 1000 times.
+ *
+ * It mixes arithmetic, word and byte loads and stores, pushes and pops, a conditional branch taken
+ * every other iteration, and loop branches. Each iteration adds the current value of the SysTick
+ * timer, so the results depend on the cycle count at every peripheral access. The image starts
+ * with the vector table.
+ */
+uint16_t const test_program[] = {
+    0x0000, 0x4001, // initial SP: 0x40010000
+    0x0009, 0x0000, // reset vector: 0x8 in Thumb state
+    0x4E13,         // ldr r6, =TEST_PROGRAM_DATA
+    0x4F14,         // ldr r7, =1000
+    0x2000,         // movs r0, #0
+    0x2101,         // movs r1, #1
+    0x4D13,         // ldr r5, =SYSTICK_ADDRESS
+    0x4B14,         // ldr r3, =0x00FFFFFF
+    0x606B,         // str r3, [r5, #4]
+    0x2301,         // movs r3, #1
+    0x602B,         // str r3, [r5, #0]
+    0xF000, 0xF813, // loop: bl work
+    0x4D10,         // ldr r5, =SYSTICK_ADDRESS
+    0x68AB,         // ldr r3, [r5, #8]
+    0x18C0,         // adds r0, r0, r3
+    0x1840,         // adds r0, r0, r1
+    0x4041,         // eors r1, r0
+    0x00C2,         // lsls r2, r0, #3
+    0x6032,         // str r2, [r6, #0]
+    0x6833,         // ldr r3, [r6, #0]
+    0x19DB,         // adds r3, r3, r7
+    0x7173,         // strb r3, [r6, #5]
+    0x7974,         // ldrb r4, [r6, #5]
+    0x087D,         // lsrs r5, r7, #1
+    0xD200,         // bcs skip
+    0x3403,         // adds r4, #3
+    0x60B4,         // skip: str r4, [r6, #8]
+    0x3F01,         // subs r7, #1
+    0xD1EC,         // bne loop
+    0x68F2,         // ldr r2, [r6, #12]
+    0xDF01,         // exit
+    0xB5F0,         // work: push {r4-r7, lr}
+    0x2410,         // movs r4, #16
+    0x68F5,         // inner: ldr r5, [r6, #12]
+    0x192D,         // adds r5, r5, r4
+    0x60F5,         // str r5, [r6, #12]
+    0x4365,         // muls r5, r4
+    0x3C01,         // subs r4, #1
+    0xD1F9,         // bne inner
+    0xBDF0,         // pop {r4-r7, pc}
+    0x0000,         // padding
+    0x0100, 0x4000, // TEST_PROGRAM_DATA
+    0x03E8, 0x0000, // 1000
+    0xE010, 0xE000, // SYSTICK_ADDRESS
+    0xFFFF, 0x00FF  // 0x00FFFFFF
+};
+
+/**
+ * Number of instructions the self-modifying program executes, including the exit instruction.
+ */
+#define SELF_MODIFYING_PROGRAM_INSTRUCTIONS 22
+
+/**
+ * A raw image of a program that copies a function to RAM and calls it twice. The second call
+ * patches the instruction after the store, in the same block, so that r5 ends at 1 + 2 = 3.
+ */
+uint16_t const self_modifying_program[] = {
+    0x0000, 0x4001, // initial SP: 0x40010000
+    0x0009, 0x0000, // reset vector: 0x8 in Thumb state
+    0x4E06,         // ldr r6, =function
+    0x4807,         // ldr r0, =function[0]
+    0x6030,         // str r0, [r6, #0]
+    0x4807,         // ldr r0, =function[1]
+    0x6070,         // str r0, [r6, #4]
+    0x2500,         // movs r5, #0
+    0x1C77,         // adds r7, r6, #1
+    0x4C06,         // ldr r4, =TEST_PROGRAM_DATA
+    0x4B06,         // ldr r3, =0x2001
+    0x47B8,         // blx r7
+    0x1CB4,         // adds r4, r6, #2
+    0x4B06,         // ldr r3, =0x2002
+    0x47B8,         // blx r7
+    0xDF01,         // exit
+    0x0200, 0x4000, // RAM_START + 0x200, where the function goes
+    0x8023, 0x2001, // strh r3, [r4, #0]; movs r0, #1
+    0x182D, 0x4770, // adds r5, r5, r0; bx lr
+    0x0100, 0x4000, // TEST_PROGRAM_DATA
+    0x2001, 0x0000, // movs r0, #1
+    0x2002, 0x0000  // movs r0, #2
+};
+
+/**
+ * Copy a program image into FLASH and reset the CPU of the machine bound to the calling thread.
+ */
+template <size_t Halfwords>
+void load_program(thumbulator::machine *target, uint16_t const (&image)[Halfwords])
+{
+  static_assert(Halfwords % 2 == 0, "FLASH is written a word at a time");
+  for(size_t i = 0; i < Halfwords; i += 2) {
+    target->flash.word(static_cast<uint32_t>(i * 2)) =
+        image[i] | (static_cast<uint32_t>(image[i + 1]) << 16);
+  }
+
+  thumbulator::cpu_reset();
+  // PC seen is PC + 4
+  thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + 0x4);
+}
+
+/**
+ * Copy the test program into FLASH and reset the CPU of the machine bound to the calling thread.
+ */
+inline void load_test_program(thumbulator::machine *target)
+{
+  load_program(target, test_program);
+}
+
+/**
+ * What a run of the test program leaves behind, which has to be the same however it ran.
+ */
+struct program_outcome {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t cycle_count;
+  uint32_t gpr[16];
+  uint32_t apsr;
+  uint32_t data[4];
+};
+
+/**
+ * The outcome of a run of the test program on a machine.
+ *
+ * @param instructions Number of instructions the run executed.
+ * @param cycles Number of cycles the run took.
+ */
+inline program_outcome capture_outcome(
+    thumbulator::machine &target, uint64_t instructions, uint64_t cycles)
+{
+  program_outcome outcome{instructions, cycles, target.cycle_count, {}, 0, {}};
+  for(int i = 0; i < 16; ++i) {
+    outcome.gpr[i] = target.cpu.gpr[i];
+  }
+
+  // the flags are compared as the program sees them, not the way the ALU keeps them
+  auto const &cpu = target.cpu;
+  outcome.apsr = (cpu.flag_n & 0x80000000) | ((cpu.flag_z == 0 ? 1u : 0u) << 30) |
+                 ((cpu.flag_c & 0x1) << 29) | ((cpu.flag_v >> 31) << 28);
+
+  for(uint32_t i = 0; i < 4; ++i) {
+    outcome.data[i] = target.ram.word(TEST_PROGRAM_DATA + i * 4);
+  }
+
+  return outcome;
+}
+
+/**
+ * Report a value that differs from the expected one.
+ *
+ * @return Whether the values are the same.
+ */
+inline bool check_value(char const *run, char const *what, uint64_t expected, uint64_t actual)
+{
+  if(expected != actual) {
+    std::fprintf(stderr, "%s: %s is 0x%" PRIX64 " instead of 0x%" PRIX64 "\n", run, what, actual,
+        expected);
+  }
+
+  return expected == actual;
+}
+
+/**
+ * Report the differences between two outcomes of the test program.
+ *
+ * @param run The name of the run that led to actual.
+ *
+ * @return Whether the outcomes are the same.
+ */
+inline bool same_outcome(
+    char const *run, program_outcome const &expected, program_outcome const &actual)
+{
+  auto passed = check_value(run, "instructions", expected.instructions, actual.instructions);
+  passed &= check_value(run, "cycles", expected.cycles, actual.cycles);
+  passed &= check_value(run, "cycle_count", expected.cycle_count, actual.cycle_count);
+  for(int i = 0; i < 16; ++i) {
+    char name[4];
+    std::snprintf(name, sizeof(name), "r%d", i);
+    passed &= check_value(run, name, expected.gpr[i], actual.gpr[i]);
+  }
+
+  passed &= check_value(run, "APSR", expected.apsr, actual.apsr);
+  for(int i = 0; i < 4; ++i) {
+    passed &= check_value(run, "a data word", expected.data[i], actual.data[i]);
+  }
+
+  return passed;
+}
+}
+
+#endif //THUMBULATOR_TESTS_TEST_PROGRAM_HPP
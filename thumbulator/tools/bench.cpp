@@ -0,0 +1,393 @@
+#include <thumbulator/cpu.hpp>
+#include <thumbulator/decode_cache.hpp>
+#include <thumbulator/machine.hpp>
+#include <thumbulator/memory.hpp>
+#include <thumbulator/memory_policy.hpp>
+#include <thumbulator/translation.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Every run is repeated and the fastest one is kept, so that noise does not skew differences
+#define BENCH_REPETITIONS 5
+
+#define COND_EQ 0x0
+#define COND_NE 0x1
+#define COND_CS 0x2
+
+/**
+ * Writes Thumb instructions into FLASH, from the address after the vector table.
+ */
+class assembler {
+public:
+  explicit assembler(thumbulator::machine *target) : target(target), address(0x8)
+  {
+  }
+
+  uint32_t here() const
+  {
+    return address;
+  }
+
+  void emit(uint16_t insn)
+  {
+    auto &word = target->flash.word(address);
+    if((address & 0x2) != 0) {
+      word = (word & 0xFFFF) | (static_cast<uint32_t>(insn) << 16);
+    } else {
+      word = (word & 0xFFFF0000) | insn;
+    }
+
+    address += 2;
+  }
+
+  // Conditional branch to an address already emitted
+  void branch(uint32_t condition, uint32_t target_address)
+  {
+    auto const offset = static_cast<int32_t>(target_address - (address + 4)) >> 1;
+    emit(0xD000 | (condition << 8) | (offset & 0xFF));
+  }
+
+  // Conditional branch over the specified number of halfwords
+  void skip(uint32_t condition, uint32_t halfwords)
+  {
+    emit(0xD000 | (condition << 8) | ((halfwords - 1) & 0xFF));
+  }
+
+  void call(uint32_t target_address)
+  {
+    auto const offset = static_cast<int32_t>(target_address - (address + 4)) >> 1;
+    auto const s = (offset >> 23) & 0x1;
+    auto const j1 = ~((offset >> 22) ^ s) & 0x1;
+    auto const j2 = ~((offset >> 21) ^ s) & 0x1;
+    emit(0xF000 | (s << 10) | ((offset >> 11) & 0x3FF));
+    emit(0xD000 | (j1 << 13) | (j2 << 11) | (offset & 0x7FF));
+  }
+
+  // r7 = count, as count_high << shift
+  void load_counter(uint32_t count_high, uint32_t shift)
+  {
+    emit(0x2700 | count_high);
+    emit(0x003F | (shift << 6));
+  }
+
+  // r6 = RAM_START
+  void load_ram_start()
+  {
+    emit(0x2601);
+    emit(0x07B6);
+  }
+
+  // Loop back while r7 is not 0 after decrementing it
+  void loop_back(uint32_t loop)
+  {
+    emit(0x3F01);
+    branch(COND_NE, loop);
+  }
+
+  void exit()
+  {
+    emit(0xDF01);
+  }
+
+private:
+  thumbulator::machine *target;
+  uint32_t address;
+};
+
+// Arithmetic and logic on registers
+void emit_alu(assembler *code, uint32_t iterations_log2)
+{
+  code->load_counter(1, iterations_log2);
+  auto const loop = code->here();
+  code->emit(0x1840); // adds r0, r0, r1
+  code->emit(0x4041); // eors r1, r0
+  code->emit(0x00C2); // lsls r2, r0, #3
+  code->emit(0x088B); // lsrs r3, r1, #2
+  code->emit(0x431A); // orrs r2, r3
+  code->emit(0x4353); // muls r3, r2
+  code->emit(0x4004); // ands r4, r0
+  code->emit(0x3501); // adds r5, #1
+  code->loop_back(loop);
+  code->exit();
+}
+
+// Word and byte loads and stores to RAM
+void emit_load_store(assembler *code, uint32_t iterations_log2)
+{
+  code->load_ram_start();
+  code->load_counter(1, iterations_log2);
+  auto const loop = code->here();
+  code->emit(0x6830); // ldr r0, [r6, #0]
+  code->emit(0x3001); // adds r0, #1
+  code->emit(0x6030); // str r0, [r6, #0]
+  code->emit(0x6871); // ldr r1, [r6, #4]
+  code->emit(0x60B1); // str r1, [r6, #8]
+  code->emit(0x7872); // ldrb r2, [r6, #1]
+  code->emit(0x7332); // strb r2, [r6, #12]
+  code->loop_back(loop);
+  code->exit();
+}
+
+// Conditional branches, taken and not taken in turns
+void emit_branchy(assembler *code, uint32_t iterations_log2)
+{
+  code->load_counter(1, iterations_log2);
+  auto const loop = code->here();
+  code->emit(0x0878); // lsrs r0, r7, #1
+  code->skip(COND_CS, 1);
+  code->emit(0x3101); // adds r1, #1
+  code->emit(0x2F03); // cmp r7, #3
+  code->skip(COND_EQ, 1);
+  code->emit(0x3201); // adds r2, #1
+  code->emit(0x08B8); // lsrs r0, r7, #2
+  code->skip(COND_CS, 1);
+  code->emit(0x3301); // adds r3, #1
+  code->loop_back(loop);
+  code->exit();
+}
+
+// Calls to a function that saves and restores registers on the stack
+void emit_push_pop(assembler *code, uint32_t iterations_log2)
+{
+  code->load_counter(1, iterations_log2);
+  // b over the function
+  code->emit(0xE003);
+  auto const function = code->here();
+  code->emit(0xB5F0); // push {r4-r7, lr}
+  code->emit(0x2401); // movs r4, #1
+  code->emit(0xBDF0); // pop {r4-r7, pc}
+  code->emit(0xBF00); // nop
+  auto const loop = code->here();
+  code->call(function);
+  code->loop_back(loop);
+  code->exit();
+}
+
+/**
+ * A memory policy that only counts the accesses it sees.
+ */
+struct counting_policy {
+  uint64_t loads = 0;
+  uint64_t stores = 0;
+
+  uint32_t ram_load(uint32_t /* address */, uint32_t data)
+  {
+    ++loads;
+    return data;
+  }
+
+  uint32_t ram_store(uint32_t /* address */, uint32_t /* old_value */, uint32_t value)
+  {
+    ++stores;
+    return value;
+  }
+};
+
+enum class execution_mode { step, block };
+
+char const *mode_name(execution_mode mode)
+{
+  return mode == execution_mode::step ? "step" : "block";
+}
+
+struct workload {
+  char const *name;
+  void (*emit)(assembler *, uint32_t);
+  bool hooked;
+};
+
+struct measurement {
+  uint64_t instructions;
+  uint64_t cycles;
+  double seconds;
+  uint64_t hook_calls;
+
+  /**
+   * Time the memory policy added over the same run without it, negative if it was faster.
+   */
+  double hook_seconds;
+};
+
+measurement run_workload(workload const &load, execution_mode mode, uint32_t iterations_log2)
+{
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+
+  counting_policy policy;
+  if(load.hooked) {
+    thumbulator::use_memory_policy(&target, &policy);
+  }
+
+  // initial stack pointer and reset vector
+  target.flash.word(0x0) = RAM_START + target.ram.size_bytes();
+  target.flash.word(0x4) = 0x8 | 0x1;
+  assembler code(&target);
+  load.emit(&code, iterations_log2);
+
+  thumbulator::cpu_reset();
+  // PC seen is PC + 4
+  thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + 0x4);
+
+  measurement result{};
+  auto const start = std::chrono::steady_clock::now();
+  if(mode == execution_mode::step) {
+    while(!target.exit_instruction_encountered) {
+      target.branch_was_taken = false;
+      auto const *instruction = thumbulator::fetch_decoded(thumbulator::cpu_get_pc() - 0x4);
+      result.cycles += thumbulator::exmemwb(instruction);
+      thumbulator::cpu_set_pc(thumbulator::cpu_get_pc() + (target.branch_was_taken ? 0x4 : 0x2));
+      ++result.instructions;
+    }
+  } else {
+    while(!target.exit_instruction_encountered) {
+      auto const block = thumbulator::execute_block();
+      result.instructions += block.instructions;
+      result.cycles += block.cycles;
+    }
+  }
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.hook_calls = policy.loads + policy.stores;
+
+  return result;
+}
+
+// The fastest of BENCH_REPETITIONS runs of a workload, and of its runs without memory policy
+measurement best_run(workload const &load, execution_mode mode, uint32_t iterations_log2)
+{
+  auto const unhooked = workload{load.name, load.emit, false};
+  measurement best{};
+  double best_unhooked = 0;
+  for(int i = 0; i < BENCH_REPETITIONS; ++i) {
+    auto const result = run_workload(load, mode, iterations_log2);
+    if(i == 0 || result.seconds < best.seconds) {
+      best = result;
+    }
+
+    // runs with and without the policy take turns, so that both see the same load of the host
+    if(load.hooked) {
+      auto const seconds = run_workload(unhooked, mode, iterations_log2).seconds;
+      if(i == 0 || seconds < best_unhooked) {
+        best_unhooked = seconds;
+      }
+    }
+  }
+
+  best.hook_seconds = load.hooked ? best.seconds - best_unhooked : 0;
+
+  return best;
+}
+
+// Time the type-erased hooks used by accesses outside of the memory instructions
+double time_hook(bool stores, uint64_t calls)
+{
+  thumbulator::machine target;
+  thumbulator::machine_binding binding(&target);
+
+  counting_policy policy;
+  thumbulator::use_memory_policy(&target, &policy);
+
+  uint32_t value = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for(uint64_t i = 0; i < calls; ++i) {
+    auto const address = RAM_START + ((i & 0xFF) << 2);
+    if(stores) {
+      thumbulator::store(address, static_cast<uint32_t>(i));
+    } else {
+      thumbulator::load(address, &value, 0);
+    }
+  }
+  auto const seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if(policy.loads + policy.stores != calls) {
+    throw std::runtime_error("The memory policy missed accesses.");
+  }
+
+  return seconds;
+}
+
+void print_usage(FILE *out, char const *program)
+{
+  std::fprintf(out, "Usage: %s [ITERATIONS_LOG2]\n", program);
+}
+}
+
+/**
+ * Measure the speed of the simulator on synthetic instruction streams.
+ *
+ * thumbulator-bench [ITERATIONS_LOG2]
+ *
+ * Every workload loops 2^ITERATIONS_LOG2 times, 2^20 by default, in each execution mode:
+ *
+ * step    fetch_decoded and exmemwb for every instruction, without translated blocks
+ * block   execute_block
+ *
+ * The results are printed as CSV, for the fastest of BENCH_REPETITIONS runs. The hooked workload
+ * is load_store with a memory policy that counts the accesses. Its ns_per_hook_call is the time
+ * the policy adds over the fastest of the same number of runs without it, taken in turns with
+ * the hooked ones, per hook call. It is negative if the hooked run was faster. The ram_load_hook
+ * and ram_store_hook rows time the type-erased hooks on their own, through load and store.
+ */
+int main(int argc, char *argv[])
+{
+  if(argc > 2) {
+    print_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if(argc == 2 && (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0)) {
+    print_usage(stdout, argv[0]);
+    return EXIT_SUCCESS;
+  }
+
+  auto const iterations_log2 = argc == 2 ? std::strtoul(argv[1], nullptr, 10) : 20;
+  if(iterations_log2 < 1 || iterations_log2 > 31) {
+    std::fprintf(stderr, "Error: ITERATIONS_LOG2 must be between 1 and 31.\n");
+    return EXIT_FAILURE;
+  }
+
+  workload const workloads[] = {{"alu", emit_alu, false}, {"load_store", emit_load_store, false},
+      {"branchy", emit_branchy, false}, {"push_pop", emit_push_pop, false},
+      {"hooked", emit_load_store, true}};
+  execution_mode const modes[] = {execution_mode::step, execution_mode::block};
+
+  try {
+    std::printf("workload,mode,instructions,cycles,seconds,mips,ns_per_instruction,hook_calls,"
+                "ns_per_hook_call\n");
+
+    for(auto const mode : modes) {
+      for(auto const &load : workloads) {
+        auto const result = best_run(load, mode, static_cast<uint32_t>(iterations_log2));
+        auto const hook_ns =
+            result.hook_calls == 0 ? 0.0 : result.hook_seconds * 1e9 / result.hook_calls;
+        std::printf("%s,%s,%" PRIu64 ",%" PRIu64 ",%.6f,%.2f,%.3f,%" PRIu64 ",%.3f\n", load.name,
+            mode_name(mode), result.instructions, result.cycles, result.seconds,
+            result.instructions / result.seconds / 1e6, result.seconds * 1e9 / result.instructions,
+            result.hook_calls, hook_ns);
+      }
+    }
+
+    uint64_t const calls = uint64_t{1} << (iterations_log2 + 3);
+    for(auto const stores : {false, true}) {
+      auto seconds = time_hook(stores, calls);
+      for(int i = 1; i < BENCH_REPETITIONS; ++i) {
+        seconds = std::min(seconds, time_hook(stores, calls));
+      }
+      std::printf("%s,direct,0,0,%.6f,0.00,0.000,%" PRIu64 ",%.3f\n",
+          stores ? "ram_store_hook" : "ram_load_hook", seconds, calls, seconds * 1e9 / calls);
+    }
+  } catch(std::exception const &e) {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
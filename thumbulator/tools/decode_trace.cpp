@@ -0,0 +1,84 @@
+#include <thumbulator/disassemble.hpp>
+#include <thumbulator/program.hpp>
+#include <thumbulator/tracer.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Render a binary instruction trace as text.
+ *
+ * thumbulator-decode-trace TRACE [BINARY]
+ *
+ * With the program binary, instructions are also labeled with the function they belong to.
+ */
+int main(int argc, char *argv[])
+{
+  if(argc < 2 || argc > 3) {
+    std::fprintf(stderr, "Usage: %s TRACE [BINARY]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::unique_ptr<thumbulator::program_image> program;
+    if(argc == 3) {
+      program.reset(new thumbulator::program_image(argv[2]));
+    }
+
+    auto *trace = std::fopen(argv[1], "rb");
+    if(trace == nullptr) {
+      throw std::runtime_error("Could not open trace file.");
+    }
+
+    thumbulator::trace_file_header header;
+    if(std::fread(&header, sizeof(header), 1, trace) != 1 ||
+        std::memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_FILE_VERSION ||
+        header.record_bytes != sizeof(thumbulator::trace_record)) {
+      std::fclose(trace);
+      throw std::runtime_error("Not a trace file of this version.");
+    }
+
+    thumbulator::trace_record record;
+    while(std::fread(&record, sizeof(record), 1, trace) == 1) {
+      char opcode[16];
+      if(thumbulator::is_32bit_instruction(static_cast<uint16_t>(record.opcode))) {
+        std::snprintf(opcode, sizeof(opcode), "%04X %04X", record.opcode & 0xFFFF,
+            record.opcode >> 16);
+      } else {
+        std::snprintf(opcode, sizeof(opcode), "%04X", record.opcode);
+      }
+
+      std::string location;
+      auto const *symbol = program ? program->find_symbol(record.pc) : nullptr;
+      if(symbol != nullptr) {
+        char offset[16];
+        std::snprintf(offset, sizeof(offset), "+0x%X", record.pc - symbol->address);
+        location = "<" + symbol->name + offset + ">";
+      }
+
+      std::printf("%12" PRIu64 " %2u  %08X %-9s  %-36s", record.cycle, record.cycles, record.pc,
+          opcode, thumbulator::disassemble(record.pc, record.opcode).c_str());
+
+      if((record.flags & TRACE_LOAD) != 0) {
+        std::printf("  load  [%08X] = %08X", record.address, record.value);
+      } else if((record.flags & TRACE_STORE) != 0) {
+        std::printf("  store [%08X] = %08X", record.address, record.value);
+      }
+
+      std::printf(location.empty() ? "\n" : "  %s\n", location.c_str());
+    }
+
+    std::fclose(trace);
+  } catch(std::exception const &e) {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}